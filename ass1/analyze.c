@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+
+/* Output a worker gathers before taking the lock to write it out. */
+#define OUT_BUFFER 65536
+
+/*
+ * Longest line written for one save, file name aside: the fixed columns,
+ * then for each of up to 100 players a score of up to 20 digits with its
+ * separator and a winner letter.
+ */
+#define LINE_EXTRA (256 + 100 * 22)
+
+struct analyzer;
+
+/*
+ * One thread of the pool. Its board is reset for each save rather than
+ * freed, so once it has seen the biggest board in the directory loading
+ * stops allocating. Finished lines collect in out.
+ */
+struct worker {
+    pthread_t thread;
+    struct analyzer *a;
+    struct game g;
+    char path[PATH_MAX];
+    char *out;
+    size_t out_len;
+    long done;
+    long failed;
+};
+
+/*
+ * Everything about a run. Saves are handed out by bumping next, and lines
+ * go to stdout under lock in whatever order they finish. players is 0 if
+ * it is to be worked out for each save.
+ */
+struct analyzer {
+    char const *dir;
+    char **names;
+    long count;
+    long next;
+    int players;
+    int num_workers;
+    struct worker *workers;
+    pthread_mutex_t lock;
+};
+
+void usage(void);
+void list_saves(struct analyzer *a);
+void analyze_save(struct worker *w, char const *name);
+void *run_worker(void *arg);
+
+int
+main(int argc, char **argv)
+{
+    struct analyzer a;
+    struct timespec start, stop;
+    long done = 0, failed = 0, i;
+    double secs;
+    char *err;
+    int opt;
+
+    memset(&a, 0, sizeof(a));
+    a.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_mutex_init(&a.lock, NULL);
+
+    while ((opt = getopt(argc, argv, "j:p:")) != -1) {
+        switch (opt) {
+            case 'j':
+                a.num_workers = strtol(optarg, &err, 10);
+                if (*err != '\0' || a.num_workers < 1) {
+                    usage();
+                }
+                break;
+            case 'p':
+                a.players = strtol(optarg, &err, 10);
+                if (*err != '\0' || a.players < 2 || a.players > 100) {
+                    fprintf(stderr, "Invalid player count\n");
+                    exit(3);
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (argc - optind != 1) {
+        usage();
+    }
+    a.dir = argv[optind];
+    list_saves(&a);
+
+    printf("file,status,height,width,to_move,free_edges,boxes_left,scores,"
+            "decided\n");
+    fflush(stdout);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    a.workers = calloc(a.num_workers, sizeof(struct worker));
+    for (i = 0; i < a.num_workers; ++i) {
+        a.workers[i].a = &a;
+        a.workers[i].out = malloc(OUT_BUFFER);
+        pthread_create(&a.workers[i].thread, NULL, run_worker,
+                &a.workers[i]);
+    }
+    for (i = 0; i < a.num_workers; ++i) {
+        pthread_join(a.workers[i].thread, NULL);
+        done += a.workers[i].done;
+        failed += a.workers[i].failed;
+        free_grid(&a.workers[i].g);
+        free(a.workers[i].out);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Analyzed %ld saves (%ld failed) in %.3fs, "
+            "%.0f saves/sec\n", done, failed, secs,
+            secs > 0 ? done / secs : 0.0);
+
+    for (i = 0; i < a.count; ++i) {
+        free(a.names[i]);
+    }
+    free(a.names);
+    free(a.workers);
+
+    return 0;
+}
+
+/*
+ * Print the usage message and exit.
+ */
+void
+usage(void)
+{
+    fprintf(stderr, "Usage: boxes-analyze [-j threads] [-p playercount] "
+            "directory\n");
+    exit(1);
+}
+
+/*
+ * Fill in the names of the saves in a's directory: everything in it except
+ * hidden files and subdirectories.
+ */
+void
+list_saves(struct analyzer *a)
+{
+    struct dirent *e;
+    long cap = 1024;
+    DIR *d;
+
+    if ((d = opendir(a->dir)) == NULL) {
+        fprintf(stderr, "Can not open directory\n");
+        exit(2);
+    }
+
+    a->names = malloc(cap * sizeof(char *));
+    while ((e = readdir(d)) != NULL) {
+        if (e->d_name[0] == '.' || e->d_type == DT_DIR) {
+            continue;
+        }
+        if (a->count == cap) {
+            cap *= 2;
+            a->names = realloc(a->names, cap * sizeof(char *));
+        }
+        a->names[a->count++] = strdup(e->d_name);
+    }
+    closedir(d);
+}
+
+/*
+ * Write name to out as a CSV field, quoted if it needs to be. Returns the
+ * number of bytes written, which is at most twice the length plus 2.
+ */
+static size_t
+csv_field(char *out, char const *name)
+{
+    size_t n = 0;
+
+    if (strpbrk(name, ",\"\n") == NULL) {
+        n = strlen(name);
+        memcpy(out, name, n);
+        return n;
+    }
+
+    out[n++] = '"';
+    for (; *name != '\0'; ++name) {
+        if (*name == '"') {
+            out[n++] = '"';
+        }
+        out[n++] = *name;
+    }
+    out[n++] = '"';
+
+    return n;
+}
+
+/*
+ * Hand what w has gathered to stdout in one go.
+ */
+static void
+flush_worker(struct worker *w)
+{
+    pthread_mutex_lock(&w->a->lock);
+    fwrite(w->out, 1, w->out_len, stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&w->a->lock);
+    w->out_len = 0;
+}
+
+/*
+ * Write the columns after the name for the position loaded into g to out,
+ * showing the scores of the first players players. The position is
+ * decided if the leader can't be caught with the boxes that are left, and
+ * the last column then names the winner, or everybody tied once the board
+ * is full. Returns the number of bytes written.
+ */
+static size_t
+format_position(char *out, int players, struct game *g)
+{
+    long left = g->possible_closures - g->close_count, best = -1, second = -1;
+    size_t n;
+    int i;
+
+    n = sprintf(out, ",ok,%d,%d,%c,%ld,%ld,", g->height, g->width,
+            g->current_player + 'A', edge_count(g) - filled_edges(g), left);
+
+    for (i = 0; i < players; ++i) {
+        n += sprintf(out + n, "%s%ld", i ? ":" : "", g->scores[i]);
+        if (g->scores[i] > best) {
+            second = best;
+            best = g->scores[i];
+        } else if (g->scores[i] > second) {
+            second = g->scores[i];
+        }
+    }
+
+    out[n++] = ',';
+    if (left == 0 || best > second + left) {
+        for (i = 0; i < players; ++i) {
+            if (g->scores[i] == best) {
+                out[n++] = 'A' + i;
+            }
+        }
+    }
+    out[n++] = '\n';
+
+    return n;
+}
+
+/*
+ * Load the save name from the directory onto w's board and add its line
+ * to w's output. The file is mapped rather than read.
+ *
+ * Unless a player count was given, binary saves say how many players
+ * there are, and for text ones the board is loaded as if there were as
+ * many as there could be and then shown with as many as it needs.
+ */
+void
+analyze_save(struct worker *w, char const *name)
+{
+    struct game *g = &w->g;
+    struct stat st;
+    char *data = MAP_FAILED, *out;
+    int fd, height, width, players, status = LOAD_OPEN, i;
+
+    if (w->out_len + 2 * strlen(name) + LINE_EXTRA > OUT_BUFFER) {
+        flush_worker(w);
+    }
+    out = w->out + w->out_len;
+    out += csv_field(out, name);
+
+    snprintf(w->path, sizeof(w->path), "%s/%s", w->a->dir, name);
+    if ((fd = open(w->path, O_RDONLY)) >= 0 && fstat(fd, &st) == 0 &&
+            S_ISREG(st.st_mode)) {
+        status = LOAD_CONTENTS;
+        if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ,
+                MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    if (data != MAP_FAILED &&
+            !save_dimensions(data, st.st_size, &height, &width, &players) &&
+            (players = w->a->players ? w->a->players :
+            players ? players : 100) <= 100) {
+        g->num_players = players;
+        reset_grid(height, width, g);
+        status = read_grid_data(data, st.st_size, g);
+    }
+    if (data != MAP_FAILED) {
+        munmap(data, st.st_size);
+    }
+
+    if (status != LOAD_OK) {
+        out += sprintf(out, ",%s,,,,,,,\n", load_message(status));
+        w->failed++;
+    } else {
+        if (players == 100 && w->a->players == 0) {
+            for (players = 2, i = 2; i < 100; ++i) {
+                if (g->scores[i] > 0 || g->current_player == i) {
+                    players = i + 1;
+                }
+            }
+        }
+        out += format_position(out, players, g);
+    }
+
+    w->out_len = out - w->out;
+    w->done++;
+}
+
+/*
+ * Thread body: analyze saves until there are none left.
+ */
+void *
+run_worker(void *arg)
+{
+    struct worker *w = arg;
+    long i;
+
+    while ((i = __sync_fetch_and_add(&w->a->next, 1)) < w->a->count) {
+        analyze_save(w, w->a->names[i]);
+    }
+    flush_worker(w);
+
+    return NULL;
+}
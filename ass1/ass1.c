@@ -1,55 +1,178 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
-
-struct game {
-    char **grid;
-    int width;
-    int height;
-    int current_player;
-    int num_players;
-    int close_count;
-    int possible_closures;
-    int scores[100];
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "book.h"
+#include "chains.h"
+#include "durable.h"
+#include "engine.h"
+#include "journal.h"
+#include "mcts.h"
+#include "nimstring.h"
+#include "perft.h"
+#include "profile.h"
+#include "replay.h"
+#include "server.h"
+#include "solver.h"
+
+/* Longest move typed at the prompt, "100000 100000 v". */
+#define MOVE_LENGTH 15
+
+/* What try_move managed to do. */
+enum move_status {
+    MOVE_MADE,
+    MOVE_RETRY,
+    MOVE_EOF,
 };
 
-void print_grid(FILE *f, struct game *g);
-void allocate_empty_grid(struct game *g);
-int place_horizontal_edge(int x, int y, struct game *g);
-int place_verticle_edge(int x, int y, struct game *g);
-void check_closures(int x, int y, struct game *g);
-void check_single_closure(int x_mid, int y_mid, struct game *g);
-int try_move(struct game *g);
-int process_move(char *m, struct game *g);
-void read_path_and_save(struct game *g);
-void save_game(FILE *f, struct game *g);
-void pick_winner(struct game *g);
-void read_edges(FILE *f, int n, struct game *g);
-void read_grid_file(char *path, struct game *g);
-int read_num_until(FILE *f, char delim, struct game *g);
-void read_filled(FILE *f, struct game *g);
-int check_game_over(struct game *g);
+enum move_status try_move(FILE *in, FILE *out, struct journal *j,
+        struct game *g);
+int process_move(char *m, struct journal *j, struct game *g);
+void read_path_and_save(FILE *in, struct game *g, int binary);
+void pick_winner(FILE *f, struct game *g);
+void run_batch(char *path, int threads, struct view *v, struct game *g);
+void usage(void);
+void run_solve(double budget, struct game *g);
+void run_nimstring(double budget, char const *memo_path, struct game *g);
+void run_perft(int depth, int threads, struct game *g);
+void computer_move(double think, int threads, struct book const *book,
+        struct journal *j, struct game *g);
+void load_or_exit(char const *path, struct game *g);
+void start_profile(char const *json_path);
 
 int
 main(int argc, char **argv)
 {
-    char *err;
+    char *err, *batch = NULL, *solve_path = NULL, *serve_path = NULL;
+    char *chains_path = NULL, *nim_path = NULL, *memo_path = NULL;
+    char *book_path = NULL, *profile_path = NULL, *profile_env;
+    char *ai = "";
+    char *journal_path = NULL, extra;
     struct game g = { 0 };
-    long w, h, p;
+    struct view view = { RENDER_FULL, 0, 0, 0, 0 };
+    enum move_status status;
+    struct journal history;
+    struct durable store;
+    struct book book = { 0 };
+    double budget = 10, think = 1;
+    long w, h, p, workers = 0, every = 1000, depth = -1, before, i;
+    int engine = -1;
+
+    /* Options come first, each one followed by its value. */
+    while (argc > 2 && strncmp(argv[1], "--", 2) == 0) {
+        if (strcmp(argv[1], "--batch") == 0) {
+            batch = argv[2];
+        } else if (strcmp(argv[1], "--solve") == 0) {
+            solve_path = argv[2];
+        } else if (strcmp(argv[1], "--chains") == 0) {
+            chains_path = argv[2];
+        } else if (strcmp(argv[1], "--nimstring") == 0) {
+            nim_path = argv[2];
+        } else if (strcmp(argv[1], "--memo") == 0) {
+            memo_path = argv[2];
+        } else if (strcmp(argv[1], "--serve") == 0) {
+            serve_path = argv[2];
+        } else if (strcmp(argv[1], "--perft") == 0) {
+            depth = strtol(argv[2], &err, 10);
+            if (*err != '\0' || depth < 0 || depth > INT_MAX) {
+                usage();
+            }
+        } else if (strcmp(argv[1], "--workers") == 0) {
+            workers = strtol(argv[2], &err, 10);
+            if (*err != '\0' || workers < 1 || workers > 1024) {
+                usage();
+            }
+        } else if (strcmp(argv[1], "--ai") == 0) {
+            ai = argv[2];
+        } else if (strcmp(argv[1], "--profile") == 0) {
+            profile_path = argv[2];
+        } else if (strcmp(argv[1], "--book") == 0) {
+            book_path = argv[2];
+        } else if (strcmp(argv[1], "--think") == 0) {
+            think = strtod(argv[2], &err);
+            if (*err != '\0' || think <= 0) {
+                usage();
+            }
+        } else if (strcmp(argv[1], "--journal") == 0) {
+            journal_path = argv[2];
+        } else if (strcmp(argv[1], "--snapshot-every") == 0) {
+            every = strtol(argv[2], &err, 10);
+            if (*err != '\0' || every < 1) {
+                usage();
+            }
+        } else if (strcmp(argv[1], "--budget") == 0) {
+            budget = strtod(argv[2], &err);
+            if (*err != '\0' || budget <= 0) {
+                usage();
+            }
+        } else if (strcmp(argv[1], "--engine") == 0 &&
+                strcmp(argv[2], "text") == 0) {
+            engine = ENGINE_TEXT;
+        } else if (strcmp(argv[1], "--engine") == 0 &&
+                strcmp(argv[2], "binary") == 0) {
+            engine = ENGINE_BINARY;
+        } else if (strcmp(argv[1], "--render") == 0 &&
+                strcmp(argv[2], "full") == 0) {
+            view.mode = RENDER_FULL;
+        } else if (strcmp(argv[1], "--render") == 0 &&
+                strcmp(argv[2], "delta") == 0) {
+            view.mode = RENDER_DELTA;
+        } else if (strcmp(argv[1], "--render") == 0 &&
+                strcmp(argv[2], "summary") == 0) {
+            view.mode = RENDER_SUMMARY;
+        } else if (strcmp(argv[1], "--view") != 0 ||
+                sscanf(argv[2], "%d,%d,%d,%d%c", &view.x, &view.y,
+                &view.width, &view.height, &extra) != 4 ||
+                view.x < 0 || view.y < 0 || view.width < 1 ||
+                view.height < 1) {
+            usage();
+        }
+        argc -= 2;
+        argv += 2;
+    }
+
+    /* BOXES_PROFILE=0 or empty is the same as not setting it. */
+    profile_env = getenv("BOXES_PROFILE");
+    if (profile_path != NULL || (profile_env != NULL &&
+            *profile_env != '\0' && strcmp(profile_env, "0") != 0)) {
+        start_profile(profile_path);
+    }
 
-    if (argc != 4 && argc != 5) {
-        fprintf(stderr, "Usage: boxes height width playercount [filename]\n");
-        exit(1);
+    if (serve_path != NULL) {
+        if (argc != 1) {
+            usage();
+        }
+        serve(serve_path, workers ? workers : 1);
+    }
+
+    if ((argc != 4 &&
+            (argc != 5 || solve_path != NULL || chains_path != NULL ||
+            nim_path != NULL)) ||
+            (journal_path != NULL && (batch != NULL || solve_path != NULL ||
+            chains_path != NULL || nim_path != NULL || depth >= 0)) ||
+            (engine >= 0 && (journal_path != NULL || batch != NULL ||
+            *ai != '\0' || solve_path != NULL || chains_path != NULL ||
+            nim_path != NULL || depth >= 0))) {
+        usage();
     }
 
     h = strtol(argv[1], &err, 10);
-    if (*err != '\0' || h < 2 || h > 999) {
+    if (*err != '\0' || h < 2 || h > MAX_DIM) {
         fprintf(stderr, "Invalid grid dimensions\n");
         exit(2);
     }
 
     w = strtol(argv[2], &err, 10);
-    if (*err != '\0' || w < 2 || w > 999) {
+    if (*err != '\0' || w < 2 || w > MAX_DIM) {
         fprintf(stderr, "Invalid grid dimensions\n");
         exit(2);
     }
@@ -60,6 +183,24 @@ main(int argc, char **argv)
         exit(3);
     }
 
+    for (i = 0; ai[i] != '\0'; ++i) {
+        if (ai[i] < 'A' || ai[i] >= 'A' + p) {
+            usage();
+        }
+    }
+    if (*ai != '\0' && (long)h * w * 2 + h + w > MCTS_MAX_EDGES) {
+        fprintf(stderr, "Board too large to solve\n");
+        exit(8);
+    }
+    /* Only the computer players use every core unless told otherwise. */
+    if (workers == 0) {
+        workers = *ai != '\0' ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+    }
+    if (book_path != NULL && book_open(&book, book_path)) {
+        fprintf(stderr, "Invalid opening book\n");
+        exit(17);
+    }
+
     g.width = w;
     g.height = h;
     g.num_players = p;
@@ -67,269 +208,482 @@ main(int argc, char **argv)
 
     allocate_empty_grid(&g);
 
-    if (argc == 5) {
-        read_grid_file(argv[4], &g);
+    /* With a journal the save might be superseded by a snapshot. */
+    if (argc == 5 && journal_path == NULL) {
+        load_or_exit(argv[4], &g);
+    }
+
+    if (chains_path != NULL) {
+        load_or_exit(chains_path, &g);
+        print_chains(stdout, &g);
+        return 0;
+    }
+
+    if (nim_path != NULL) {
+        load_or_exit(nim_path, &g);
+        run_nimstring(budget, memo_path, &g);
+        return 0;
+    }
+
+    if (solve_path != NULL) {
+        load_or_exit(solve_path, &g);
+        run_solve(budget, &g);
+        return 0;
+    }
+
+    if (depth >= 0) {
+        run_perft(depth, workers, &g);
+        return 0;
+    }
+
+    if (batch != NULL) {
+        run_batch(batch, workers, &view, &g);
+        return 0;
+    }
+
+    if (engine >= 0) {
+        run_engine(engine, stdin, stdout, &g);
+        return 0;
+    }
+
+    journal_init(&history, 0);
+    if (journal_path != NULL) {
+        durable_open(&store, journal_path, every, argc == 5 ? argv[4] : NULL,
+                &history, &g);
     }
 
     while (1) {
-        print_grid(stdout, &g);
-        if (g.close_count == g.possible_closures) {
-            pick_winner(&g);
+        print_view(stdout, &view, &g);
+        if (check_game_over(&g)) {
+            if (journal_path != NULL) {
+                durable_sync(&store);
+            }
+            pick_winner(stdout, &g);
+            return 0;
+        }
+
+        before = history.count;
+        if (strchr(ai, g.current_player + 'A') != NULL) {
+            computer_move(think, workers, &book, &history, &g);
+            status = MOVE_MADE;
+        } else {
+            while ((status = try_move(stdin, stdout, &history, &g)) ==
+                    MOVE_RETRY);
+        }
+        if (status == MOVE_EOF) {
+            if (journal_path != NULL) {
+                durable_sync(&store);
+            }
+            fprintf(stderr, "End of user input\n");
+            exit(6);
+        }
+
+        if (journal_path != NULL) {
+            durable_note(&store, before, &history, &g);
         }
-        while (try_move(&g));
-        g.current_player = (g.current_player + 1) % g.num_players;
     }
+}
 
-    return 0;
+/*
+ * Print the usage message and exit.
+ */
+void
+usage(void)
+{
+    fprintf(stderr, "Usage: boxes height width playercount [filename]\n"
+            "       boxes [--batch movefile [--workers threads]] "
+            "[--render full|delta|summary] [--view x,y,w,h] "
+            "height width playercount [filename]\n"
+            "       boxes --engine text|binary "
+            "height width playercount [filename]\n"
+            "       boxes --journal path [--snapshot-every moves] "
+            "height width playercount [filename]\n"
+            "       boxes --ai players [--think seconds] [--workers threads] "
+            "[--book path] height width playercount [filename]\n"
+            "       boxes --solve savefile [--budget seconds] "
+            "height width playercount\n"
+            "       boxes --chains savefile height width playercount\n"
+            "       boxes --nimstring savefile [--memo path] "
+            "[--budget seconds] height width playercount\n"
+            "       boxes --perft depth [--workers threads] "
+            "height width playercount [filename]\n"
+            "       boxes --serve socketpath [--workers threads]\n"
+            "Any of these can also take --profile jsonpath.\n");
+    exit(1);
 }
 
 /*
- * Pick the winners from g.
- *
- * Does not return - it is assumed if this is called the game is over.
+ * Solve the position in g, spending at most budget seconds, and report the
+ * result and how the search went.
  */
 void
-pick_winner(struct game *g)
+run_solve(double budget, struct game *g)
 {
-    int max = 0, ind = 0, i;
+    struct solve_result res;
+    int x, y, vertical;
 
-    for (i = 0; i < g->num_players; ++i) {
-        if (g->scores[i] > max) {
-            max = g->scores[i];
-            ind = i;
-        }
+    if (solve(g, budget, &res)) {
+        fprintf(stderr, "Board too large to solve\n");
+        exit(8);
     }
 
-    /* ind is the first occurance of the winner, start there. */
-    printf("Winner(s): %c", ind + 'A');
-    for (++ind; ind < g->num_players; ++ind) {
-        if (g->scores[ind] == max) {
-            printf(", %c", ind + 'A');
-        }
+    printf("Side to move: %c\n", g->current_player + 'A');
+    if (res.exact) {
+        printf("Score margin: %+d (exact)\n", res.score);
+    } else {
+        printf("Score margin: %+d (to depth %d, out of time)\n", res.score,
+                res.depth);
+    }
+
+    if (res.best_move < 0) {
+        printf("Best move: none\n");
+    } else {
+        edge_coords(res.best_move, &x, &y, &vertical, g);
+        printf("Best move: %d %d %c\n", y, x, vertical ? 'v' : 'h');
     }
-    printf("\n");
 
-    exit(0);
+    printf("Nodes: %ld in %.3fs (%.0f nodes/sec)\n", res.nodes, res.seconds,
+            res.seconds > 0 ? res.nodes / res.seconds : 0.0);
+    printf("TT hits: %ld of %ld probes (%.1f%%)\n", res.tt_hits,
+            res.tt_probes,
+            res.tt_probes ? 100.0 * res.tt_hits / res.tt_probes : 0.0);
 }
 
 /*
- * Fill in the edge at position (x,y) if it is in the grid.
- *
- * If it is not in the grid return 1, otherwise 0.
+ * Value the position in g as nimstring, spending at most budget seconds and
+ * keeping component values in the memo at memo_path (if given), and report
+ * each component's value and who wins.
  */
-int
-place_verticle_edge(int x, int y, struct game *g)
+void
+run_nimstring(double budget, char const *memo_path, struct game *g)
 {
-    /* Vertical lines can't be at y == height. */
-    if (x < 0 || x > g->width || y < 0 || y >= g->height ||
-            g->grid[2 * y + 1][2 * x] != ' ') {
-        return 1;
+    struct nim_result res;
+    struct nim_memo memo;
+    long i;
+
+    nim_memo_open(&memo, memo_path);
+    if (nimstring(g, budget, &memo, &res)) {
+        fprintf(stderr, "Board too large to solve\n");
+        exit(8);
+    }
+
+    printf("Side to move: %c\n", g->current_player + 'A');
+    for (i = 0; i < res.count; ++i) {
+        printf("Component %ld: %ld strings, ", i + 1,
+                res.components[i].strings);
+        if (res.components[i].value == NIM_LOONY) {
+            printf("loony\n");
+        } else if (res.components[i].value == NIM_UNKNOWN) {
+            printf("unknown\n");
+        } else {
+            printf("*%d\n", res.components[i].value);
+        }
     }
 
-    g->grid[2 * y + 1][2 * x] = '|';
+    if (res.loony) {
+        printf("Nimstring: side to move wins (loony)\n");
+    } else if (!res.decided) {
+        printf("Nimstring: unknown\n");
+    } else {
+        printf("Nimstring: *%u, side to move %s\n", res.value,
+                res.value ? "wins" : "loses");
+    }
 
-    check_closures(x, y, g);
+    printf("Nodes: %ld in %.3fs\n", res.nodes, res.seconds);
+    printf("Memo hits: %ld of %ld probes (%.1f%%)\n", res.hits, res.probes,
+            res.probes ? 100.0 * res.hits / res.probes : 0.0);
 
-    return 0;
+    free(res.components);
+    nim_memo_close(&memo);
 }
 
 /*
- * Fill in the edge at position (x,y) if it is in the grid.
- *
- * If it is not in the grid return 1, otherwise 0.
+ * Count the move sequences depth moves long from g on threads threads and
+ * report how many there were, how many ended in a capture and how fast they
+ * were counted.
  */
-int
-place_horizontal_edge(int x, int y, struct game *g)
+void
+run_perft(int depth, int threads, struct game *g)
 {
-    /* Horizontal lines can't be at x == width. */
-    if (x < 0 || x >= g->width || y < 0 || y > g->height ||
-            g->grid[2 * y][2 * x + 1] != ' ') {
-        return 1;
-    }
-
-    g->grid[2 * y][2 * x + 1] = '-';
+    struct perft_result res;
 
-    check_closures(x, y, g);
+    perft(g, depth, threads, &res);
 
-    return 0;
+    printf("Depth: %d\n", res.depth);
+    printf("Nodes: %" PRIu64 " in %.3fs (%.0f nodes/sec)\n", res.nodes,
+            res.seconds, res.seconds > 0 ? res.nodes / res.seconds : 0.0);
+    printf("Captures: %" PRIu64 " (%" PRIu64 " doubles)\n", res.captures,
+            res.doubles);
 }
 
 /*
- * Check all possible closures that could result from filling the edge at
- * position (x, y) in the grid.
- *
- * If a closure is detected then the current player is rolled back so that
- * the next player is the current player. This is a bit of a hack because I
- * forgot about it until too late to do it nicely.
+ * Print the winners of g to f. It is assumed if this is called the game is
+ * over.
  */
 void
-check_closures(int x, int y, struct game *g)
+pick_winner(FILE *f, struct game *g)
 {
-    int starting_closed = g->close_count;
+    int winners[100], n, i;
 
-    check_single_closure(x * 2 - 1, y * 2 - 1, g);
-    check_single_closure(x * 2 + 1, y * 2 - 1, g);
-    check_single_closure(x * 2 - 1, y * 2 + 1, g);
-    check_single_closure(x * 2 + 1, y * 2 + 1, g);
+    n = find_winners(g, winners);
 
-    /* Easier than returning stuff... */
-    if (g->close_count != starting_closed) {
-        g->current_player = g->current_player == 0 ? g->num_players - 1 :
-                g->current_player - 1;
+    fprintf(f, "Winner(s): %c", winners[0] + 'A');
+    for (i = 1; i < n; ++i) {
+        fprintf(f, ", %c", winners[i] + 'A');
     }
+    fprintf(f, "\n");
 }
 
 /*
- * Check if the box with centre at (x_mid, y_mid) is fully enclosed.
- * If it is then the game state is updated to reflect this box as now beign
- * taken.
+ * Parse one "y x h|v" line of a text move file starting at *p, leaving *p
+ * at the start of the next line.
+ *
+ * Returns 0 and fills in the move if the line is well formed, otherwise 1.
+ * Numbers are limited to 9 digits so they always fit in an int.
  */
-void
-check_single_closure(int x_mid, int y_mid, struct game *g)
+static int
+parse_move_line(char const **p, char const *end, int *y, int *x,
+        int *vertical)
 {
-    /* Don't bother checking if it goes outside the grid. */
-    if (x_mid > 0 && x_mid < g->width * 2 && 
-            y_mid > 0 && y_mid < g->height * 2) {
-        if (g->grid[y_mid - 1][x_mid] != ' ' && 
-                g->grid[y_mid + 1][x_mid] != ' ' &&
-                g->grid[y_mid][x_mid + 1] != ' ' &&
-                g->grid[y_mid][x_mid - 1] != ' ' &&
-                g->grid[y_mid][x_mid] == ' ') {
-            g->grid[y_mid][x_mid] = g->current_player + 'A';
-            g->close_count++;
-            g->scores[g->current_player]++;
+    char const *s = *p, *eol;
+    int *num[2] = { y, x }, i, digits;
+
+    eol = memchr(s, '\n', end - s);
+    if (eol == NULL) {
+        eol = end;
+    }
+    *p = eol == end ? end : eol + 1;
+
+    for (i = 0; i < 2; ++i) {
+        *num[i] = 0;
+        for (digits = 0; s < eol && *s >= '0' && *s <= '9'; ++s, ++digits) {
+            *num[i] = *num[i] * 10 + *s - '0';
+        }
+        if (digits == 0 || digits > 9 || s == eol || *s++ != ' ') {
+            return 1;
         }
     }
+
+    if (eol - s != 1 || (*s != 'h' && *s != 'v')) {
+        return 1;
+    }
+    *vertical = *s == 'v';
+
+    return 0;
 }
 
 /*
- * Set up g->grid with an empty initial game state.
+ * Replay every move in the file at path against g without any prompting or
+ * redrawing, then print the final board through v, the scores and the
+ * winner.
+ *
+ * The file is either text, one "y x h|v" move per line as typed at the
+ * prompt, or MOVE_MAGIC followed by native endian pairs of 32 bit words
+ * (y, x), with MOVE_VERTICAL set in x for vertical edges. Moves that would be
+ * rejected at the prompt are skipped without using up the turn. Replay stops
+ * early if the game ends. The replay rate is reported on stderr.
+ *
+ * Binary files are replayed on threads threads if there is more than one,
+ * which comes out the same as playing the moves one by one.
  */
 void
-allocate_empty_grid(struct game *g)
+run_batch(char *path, int threads, struct view *v, struct game *g)
 {
-    int i, j;
-    
-    g->grid = malloc((g->height * 2 + 1) * sizeof(char *));
-    for (i = 0; i < g->height * 2 + 1; ++i) {
-        g->grid[i] = malloc((g->width + 1) * 2);
-
-        for (j = 0; j < g->width * 2 + 1; ++j) {
-            /* Odd rows and columns always start as spaces. */
-            if (i % 2 || j % 2) {
-                g->grid[i][j] = ' ';
-            } else {
-                g->grid[i][j] = '+';
+    struct timespec start, stop;
+    struct replay_result res;
+    struct stat st;
+    char const *data = NULL, *p, *end;
+    uint32_t rec[2];
+    long applied = 0, rejected = 0;
+    double secs;
+    int fd, x, y, vertical, binary;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Invalid move file\n");
+        exit(7);
+    }
+    if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ,
+            MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Invalid move file\n");
+        exit(7);
+    }
+    close(fd);
+
+    p = data;
+    end = data + st.st_size;
+    binary = st.st_size >= 4 && memcmp(data, MOVE_MAGIC, 4) == 0;
+    if (binary) {
+        p += 4;
+        madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (binary && threads > 1) {
+        replay_moves((uint32_t const *)p, (end - p) / sizeof(rec), threads,
+                &res, g);
+        applied = res.applied;
+        rejected = res.rejected;
+        p += (end - p) / sizeof(rec) * sizeof(rec);
+    }
+
+    while (p < end && g->close_count != g->possible_closures) {
+        if (binary) {
+            if (end - p < (long)sizeof(rec)) {
+                ++rejected;
+                break;
             }
+            memcpy(rec, p, sizeof(rec));
+            p += sizeof(rec);
+            y = rec[0] & ~MOVE_VERTICAL;
+            x = rec[1] & ~MOVE_VERTICAL;
+            vertical = (rec[1] & MOVE_VERTICAL) != 0;
+        } else if (parse_move_line(&p, end, &y, &x, &vertical)) {
+            ++rejected;
+            continue;
         }
 
-        g->grid[i][j] = '\0';
+        if (make_move(x, y, vertical, g) != 0) {
+            ++rejected;
+            continue;
+        }
+
+        ++applied;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (data != NULL) {
+        munmap((void *)data, st.st_size);
+    }
+
+    secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Replayed %ld moves (%ld rejected) in %.6fs, "
+            "%.0f moves/sec\n", applied, rejected, secs,
+            secs > 0 ? applied / secs : 0.0);
+
+    print_view(stdout, v, g);
+    if (v->mode != RENDER_SUMMARY) {
+        print_scores(stdout, g);
+    }
+    if (check_game_over(g)) {
+        pick_winner(stdout, g);
+    } else {
+        printf("Game not finished\n");
     }
 }
 
 /*
- * Print the grid in g to file f.
+ * Have the computer pick and make the move for the player to move in g,
+ * recording it in j and showing it after the prompt as if it had been
+ * typed. The move comes from book if the position is in it, otherwise from
+ * thinking for think seconds on threads threads.
  */
 void
-print_grid(FILE *f, struct game *g)
+computer_move(double think, int threads, struct book const *book,
+        struct journal *j, struct game *g)
 {
-    int i;
+    struct mcts_result res;
+    int x, y, vertical;
 
-    for (i = 0; i < g->height * 2 + 1; ++i) {
-        fprintf(f, "%s\n", g->grid[i]);
+    if (!book_lookup(book, g, &res.move)) {
+        mcts(g, think, threads, &res);
     }
+    edge_coords(res.move, &x, &y, &vertical, g);
+    printf("%c> %d %d %c\n", g->current_player + 'A', y, x,
+            vertical ? 'v' : 'h');
+    journal_make(j, res.move, g);
 }
 
 /*
- * Try to read and process a move from stdin. 
+ * Prompt on out for a move and try to read and process it from in. Moves
+ * are recorded in j, "u" and "r" undo and redo them and "c" lists the
+ * chains and loops on the board.
  *
- * Returns 1 if a move was successfully made, otherwise 0. Success means an
- * actual move - saving a file is reported as failure to allow re-prompting.
+ * Returns MOVE_MADE if the board changed, MOVE_EOF if in ran out and
+ * MOVE_RETRY otherwise. Saving a file, listing chains, or an undo or redo
+ * with nothing to do, is reported as MOVE_RETRY to allow re-prompting.
  */
-int
-try_move(struct game *g)
+enum move_status
+try_move(FILE *in, FILE *out, struct journal *j, struct game *g)
 {
-    char input[11] = { 0 };
+    char input[MOVE_LENGTH + 1] = { 0 };
     int n = 0, c;
 
-    printf("%c> ", g->current_player + 'A');
-    fflush(stdout);
+    fprintf(out, "%c> ", g->current_player + 'A');
+    fflush(out);
 
-    while (n < 10) {
-        c = fgetc(stdin);
+    while (n < MOVE_LENGTH) {
+        c = fgetc(in);
         
         if (c == EOF || c == '\n') {
             break;
-        } else if (n == 1 && c == ' ' && *input == 'w') {
-            read_path_and_save(g);
-            return 1;
+        } else if (n == 1 && c == ' ' && (*input == 'w' || *input == 'b')) {
+            read_path_and_save(in, g, *input == 'b');
+            return MOVE_RETRY;
         } else {
             input[n++] = c;
         }
     }
 
     while (c != EOF && c != '\n') {
-        c = fgetc(stdin);
+        c = fgetc(in);
     }
 
     if (c == EOF && n == 0) {
-        fprintf(stderr, "End of user input\n");
-        exit(6);
+        return MOVE_EOF;
     }
 
-    if (n == 10) {
-        return 1;
-    } 
+    if (n == MOVE_LENGTH) {
+        return MOVE_RETRY;
+    } else if (strcmp(input, "u") == 0) {
+        return journal_undo(j, g) ? MOVE_RETRY : MOVE_MADE;
+    } else if (strcmp(input, "r") == 0) {
+        return journal_redo(j, g) ? MOVE_RETRY : MOVE_MADE;
+    } else if (strcmp(input, "c") == 0) {
+        print_chains(out, g);
+        return MOVE_RETRY;
+    }
 
-    return process_move(input, g);
+    return process_move(input, j, g) ? MOVE_RETRY : MOVE_MADE;
 }
 
 /*
- * Convert the move in the string m to an actual move on our game board.
+ * Convert the move in the string m to an actual move on our game board,
+ * passing the turn on as make_move does and recording it in j.
  *
  * On failure, 1 is returned, otherwise 0.
  */
 int
-process_move(char *m, struct game *g)
+process_move(char *m, struct journal *j, struct game *g)
 {
-    char *err;
     long x, y;
+    int vertical, failed;
+    PROFILE_BEGIN(t);
 
-    y = strtol(m, &err, 10);
-    if (*err != ' ' || y < 0 || y > 999) {
-        return 1;
-    }
+    failed = parse_move(m, &x, &y, &vertical) ||
+            journal_make(j, find_edge(x, y, vertical, g), g) < 0;
 
-    m = err + 1;
-    x = strtol(m, &err, 10);
-    if (*err != ' ' || x < 0 || x > 999) {
-        return 1;
-    }
-
-    if (err[1]  == 'v' && err[2] == '\0') {
-        return place_verticle_edge(x, y, g);
-    } else if (err[1] == 'h' && err[2] == '\0') {
-        return place_horizontal_edge(x, y, g);
-    } else {
-        return 1;
-    }
+    PROFILE_END(PROBE_PROCESS_MOVE, t);
+    return failed;
 }
 
 /*
- * Try and read a path from stdin and save the game to that location.
+ * Try and read a path from in and save the game to that location, in the
+ * binary format if binary is set and the text one otherwise.
  *
  * If the function returns, the file was able to be saved, otherwise the
  * program is killed with appropriate status.
  */
 void
-read_path_and_save(struct game *g)
+read_path_and_save(FILE *in, struct game *g, int binary)
 {
     char path[FILENAME_MAX + 1];
     int n = 0, c;
     FILE *f;
 
     while (n < FILENAME_MAX) {
-        c = fgetc(stdin);
+        c = fgetc(in);
 
         if (c == EOF || c == '\n') {
             break;
@@ -341,7 +695,7 @@ read_path_and_save(struct game *g)
     path[n] = '\0';
 
     while (c != EOF && c != '\n') {
-        c = fgetc(stdin);
+        c = fgetc(in);
     }
 
     if ((f = fopen(path, "w")) == NULL) {
@@ -349,203 +703,67 @@ read_path_and_save(struct game *g)
         return;
     } 
 
-    save_game(f, g);
+    if (binary) {
+        if (save_binary(fileno(f), 0, g)) {
+            fclose(f);
+            fprintf(stderr, "Can not open file for write\n");
+            return;
+        }
+    } else {
+        save_game(f, g);
+    }
     fclose(f);
 
     fprintf(stderr, "Save complete\n");
 }
 
 /*
- * Save the game state in g to file f. Will always succeed.
+ * Load the save at path into g, or exit with the right status and message
+ * if it can't be.
  */
 void
-save_game(FILE *f, struct game *g)
+load_or_exit(char const *path, struct game *g)
 {
-    int h = 0, v = 0, i;
-
-    fprintf(f, "%d\n", g->current_player + 1);
-
-    /* Need to do one extra for the horizontal only. */
-    while (!(h == g->height + 1 && v == g->height)) {
-        if (h != g->height + 1) {
-            for (i = 1; i < g->width * 2; i += 2) {
-                fprintf(f, "%c", g->grid[h * 2][i] == '-' ? '1' : '0');
-            }
-            fprintf(f, "\n");
-            ++h;
-        }
-
-        if (v != g->height) {
-            for (i = 0; i < g->width * 2 + 1; i += 2) {
-                fprintf(f, "%c", g->grid[v * 2 + 1][i] == '|' ? '1' : '0');
-            }
-            fprintf(f, "\n");
-            ++v;
-        }
-    }
+    int status = read_grid_file(path, g);
 
-    for (v = 1; v < 2 * g->height; v += 2) {
-        /* x - '@' maps 'A' -> 1, etc */
-        for (h = 1; h < 2 * g->width - 2; h += 2) {
-            fprintf(f, "%d,", g->grid[v][h] == ' ' ? 0 : g->grid[v][h] - '@');
-        }
-        fprintf(f, "%d\n", g->grid[v][h] == ' ' ? 0 : g->grid[v][h] - '@');
+    if (status != LOAD_OK) {
+        fprintf(stderr, "%s\n", load_message(status));
+        exit(status);
     }
 }
 
-/*
- * Try and read in the file from path as if it was a grid.
- *
- * Will exit with appropriate status if the file isn't actually a valid grid
- * for this game.
- *
- * On return g should be ready to play games with.
- */
-void
-read_grid_file(char *path, struct game *g)
-{
-    int n = 0;
-    FILE *f;
-
-    if ((f = fopen(path, "r")) == NULL) {
-        fprintf(stderr, "Invalid grid file\n");
-        exit(4);
-    }
-    
-    if ((g->current_player = read_num_until(f, '\n', g) - 1) < 0) {
-        fprintf(stderr, "Error reading grid contents\n");
-        exit(5);
-    }
-
-
-    while (n != 2 * g->height + 1) {
-        read_edges(f, n++, g);
-    }
-
-    read_filled(f, g);
-
-    if (fgetc(f) != EOF) {
-        fprintf(stderr, "Error reading grid contents\n");
-        exit(5);
-    }
-
-    fclose(f);
-}
+#ifdef BOXES_PROFILE
+/* Where report_profile writes the JSON copy of its report, if anywhere. */
+static char const *profile_json;
 
 /*
- * Read the filled boxes for the game in g from file f. 
- *
- * Along the way if any errors are found then the program will be killed
- * and the appropriate error thrown.
- *
- * On return g->grid should be up to date with the current file's map. 
+ * Print what the probes saw to stderr, and write it out as JSON too if
+ * asked to. Run on the way out however boxes exits.
  */
-void
-read_filled(FILE *f, struct game *g)
+static void
+report_profile(void)
 {
-    int p, n, i;
-
-    for (i = 0; i < g->height; ++i) { 
-        /* read_num_until does the bounds check for us... */
-        for (n = 0; n < g->width - 1; ++n) {
-            p = read_num_until(f, ',', g);
-            if (p != 0) {
-                g->grid[i * 2 + 1][n * 2 + 1] = p + '@';
-                g->close_count++;
-            }
-        }
-        p = read_num_until(f, '\n', g);
-        if (p != 0) {
-            g->grid[i * 2 + 1][n * 2 + 1] = p + '@';
-            g->close_count++;
-        }
+    profile_report(stderr);
+    if (profile_json != NULL && profile_write_json(profile_json)) {
+        fprintf(stderr, "Can not write profile\n");
     }
 }
+#endif
 
 /*
- * Read a number from f up until delim is reached or EOF is encountered.
- *
- * If the number is too long to be any valid number for this game or the
- * thing being read is not a number, then the function kills the game. 
- *
- * If the function managed to return then a number was successfully read.
- */
-int
-read_num_until(FILE *f, char delim, struct game *g)
-{
-    char input[5];
-    int n = 0, c;
-
-    while (n != 4) {
-        c = fgetc(f);
-
-        if (c == delim || c == EOF) {
-            break;
-        } else if (c < '0' || c > '9') {
-            fprintf(stderr, "Error reading grid contents\n");
-            exit(5);
-        } else {
-            input[n++] = c;
-        }
-    }
-
-    input[n] = '\0';
-
-    if (n == 4 || n == 0) {
-        fprintf(stderr, "Error reading grid contents\n");
-        exit(5);
-    }
-
-    n = strtol(input, NULL, 10);
-
-    /* We should never get a number larger than the number of players. */
-    if (n > g->num_players) {
-        fprintf(stderr, "Error reading grid contents\n");
-        exit(5);
-    }
-
-    return n;
-}
-
-/*
- * Read the edge positions for row n from file f.
- *
- * If the next line in f does not contain a valid set of edges for the given
- * n then it will kill the progam with appropriate error message.
- *
- * On return g->grid[n] should be appropriatly populated.
+ * Turn on the timing probes for the rest of the run and have their report
+ * printed on exit, also written as JSON to json_path unless it is NULL.
+ * boxes built with PROFILE=0 has no probes and says so.
  */
 void
-read_edges(FILE *f, int n, struct game *g)
+start_profile(char const *json_path)
 {
-    char input[1001], sep;
-    int i = 0, j = 0, c;
-
-    /* Odd rows are longer. */
-    while (i != g->width + n % 2) {
-        c = fgetc(f);
-
-        if (c == EOF || c == '\n' || (c != '0' && c != '1')) {
-            fprintf(stderr, "Error reading grid contents\n");
-            exit(5);
-        } else {
-            input[i++] = c;
-        }
-    }
-
-    input[i] = '\0';
-
-    if ((c = fgetc(f)) != '\n') {
-        fprintf(stderr, "Error reading grid contents\n");
-        exit(5);
-    }
-
-    sep = n % 2 ? '|' : '-';
-
-    /* Odd rows get offset 1. */
-    for (i = !(n % 2); i < g->width * 2 + 1; i += 2, ++j) {
-        if (input[j] != '0') {
-            g->grid[n][i] = sep;
-        }
-    }
+#ifdef BOXES_PROFILE
+    profile_json = json_path;
+    profile_start();
+    atexit(report_profile);
+#else
+    (void)json_path;
+    fprintf(stderr, "Profiling not built in\n");
+#endif
 }
@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "board.h"
+#include "policy.h"
+
+/*
+ * Each benchmark runs for at least MIN_SECONDS, split into ROUNDS rounds.
+ */
+#define MIN_SECONDS 0.5
+#define ROUNDS 5
+
+/* Default slowdown, in percent, counted as a regression. */
+#define DEFAULT_TOLERANCE 15.0
+
+/*
+ * The timing for one operation on one board size. ns_per_op is from its
+ * fastest round and rss_kb is the peak resident size of the whole run once
+ * it had finished.
+ */
+struct result {
+    char name[16];
+    int height;
+    int width;
+    long ops;
+    double ns_per_op;
+    long rss_kb;
+};
+
+/*
+ * Everything about a run. Every board is played in the same random order
+ * for a given seed, so runs can be compared with each other.
+ */
+struct bench {
+    uint64_t seed;
+    double tolerance;
+    char *baseline;
+    char *scratch;
+    struct result *results;
+    int count;
+    int cap;
+};
+
+void usage(void);
+void run_size(struct bench *b, int h, int w);
+int compare_baseline(struct bench *b);
+
+int
+main(int argc, char **argv)
+{
+    static int const sizes[][2] = { { 5, 5 }, { 100, 100 }, { 999, 999 } };
+    struct bench b;
+    char *err;
+    int opt, h, w, fd, regressed;
+    size_t i;
+
+    memset(&b, 0, sizeof(b));
+    b.seed = 1;
+    b.tolerance = DEFAULT_TOLERANCE;
+
+    while ((opt = getopt(argc, argv, "b:s:t:")) != -1) {
+        switch (opt) {
+            case 'b':
+                b.baseline = optarg;
+                break;
+            case 's':
+                b.seed = strtoull(optarg, &err, 10);
+                if (*err != '\0') {
+                    usage();
+                }
+                break;
+            case 't':
+                b.tolerance = strtod(optarg, &err);
+                if (*err != '\0' || b.tolerance < 0) {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+    b.seed = b.seed ? b.seed : 1;
+
+    b.scratch = strdup("/tmp/boxes-bench-XXXXXX");
+    if ((fd = mkstemp(b.scratch)) < 0) {
+        fprintf(stderr, "Can not create scratch file\n");
+        exit(3);
+    }
+    close(fd);
+
+    printf("# %-6s %-9s %10s %12s %14s %10s\n", "op", "size", "ops",
+            "ns/op", "ops/sec", "peak_kb");
+
+    if (optind == argc) {
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            run_size(&b, sizes[i][0], sizes[i][1]);
+        }
+    }
+    for (; optind < argc; ++optind) {
+        if (sscanf(argv[optind], "%dx%d", &h, &w) != 2 || h < 2 ||
+                w < 2 || h > 999 || w > 999) {
+            usage();
+        }
+        run_size(&b, h, w);
+    }
+
+    unlink(b.scratch);
+    free(b.scratch);
+
+    regressed = b.baseline != NULL && compare_baseline(&b);
+    free(b.results);
+    return regressed ? 2 : 0;
+}
+
+/*
+ * Print the usage message and exit.
+ */
+void
+usage(void)
+{
+    fprintf(stderr, "Usage: boxes-bench [-s seed] [-b baseline] "
+            "[-t tolerance%%] [heightxwidth...]\n");
+    exit(1);
+}
+
+/*
+ * Return the seconds elapsed on the monotonic clock.
+ */
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Set g up as an empty two player h by w game.
+ */
+static void
+new_game(int h, int w, struct game *g)
+{
+    memset(g, 0, sizeof(*g));
+    g->height = h;
+    g->width = w;
+    g->num_players = 2;
+    g->possible_closures = (long)h * w;
+    allocate_empty_grid(g);
+}
+
+/*
+ * Return every edge of g in an order shuffled by seed.
+ */
+static long *
+shuffled_edges(uint64_t seed, struct game *g)
+{
+    uint64_t rng = seed * 0x9e3779b97f4a7c15ULL | 1;
+    long n = edge_count(g), i, j, t;
+    long *order = malloc(n * sizeof(long));
+
+    for (i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    for (i = n - 1; i > 0; --i) {
+        j = next_rand(&rng) % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    return order;
+}
+
+/*
+ * Make the first n moves of order on g.
+ */
+static void
+play(long const *order, long n, struct game *g)
+{
+    int x, y, vertical;
+    long i;
+
+    for (i = 0; i < n; ++i) {
+        edge_coords(order[i], &x, &y, &vertical, g);
+        make_move(x, y, vertical, g);
+    }
+}
+
+/*
+ * What the operations being timed work on: a half played board, the order
+ * its edges are played in and somewhere to write to.
+ */
+struct subject {
+    struct game g;
+    long *order;
+    long edges;
+    FILE *null;
+    char *scratch;
+};
+
+/*
+ * Play a whole game in the subject's order through make_move, so covering
+ * placing edges and checking for closures. Counts as one op per move.
+ */
+static void
+op_move(struct subject *s)
+{
+    struct game g;
+
+    new_game(s->g.height, s->g.width, &g);
+    play(s->order, s->edges, &g);
+    free_grid(&g);
+}
+
+/*
+ * Draw the board with print_grid.
+ */
+static void
+op_print(struct subject *s)
+{
+    print_grid(s->null, &s->g);
+}
+
+/*
+ * Write the board to the scratch file with save_game.
+ */
+static void
+op_save(struct subject *s)
+{
+    FILE *f = fopen(s->scratch, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Can not create scratch file\n");
+        exit(3);
+    }
+    save_game(f, &s->g);
+    fclose(f);
+}
+
+/*
+ * Load the scratch file back with read_grid_file.
+ */
+static void
+op_read(struct subject *s)
+{
+    struct game g;
+
+    new_game(s->g.height, s->g.width, &g);
+    if (read_grid_file(s->scratch, &g) != LOAD_OK) {
+        fprintf(stderr, "Can not read back scratch file\n");
+        exit(3);
+    }
+    free_grid(&g);
+}
+
+/*
+ * Time op on s and record it under name, counting each call as ops_per_call
+ * ops. The time is split into ROUNDS rounds and only the fastest is kept,
+ * which keeps whatever else the machine is doing out of the numbers.
+ */
+static void
+measure(struct bench *b, char const *name, void (*op)(struct subject *),
+        long ops_per_call, struct subject *s)
+{
+    struct result *r;
+    struct rusage ru;
+    double start, spent, ns, best = 0;
+    long calls, ops = 0;
+    int round;
+
+    if (b->count == b->cap) {
+        b->cap = b->cap ? 2 * b->cap : 16;
+        b->results = realloc(b->results, b->cap * sizeof(struct result));
+    }
+    r = &b->results[b->count++];
+
+    for (round = 0; round < ROUNDS; ++round) {
+        start = now();
+        calls = 0;
+        do {
+            op(s);
+            calls++;
+        } while ((spent = now() - start) < MIN_SECONDS / ROUNDS);
+
+        ops += calls * ops_per_call;
+        ns = spent * 1e9 / (calls * ops_per_call);
+        if (round == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    getrusage(RUSAGE_SELF, &ru);
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->height = s->g.height;
+    r->width = s->g.width;
+    r->ops = ops;
+    r->ns_per_op = best;
+    r->rss_kb = ru.ru_maxrss;
+
+    printf("%-8s %4dx%-4d %10ld %12.1f %14.0f %10ld\n", r->name, r->height,
+            r->width, ops, best, 1e9 / best, r->rss_kb);
+    fflush(stdout);
+}
+
+/*
+ * Time each operation on an h by w board and record the results. All but
+ * move work on the board half way through the game.
+ */
+void
+run_size(struct bench *b, int h, int w)
+{
+    struct subject s;
+
+    new_game(h, w, &s.g);
+    s.edges = edge_count(&s.g);
+    s.order = shuffled_edges(b->seed, &s.g);
+    s.scratch = b->scratch;
+    s.null = fopen("/dev/null", "w");
+    play(s.order, s.edges / 2, &s.g);
+
+    measure(b, "move", op_move, s.edges, &s);
+    measure(b, "print", op_print, 1, &s);
+    measure(b, "save", op_save, 1, &s);
+    measure(b, "read", op_read, 1, &s);
+
+    fclose(s.null);
+    free(s.order);
+    free_grid(&s.g);
+}
+
+/*
+ * Check the results in b against the baseline file, a saved copy of
+ * boxes-bench's output, and report on stderr every operation that got more
+ * than tolerance percent slower. Operations missing from either side are
+ * left out.
+ *
+ * Returns 1 if anything regressed, otherwise 0.
+ */
+int
+compare_baseline(struct bench *b)
+{
+    FILE *f = fopen(b->baseline, "r");
+    char line[256], name[16];
+    double ns, change;
+    int h, w, i, regressed = 0;
+
+    if (f == NULL) {
+        fprintf(stderr, "Can not read baseline %s\n", b->baseline);
+        exit(3);
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%15s %dx%d %*d %lf", name, &h,
+                &w, &ns) != 4) {
+            continue;
+        }
+        for (i = 0; i < b->count; ++i) {
+            if (strcmp(b->results[i].name, name) != 0 ||
+                    b->results[i].height != h || b->results[i].width != w) {
+                continue;
+            }
+            change = 100.0 * (b->results[i].ns_per_op - ns) / ns;
+            if (change > b->tolerance) {
+                fprintf(stderr, "Regression: %s %dx%d %.1f ns/op, was %.1f "
+                        "(+%.1f%%)\n", name, h, w, b->results[i].ns_per_op,
+                        ns, change);
+                regressed = 1;
+            }
+        }
+    }
+
+    fclose(f);
+    return regressed;
+}
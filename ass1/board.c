@@ -0,0 +1,1919 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "board.h"
+#include "chains.h"
+#include "edgeset.h"
+#include "profile.h"
+
+/* Binary saves start with this header, see save_binary. */
+#define SAVE_MAGIC "BOXS"
+#define SAVE_VERSION 2
+
+/*
+ * tiles was reserved (and zero) in version 1. serial is free for whoever
+ * writes the save to number it with, and is 0 from the w command.
+ */
+struct save_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t height;
+    uint32_t width;
+    uint32_t num_players;
+    uint32_t current_player;
+    uint32_t tiles;
+    uint32_t serial;
+};
+
+/* The part of a tile that goes in a binary save; sides is rebuilt. */
+#define TILE_RECORD offsetof(struct tile, sides)
+
+/* Tiles handed to each writev in save_binary. */
+#define SAVE_BATCH 256
+
+/* Text saves are parsed straight out of memory through one of these. */
+struct reader {
+    char const *p;
+    char const *end;
+};
+
+/* Scratch space save_game fills before handing it to stdio. */
+#define SAVE_BUFFER 65536
+
+/* "0,0,0,0," as loaded by load_bytes. */
+#define ZERO_RUN 0x2c302c302c302c30ULL
+
+/* Every byte of a word set to the same value. */
+#define BYTES(b) ((uint64_t)0x0101010101010101ULL * (b))
+
+int read_binary_save(char const *data, size_t len, struct game *g);
+int read_edges(struct reader *r, int n, struct game *g);
+int read_num_until(struct reader *r, char delim, struct game *g);
+int read_filled(struct reader *r, struct game *g);
+
+/*
+ * Print the score of every player in g to f on a single line.
+ */
+void
+print_scores(FILE *f, struct game *g)
+{
+    int i;
+
+    fprintf(f, "Scores: ");
+    for (i = 0; i < g->num_players; ++i) {
+        fprintf(f, "%s%c=%ld", i ? ", " : "", i + 'A', g->scores[i]);
+    }
+    fprintf(f, "\n");
+}
+
+/*
+ * Fill in the edge at position (x,y) if it is in the grid.
+ *
+ * If it is not in the grid return 1, otherwise 0.
+ */
+int
+place_verticle_edge(int x, int y, struct game *g)
+{
+    /* Vertical lines can't be at y == height. */
+    if (x < 0 || x > g->width || y < 0 || y >= g->height ||
+            vedge_filled(x, y, g)) {
+        return 1;
+    }
+
+    fill_edge(x, y, 1, g);
+    g->last_x = x;
+    g->last_y = y;
+    g->last_vertical = 1;
+
+    check_closures(x, y, g);
+
+    return 0;
+}
+
+/*
+ * Fill in the edge at position (x,y) if it is in the grid.
+ *
+ * If it is not in the grid return 1, otherwise 0.
+ */
+int
+place_horizontal_edge(int x, int y, struct game *g)
+{
+    /* Horizontal lines can't be at x == width. */
+    if (x < 0 || x >= g->width || y < 0 || y > g->height ||
+            hedge_filled(x, y, g)) {
+        return 1;
+    }
+
+    fill_edge(x, y, 0, g);
+    g->last_x = x;
+    g->last_y = y;
+    g->last_vertical = 0;
+
+    check_closures(x, y, g);
+
+    return 0;
+}
+
+/*
+ * Report whether the free edge at (x, y) is safe, ie. filling it would not
+ * give either of the boxes it borders a third side.
+ */
+int
+is_safe_edge(int x, int y, int vertical, struct game *g)
+{
+    if (vertical) {
+        return !vedge_filled(x, y, g) &&
+                (x == 0 || box_sides(x - 1, y, g) < 2) &&
+                (x == g->width || box_sides(x, y, g) < 2);
+    }
+
+    return !hedge_filled(x, y, g) &&
+            (y == 0 || box_sides(x, y - 1, g) < 2) &&
+            (y == g->height || box_sides(x, y, g) < 2);
+}
+
+/*
+ * Add the edges of box (x, y) whose safety may change when its side count
+ * does to the running total in safe. The edge skip_x/skip_y/skip_vertical
+ * is left out so the edge shared by two boxes is only counted once.
+ */
+static long
+box_safe_edges(int x, int y, int skip_x, int skip_y, int skip_vertical,
+        struct game *g)
+{
+    long safe = 0;
+
+    if (!(skip_vertical == 0 && skip_x == x && skip_y == y)) {
+        safe += is_safe_edge(x, y, 0, g);
+    }
+    if (!(skip_vertical == 0 && skip_x == x && skip_y == y + 1)) {
+        safe += is_safe_edge(x, y + 1, 0, g);
+    }
+    if (!(skip_vertical == 1 && skip_x == x && skip_y == y)) {
+        safe += is_safe_edge(x, y, 1, g);
+    }
+    if (!(skip_vertical == 1 && skip_x == x + 1 && skip_y == y)) {
+        safe += is_safe_edge(x + 1, y, 1, g);
+    }
+
+    return safe;
+}
+
+/*
+ * Put the boxes either side of the edge at (x, y) in bx/by: left then right
+ * of a vertical, above then below a horizontal. Returns how many there are.
+ */
+static int
+edge_boxes(int x, int y, int vertical, int *bx, int *by, struct game *g)
+{
+    int n = 0;
+
+    if (vertical) {
+        if (x > 0) {
+            bx[n] = x - 1;
+            by[n++] = y;
+        }
+        if (x < g->width) {
+            bx[n] = x;
+            by[n++] = y;
+        }
+    } else {
+        if (y > 0) {
+            bx[n] = x;
+            by[n++] = y - 1;
+        }
+        if (y < g->height) {
+            bx[n] = x;
+            by[n++] = y;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Fill (or with fill unset, clear) the edge at (x, y) and bring the side
+ * counters of the boxes either side of it, and the totals derived from them,
+ * up to date.
+ *
+ * Only the edges of those two boxes can change safety, so the safe edge
+ * count is adjusted by recounting just them before and after. Likewise
+ * they are the only boxes that can join or leave a chain, and theirs the
+ * only edges that can join or leave the safe and capturing sets.
+ */
+static void
+change_edge(int x, int y, int vertical, int fill, struct game *g)
+{
+    int bx[2], by[2], n, i;
+    long before = 0, after = 0;
+    uint64_t *row, bit = (uint64_t)1 << (x & TILE_MASK);
+    unsigned char *s;
+
+    n = edge_boxes(x, y, vertical, bx, by, g);
+
+    before += is_safe_edge(x, y, vertical, g);
+    for (i = 0; i < n; ++i) {
+        before += box_safe_edges(bx[i], by[i], x, y, vertical, g);
+        if (g->chains != NULL && box_sides(bx[i], by[i], g) == 2) {
+            chains_remove_box(bx[i], by[i], g);
+        }
+    }
+
+    /* Touching the boxes' tiles too keeps every box with a side in a tile. */
+    row = vertical ? &touch_tile(x, y, g)->vedges[y & TILE_MASK] :
+            &touch_tile(x, y, g)->hedges[y & TILE_MASK];
+    *row = fill ? *row | bit : *row & ~bit;
+    SET_BIT(g->dirty_rows, 2 * y + vertical);
+
+    for (i = 0; i < n; ++i) {
+        s = &touch_tile(bx[i], by[i], g)->sides[TILE_BOX(bx[i], by[i])];
+        g->side_totals[*s]--;
+        *s += fill ? 1 : -1;
+        g->side_totals[*s]++;
+    }
+
+    after += is_safe_edge(x, y, vertical, g);
+    for (i = 0; i < n; ++i) {
+        after += box_safe_edges(bx[i], by[i], x, y, vertical, g);
+        if (g->chains != NULL && box_sides(bx[i], by[i], g) == 2) {
+            chains_add_box(bx[i], by[i], g);
+        }
+    }
+
+    g->safe_edges += after - before;
+
+    if (g->edge_sets != NULL) {
+        edge_sets_update(x, y, vertical, g);
+    }
+}
+
+/*
+ * Mark the free edge at (x, y) as filled, keeping the side counters up to
+ * date.
+ */
+void
+fill_edge(int x, int y, int vertical, struct game *g)
+{
+    PROFILE_BEGIN(t);
+
+    change_edge(x, y, vertical, 1, g);
+
+    PROFILE_END(PROBE_PLACE_EDGE, t);
+}
+
+/*
+ * Mark the filled edge at (x, y) as free again, keeping the side counters
+ * up to date. Any boxes it closed must already have been reopened.
+ */
+void
+clear_edge(int x, int y, int vertical, struct game *g)
+{
+    change_edge(x, y, vertical, 0, g);
+}
+
+/*
+ * Return the number of free edges that can be filled without giving any box
+ * a third side.
+ */
+long
+count_safe_edges(struct game *g)
+{
+    return g->safe_edges;
+}
+
+/*
+ * Return the number of edges filled in g, counted a tile row word at a
+ * time.
+ */
+long
+filled_edges(struct game *g)
+{
+    struct tile *t;
+    long i, filled = 0;
+    int r;
+
+    for (i = 0; i < (long)g->tiles_w * g->tiles_h; ++i) {
+        if ((t = g->tiles[i]) != NULL) {
+            for (r = 0; r < TILE_SIZE; ++r) {
+                filled += __builtin_popcountll(t->hedges[r]) +
+                        __builtin_popcountll(t->vedges[r]);
+            }
+        }
+    }
+
+    return filled;
+}
+
+/*
+ * Return the number of boxes that have exactly n of their sides filled.
+ */
+long
+boxes_with_sides(int n, struct game *g)
+{
+    return n < 0 || n > 4 ? 0 : g->side_totals[n];
+}
+
+/*
+ * Return the total number of edges on the board. Edges are numbered from 0
+ * with every horizontal (in HEDGE order) before every vertical (in VEDGE
+ * order).
+ */
+long
+edge_count(struct game *g)
+{
+    return (long)(g->height + 1) * g->width +
+            (long)g->height * (g->width + 1);
+}
+
+/*
+ * Return the number of the edge at (x, y).
+ */
+long
+edge_index(int x, int y, int vertical, struct game *g)
+{
+    if (vertical) {
+        return (long)(g->height + 1) * g->width + VEDGE(g, (long)x, y);
+    }
+
+    return HEDGE(g, (long)x, y);
+}
+
+/*
+ * Return the number of the edge at (x, y), or -1 if g has no such edge.
+ * Verticals go one further across than horizontals and horizontals one
+ * further down.
+ */
+long
+find_edge(long x, long y, int vertical, struct game *g)
+{
+    if (x < 0 || y < 0 || x >= g->width + vertical ||
+            y >= g->height + !vertical) {
+        return -1;
+    }
+
+    return edge_index(x, y, vertical, g);
+}
+
+/*
+ * Parse the move m, "y x h|v" as typed at the prompt, into its position and
+ * direction. The position isn't checked against any board.
+ *
+ * Returns 0 if m is well formed, otherwise 1.
+ */
+int
+parse_move(char const *m, long *x, long *y, int *vertical)
+{
+    char *err;
+
+    *y = strtol(m, &err, 10);
+    if (*err != ' ' || *y < 0 || *y > MAX_DIM) {
+        return 1;
+    }
+
+    m = err + 1;
+    *x = strtol(m, &err, 10);
+    if (*err != ' ' || *x < 0 || *x > MAX_DIM) {
+        return 1;
+    }
+
+    if ((err[1] != 'v' && err[1] != 'h') || err[2] != '\0') {
+        return 1;
+    }
+    *vertical = err[1] == 'v';
+
+    return 0;
+}
+
+/*
+ * Turn edge number e back into its position and direction.
+ */
+void
+edge_coords(long e, int *x, int *y, int *vertical, struct game *g)
+{
+    long horizontals = (long)(g->height + 1) * g->width;
+
+    if ((*vertical = e >= horizontals)) {
+        e -= horizontals;
+        *y = e / (g->width + 1);
+        *x = e % (g->width + 1);
+    } else {
+        *y = e / g->width;
+        *x = e % g->width;
+    }
+}
+
+/*
+ * Apply symmetry t to the dot (px, py) of a board whose dots run from 0 to
+ * w across and 0 to h down. The first four work on any board, the last four
+ * only when it is square.
+ */
+static void
+map_dot(int t, int px, int py, int w, int h, int *qx, int *qy)
+{
+    switch (t) {
+        case 0:
+            *qx = px;
+            *qy = py;
+            break;
+        case 1:
+            *qx = w - px;
+            *qy = py;
+            break;
+        case 2:
+            *qx = px;
+            *qy = h - py;
+            break;
+        case 3:
+            *qx = w - px;
+            *qy = h - py;
+            break;
+        case 4:
+            *qx = py;
+            *qy = px;
+            break;
+        case 5:
+            *qx = h - py;
+            *qy = px;
+            break;
+        case 6:
+            *qx = py;
+            *qy = w - px;
+            break;
+        default:
+            *qx = h - py;
+            *qy = w - px;
+            break;
+    }
+}
+
+/*
+ * Return how many symmetries the board in g has: 8 if it is square,
+ * otherwise the 4 reflections and the half turn.
+ */
+int
+symmetry_count(struct game *g)
+{
+    return g->width == g->height ? 8 : 4;
+}
+
+/*
+ * Return the number of the edge that symmetry t (below symmetry_count)
+ * sends edge e to, found by moving the dots at its two ends.
+ */
+long
+map_edge(int t, long e, struct game *g)
+{
+    int x, y, vertical, x1, y1, x2, y2;
+
+    edge_coords(e, &x, &y, &vertical, g);
+    map_dot(t, x, y, g->width, g->height, &x1, &y1);
+    map_dot(t, x + !vertical, y + vertical, g->width, g->height, &x2, &y2);
+
+    if (y1 == y2) {
+        return edge_index(x1 < x2 ? x1 : x2, y1, 0, g);
+    }
+    return edge_index(x1, y1 < y2 ? y1 : y2, 1, g);
+}
+
+/*
+ * Return whether edge number e is filled.
+ */
+int
+edge_filled(long e, struct game *g)
+{
+    int x, y, vertical;
+
+    edge_coords(e, &x, &y, &vertical, g);
+
+    return vertical ? vedge_filled(x, y, g) : hedge_filled(x, y, g);
+}
+
+/*
+ * Return the bits of the 64 positions starting at start that are below
+ * limit.
+ */
+static uint64_t
+span_mask(long start, long limit)
+{
+    if (limit - start >= WORD_BITS) {
+        return ~(uint64_t)0;
+    }
+
+    return limit <= start ? 0 : ((uint64_t)1 << (limit - start)) - 1;
+}
+
+/*
+ * Return the first free edge at or after x in row y of the verticals, or of
+ * the horizontals if vertical is clear, where a row is limit edges long.
+ * Returns -1 if the rest of the row is filled.
+ *
+ * Each tile row is one word, so this takes a bit scan per tile rather than
+ * a test per edge, and a missing tile is free all the way across.
+ */
+static long
+free_in_row(long x, long y, long limit, int vertical, struct game *g)
+{
+    struct tile *t;
+    uint64_t free;
+    long base;
+
+    for (; x < limit; x = base + TILE_SIZE) {
+        base = x & ~(long)TILE_MASK;
+        t = tile_at(x, y, g);
+        free = t == NULL ? ~(uint64_t)0 :
+                ~(vertical ? t->vedges : t->hedges)[y & TILE_MASK];
+        free &= span_mask(base, limit) & (~(uint64_t)0 << (x - base));
+        if (free != 0) {
+            return base + __builtin_ctzll(free);
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Return the number of the first free edge of g numbered e or more, or -1
+ * if there are none. Starting from 0 and going on from one past each edge
+ * returned visits every free edge in order:
+ *
+ *     for (e = next_free_edge(0, g); e >= 0; e = next_free_edge(e + 1, g))
+ *
+ * Filling or clearing edges before e along the way doesn't upset this.
+ */
+long
+next_free_edge(long e, struct game *g)
+{
+    long horizontals = (long)(g->height + 1) * g->width, x, y, found;
+
+    for (y = e / g->width, x = e % g->width; e < horizontals;
+            x = 0, e = ++y * g->width) {
+        if ((found = free_in_row(x, y, g->width, 0, g)) >= 0) {
+            return HEDGE(g, found, y);
+        }
+    }
+
+    e -= horizontals;
+    for (y = e / (g->width + 1), x = e % (g->width + 1); y < g->height;
+            x = 0, ++y) {
+        if ((found = free_in_row(x, y, g->width + 1, 1, g)) >= 0) {
+            return horizontals + VEDGE(g, found, y);
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Return how many boxes filling the free edge number e would close.
+ */
+int
+edge_closes(long e, struct game *g)
+{
+    int x, y, vertical, bx[2], by[2], n, i, closes = 0;
+
+    edge_coords(e, &x, &y, &vertical, g);
+    n = edge_boxes(x, y, vertical, bx, by, g);
+    for (i = 0; i < n; ++i) {
+        closes += box_sides(bx[i], by[i], g) == 3;
+    }
+
+    return closes;
+}
+
+/*
+ * Fill the free edge number e for the current player, make it the last
+ * move and give them any boxes it closes, whose numbers go in closed. The
+ * turn is left alone, so this and untake_edge make a make/unmake pair for
+ * search code.
+ *
+ * Returns -1 if the edge is already filled, otherwise the number of boxes
+ * closed.
+ */
+int
+take_edge(long e, long *closed, struct game *g)
+{
+    int x, y, vertical, bx[2], by[2], n, i, count = 0;
+    struct tile *t;
+
+    edge_coords(e, &x, &y, &vertical, g);
+    if (vertical ? vedge_filled(x, y, g) : hedge_filled(x, y, g)) {
+        return -1;
+    }
+    fill_edge(x, y, vertical, g);
+    g->last_x = x;
+    g->last_y = y;
+    g->last_vertical = vertical;
+
+    /* The same job as check_closures, so it is timed as that. */
+    PROFILE_BEGIN(pt);
+    n = edge_boxes(x, y, vertical, bx, by, g);
+    for (i = 0; i < n; ++i) {
+        t = tile_at(bx[i], by[i], g);
+        if (t->sides[TILE_BOX(bx[i], by[i])] == 4 &&
+                t->owners[TILE_BOX(bx[i], by[i])] == 0) {
+            t->owners[TILE_BOX(bx[i], by[i])] = g->current_player + 1;
+            g->close_count++;
+            g->scores[g->current_player]++;
+            SET_BIT(g->dirty_rows, 2 * by[i] + 1);
+            closed[count++] = BOX(g, bx[i], by[i]);
+        }
+    }
+    PROFILE_END(PROBE_CHECK_CLOSURES, pt);
+
+    return count;
+}
+
+/*
+ * Undo take_edge(e, closed) by player, which returned n. The last move is
+ * left for the caller to put back.
+ */
+void
+untake_edge(long e, long const *closed, int n, int player, struct game *g)
+{
+    int x, y, vertical, i;
+
+    for (i = 0; i < n; ++i) {
+        x = closed[i] % g->width;
+        y = closed[i] / g->width;
+        tile_at(x, y, g)->owners[TILE_BOX(x, y)] = 0;
+        g->close_count--;
+        g->scores[player]--;
+        SET_BIT(g->dirty_rows, 2 * y + 1);
+    }
+
+    edge_coords(e, &x, &y, &vertical, g);
+    clear_edge(x, y, vertical, g);
+}
+
+/*
+ * Check all possible closures that could result from filling the edge at
+ * position (x, y) in the grid.
+ *
+ * If a closure is detected then the current player is rolled back so that
+ * the next player is the current player. This is a bit of a hack because I
+ * forgot about it until too late to do it nicely.
+ */
+void
+check_closures(int x, int y, struct game *g)
+{
+    long starting_closed = g->close_count;
+    PROFILE_BEGIN(t);
+
+    check_single_closure(x - 1, y - 1, g);
+    check_single_closure(x, y - 1, g);
+    check_single_closure(x - 1, y, g);
+    check_single_closure(x, y, g);
+
+    /* Easier than returning stuff... */
+    if (g->close_count != starting_closed) {
+        g->current_player = g->current_player == 0 ? g->num_players - 1 :
+                g->current_player - 1;
+    }
+
+    PROFILE_END(PROBE_CHECK_CLOSURES, t);
+}
+
+/*
+ * Check if the box at (x, y) is fully enclosed.
+ * If it is then the game state is updated to reflect this box as now beign
+ * taken.
+ */
+void
+check_single_closure(int x, int y, struct game *g)
+{
+    /* Don't bother checking if it goes outside the grid. */
+    if (x >= 0 && x < g->width && y >= 0 && y < g->height) {
+        if (box_sides(x, y, g) == 4 && box_owner(x, y, g) == 0) {
+            tile_at(x, y, g)->owners[TILE_BOX(x, y)] = g->current_player + 1;
+            SET_BIT(g->dirty_rows, 2 * y + 1);
+            g->close_count++;
+            g->scores[g->current_player]++;
+        }
+    }
+}
+
+/*
+ * Fill in the edge at (x, y) for the current player and pass the turn on,
+ * unless the edge closed a box in which case they go again.
+ *
+ * If the edge is not in the grid or already filled return 1, otherwise 0.
+ */
+int
+make_move(int x, int y, int vertical, struct game *g)
+{
+    if ((vertical ? place_verticle_edge(x, y, g) :
+            place_horizontal_edge(x, y, g)) != 0) {
+        return 1;
+    }
+
+    /* check_closures has already wound the player back if they go again. */
+    g->current_player = (g->current_player + 1) % g->num_players;
+
+    return 0;
+}
+
+/*
+ * Return whether every box in g has been taken.
+ */
+int
+check_game_over(struct game *g)
+{
+    return g->close_count == g->possible_closures;
+}
+
+/*
+ * Put the players with the highest score in g into winners, in order.
+ * Returns how many there are.
+ */
+int
+find_winners(struct game *g, int *winners)
+{
+    long max = 0;
+    int n = 0, i;
+
+    for (i = 0; i < g->num_players; ++i) {
+        if (g->scores[i] > max) {
+            max = g->scores[i];
+        }
+    }
+
+    for (i = 0; i < g->num_players; ++i) {
+        if (g->scores[i] == max) {
+            winners[n++] = i;
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Set up g with an empty initial game state.
+ *
+ * Only the table of tile pointers is allocated up front; tiles come into
+ * being as play reaches them.
+ */
+void
+allocate_empty_grid(struct game *g)
+{
+    g->tiles_w = (g->width >> TILE_SHIFT) + 1;
+    g->tiles_h = (g->height >> TILE_SHIFT) + 1;
+    g->tiles = calloc((size_t)g->tiles_w * g->tiles_h, sizeof(struct tile *));
+    g->tile_count = 0;
+
+    /* The first frame has to draw everything. */
+    g->dirty_rows = malloc(WORDS_FOR(g->height * 2 + 1) * sizeof(uint64_t));
+    memset(g->dirty_rows, 0xff,
+            WORDS_FOR(g->height * 2 + 1) * sizeof(uint64_t));
+    g->last_x = -1;
+
+    /* Every box starts with no sides and every edge starts out safe. */
+    memset(g->side_totals, 0, sizeof(g->side_totals));
+    g->side_totals[0] = (long)g->height * g->width;
+    g->safe_edges = edge_count(g);
+}
+
+/*
+ * Give back everything allocate_empty_grid got for g.
+ */
+void
+free_grid(struct game *g)
+{
+    long i;
+
+    chains_disable(g);
+    edge_sets_disable(g);
+    for (i = 0; i < (long)g->tiles_w * g->tiles_h; ++i) {
+        free(g->tiles[i]);
+    }
+    for (i = 0; i < g->spare_count; ++i) {
+        free(g->spare[i]);
+    }
+    free(g->tiles);
+    free(g->dirty_rows);
+    free(g->spare);
+    g->tiles = NULL;
+    g->dirty_rows = NULL;
+    g->spare = NULL;
+    g->spare_count = 0;
+    g->spare_cap = 0;
+}
+
+/*
+ * Empty the board in g and make it height by width, for loading or playing
+ * another game with the same number of players on it. The tiles it had are
+ * kept aside for touch_tile to reuse, and the table of them is only
+ * allocated again if the size changes, so going through many boards this
+ * way soon stops allocating at all.
+ */
+void
+reset_grid(int height, int width, struct game *g)
+{
+    long i, n = (long)g->tiles_w * g->tiles_h;
+
+    chains_disable(g);
+    edge_sets_disable(g);
+    if (g->spare_count + g->tile_count > g->spare_cap) {
+        g->spare_cap = (g->spare_count + g->tile_count) * 2;
+        g->spare = realloc(g->spare, g->spare_cap * sizeof(struct tile *));
+    }
+    for (i = 0; i < n; ++i) {
+        if (g->tiles[i] != NULL) {
+            g->spare[g->spare_count++] = g->tiles[i];
+        }
+    }
+
+    if (height != g->height || width != g->width) {
+        free(g->tiles);
+        free(g->dirty_rows);
+        g->height = height;
+        g->width = width;
+        g->possible_closures = (long)height * width;
+        allocate_empty_grid(g);
+    } else {
+        memset(g->tiles, 0, n * sizeof(struct tile *));
+        g->tile_count = 0;
+        memset(g->dirty_rows, 0xff,
+                WORDS_FOR(g->height * 2 + 1) * sizeof(uint64_t));
+        g->last_x = -1;
+        memset(g->side_totals, 0, sizeof(g->side_totals));
+        g->side_totals[0] = (long)g->height * g->width;
+        g->safe_edges = edge_count(g);
+    }
+
+    memset(g->scores, 0, sizeof(g->scores));
+    g->close_count = 0;
+    g->current_player = 0;
+}
+
+/*
+ * Make to a copy of from that shares nothing with it, so the two can be
+ * played on separately (by different threads, say). Only tiles that exist
+ * are copied. The copy doesn't keep chains or edge sets even if from
+ * does.
+ */
+void
+copy_grid(struct game *to, struct game const *from)
+{
+    long i;
+
+    *to = *from;
+    to->chains = NULL;
+    to->edge_sets = NULL;
+    to->spare = NULL;
+    to->spare_count = 0;
+    to->spare_cap = 0;
+    allocate_empty_grid(to);
+    memcpy(to->side_totals, from->side_totals, sizeof(from->side_totals));
+    to->safe_edges = from->safe_edges;
+    to->last_x = from->last_x;
+
+    for (i = 0; i < (long)from->tiles_w * from->tiles_h; ++i) {
+        if (from->tiles[i] != NULL) {
+            to->tiles[i] = malloc(sizeof(struct tile));
+            memcpy(to->tiles[i], from->tiles[i], sizeof(struct tile));
+            to->tile_count++;
+        }
+    }
+}
+
+/*
+ * Return the tile holding box (x, y), or the edges along its top and left,
+ * allocating it if this is the first time it has been needed.
+ */
+struct tile *
+touch_tile(long x, long y, struct game *g)
+{
+    struct tile **t;
+
+    t = &g->tiles[(y >> TILE_SHIFT) * g->tiles_w + (x >> TILE_SHIFT)];
+    if (*t == NULL && g->spare_count > 0) {
+        *t = g->spare[--g->spare_count];
+        memset(*t, 0, sizeof(struct tile));
+        g->tile_count++;
+    } else if (*t == NULL) {
+        *t = calloc(1, sizeof(struct tile));
+        g->tile_count++;
+    }
+
+    return *t;
+}
+
+/*
+ * Fill line with row i of the ASCII picture of g, covering boxes x0 up to
+ * but not including x1, and finish it with a newline. Returns the length.
+ */
+static int
+render_row(char *line, int i, int x0, int x1, struct game *g)
+{
+    int x, y = i / 2, n = 0, owner;
+
+    for (x = x0; x < x1; ++x) {
+        if (i % 2 == 0) {
+            line[n++] = '+';
+            line[n++] = hedge_filled(x, y, g) ? '-' : ' ';
+        } else {
+            owner = box_owner(x, y, g);
+            line[n++] = vedge_filled(x, y, g) ? '|' : ' ';
+            line[n++] = owner ? owner - 1 + 'A' : ' ';
+        }
+    }
+
+    if (i % 2 == 0) {
+        line[n++] = '+';
+    } else {
+        line[n++] = vedge_filled(x, y, g) ? '|' : ' ';
+    }
+    line[n++] = '\n';
+
+    return n;
+}
+
+/*
+ * Hand the n bytes at buf to the stdio file ctx for write_game and
+ * write_grid.
+ */
+static int
+write_stdio(void *ctx, char const *buf, size_t n)
+{
+    return fwrite(buf, 1, n, ctx) != n;
+}
+
+/*
+ * Print the grid in g to file f.
+ */
+void
+print_grid(FILE *f, struct game *g)
+{
+    PROFILE_BEGIN(t);
+
+    write_grid(write_stdio, f, g);
+
+    PROFILE_END(PROBE_PRINT_GRID, t);
+}
+
+/*
+ * Draw the grid in g by handing it to write along with ctx a row at a
+ * time. write returns nonzero if it failed.
+ *
+ * Each row of the picture is built from the bit planes into a scratch line
+ * as it is needed. Returns 1 if a write failed, otherwise 0.
+ */
+int
+write_grid(int (*write)(void *ctx, char const *buf, size_t n), void *ctx,
+        struct game *g)
+{
+    char *line = malloc(g->width * 2 + 2);
+    int i, failed = 0;
+
+    for (i = 0; i < g->height * 2 + 1 && !failed; ++i) {
+        failed = write(ctx, line, render_row(line, i, 0, g->width, g));
+    }
+
+    free(line);
+
+    return failed;
+}
+
+/*
+ * Draw g to f the way v asks for:
+ *
+ * RENDER_FULL prints the picture, cropped to the window if there is one.
+ * RENDER_DELTA prints only the rows of the picture (in the window) that
+ *     changed since the last call, each prefixed with its row number and a
+ *     colon. The first call prints every row.
+ * RENDER_SUMMARY prints the last move and the scores instead.
+ */
+void
+print_view(FILE *f, struct view *v, struct game *g)
+{
+    int x0 = 0, x1 = g->width, r0 = 0, r1 = g->height * 2 + 1, i;
+    char *line;
+
+    if (v->mode == RENDER_SUMMARY) {
+        if (g->last_x < 0) {
+            fprintf(f, "Last move: none\n");
+        } else {
+            fprintf(f, "Last move: %d %d %c\n", g->last_y, g->last_x,
+                    g->last_vertical ? 'v' : 'h');
+        }
+        print_scores(f, g);
+    } else if (v->mode == RENDER_FULL && v->width == 0) {
+        print_grid(f, g);
+    } else {
+        /* Clip the window to the board. */
+        if (v->width != 0) {
+            x0 = v->x < g->width ? v->x : g->width;
+            x1 = v->x + v->width < g->width ? v->x + v->width : g->width;
+            r0 = v->y < g->height ? 2 * v->y : 2 * g->height;
+            r1 = v->y + v->height < g->height ?
+                    2 * (v->y + v->height) + 1 : 2 * g->height + 1;
+        }
+
+        line = malloc((x1 - x0) * 2 + 2);
+        for (i = r0; i < r1; ++i) {
+            if (v->mode == RENDER_DELTA) {
+                if (!TEST_BIT(g->dirty_rows, i)) {
+                    continue;
+                }
+                fprintf(f, "%d:", i);
+            }
+            fwrite(line, 1, render_row(line, i, x0, x1, g), f);
+        }
+        free(line);
+    }
+
+    memset(g->dirty_rows, 0, WORDS_FOR(g->height * 2 + 1) * sizeof(uint64_t));
+}
+
+/*
+ * Write all of iov[0..n) to fd, however many goes it takes. Returns 0 on
+ * success and 1 if the write failed.
+ */
+static int
+write_iov(int fd, struct iovec *iov, int n)
+{
+    ssize_t done;
+    int i = 0;
+
+    while (i < n) {
+        if ((done = writev(fd, iov + i, n - i)) < 0) {
+            return 1;
+        }
+        for (; i < n && (size_t)done >= iov[i].iov_len; ++i) {
+            done -= iov[i].iov_len;
+        }
+        if (i < n) {
+            iov[i].iov_base = (char *)iov[i].iov_base + done;
+            iov[i].iov_len -= done;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Save the game state in g to fd in the binary format: a struct save_header
+ * followed by one record per allocated tile, which is the tile's column and
+ * row as two 32 bit words and then its hedges, vedges and owners exactly as
+ * they are laid out in memory. Missing tiles are empty. Everything is in
+ * native byte order.
+ *
+ * The header is stamped with serial. Tiles are streamed out SAVE_BATCH at
+ * a time with writev. Returns 0 on success and 1 if the write failed.
+ */
+int
+save_binary(int fd, uint32_t serial, struct game *g)
+{
+    struct save_header hdr = { SAVE_MAGIC, SAVE_VERSION, 0, 0, 0, 0, 0, 0 };
+    struct iovec iov[2 * SAVE_BATCH + 1];
+    uint32_t coords[SAVE_BATCH][2];
+    long tx, ty;
+    int n = 0, k = 0;
+
+    hdr.height = g->height;
+    hdr.width = g->width;
+    hdr.num_players = g->num_players;
+    hdr.current_player = g->current_player;
+    hdr.tiles = g->tile_count;
+    hdr.serial = serial;
+
+    iov[n].iov_base = &hdr;
+    iov[n++].iov_len = sizeof(hdr);
+
+    for (ty = 0; ty < g->tiles_h; ++ty) {
+        for (tx = 0; tx < g->tiles_w; ++tx) {
+            if (g->tiles[ty * g->tiles_w + tx] == NULL) {
+                continue;
+            }
+
+            coords[k][0] = tx;
+            coords[k][1] = ty;
+            iov[n].iov_base = coords[k++];
+            iov[n++].iov_len = sizeof(coords[0]);
+            iov[n].iov_base = g->tiles[ty * g->tiles_w + tx];
+            iov[n++].iov_len = TILE_RECORD;
+
+            if (k == SAVE_BATCH) {
+                if (write_iov(fd, iov, n)) {
+                    return 1;
+                }
+                n = k = 0;
+            }
+        }
+    }
+
+    return write_iov(fd, iov, n);
+}
+
+/*
+ * Return a mask with a bit for each of the TILE_SIZE owners from owners on
+ * that is set. Eight are tested at a time: adding 0x7f to the low seven
+ * bits of each byte carries into its top bit unless they were all clear,
+ * and the top bits are then gathered into one byte by a multiply.
+ */
+static uint64_t
+owned_mask(unsigned char const *owners)
+{
+    uint64_t mask = 0, w, high;
+    int i;
+
+    for (i = 0; i < TILE_SIZE; i += 8) {
+        memcpy(&w, owners + i, sizeof(w));
+        high = (((w & 0x7f7f7f7f7f7f7f7fULL) + 0x7f7f7f7f7f7f7f7fULL) | w) &
+                0x8080808080808080ULL;
+        mask |= ((high >> 7) * 0x0102040810204080ULL >> 56) << i;
+    }
+
+    return mask;
+}
+
+/*
+ * Recompute the side counters, their totals, the safe edge count, the
+ * scores and the number of closed boxes in g from its edges and owners.
+ * Only allocated tiles are looked at, so this costs nothing for the empty
+ * parts of a sparse board.
+ *
+ * Along the way each row of a tile has its four sides ANDed together a
+ * word at a time to find the closed boxes, which must be exactly the owned
+ * ones.
+ *
+ * Returns 1 if some box is closed without an owner or owned without being
+ * closed, otherwise 0.
+ */
+int
+rebuild_counters(struct game *g)
+{
+    struct tile *t, *below, *right;
+    uint64_t top, bottom, left, edge_right, boxes, owned;
+    long tx, ty, x, y, filled = 0, unsafe = 0, sided = 0;
+    int r, i, s, bad = 0;
+
+    memset(g->side_totals, 0, sizeof(g->side_totals));
+    memset(g->scores, 0, sizeof(g->scores));
+    g->close_count = 0;
+
+    /*
+     * Edges along the top row and left column of a tile also border boxes
+     * in the tiles above and to the left, which have to exist to count
+     * them. Tiles made here have no edges so one pass is enough.
+     */
+    for (ty = 0; ty < g->tiles_h; ++ty) {
+        for (tx = 0; tx < g->tiles_w; ++tx) {
+            if ((t = g->tiles[ty * g->tiles_w + tx]) == NULL) {
+                continue;
+            }
+            if (ty > 0 && t->hedges[0] != 0) {
+                touch_tile(tx << TILE_SHIFT, (ty << TILE_SHIFT) - 1, g);
+            }
+            for (r = 0; tx > 0 && r < TILE_SIZE; ++r) {
+                if (t->vedges[r] & 1) {
+                    touch_tile((tx << TILE_SHIFT) - 1, ty << TILE_SHIFT, g);
+                    break;
+                }
+            }
+        }
+    }
+
+    for (ty = 0; ty < g->tiles_h; ++ty) {
+        for (tx = 0; tx < g->tiles_w; ++tx) {
+            if ((t = g->tiles[ty * g->tiles_w + tx]) == NULL) {
+                continue;
+            }
+            below = ty + 1 < g->tiles_h ?
+                    g->tiles[(ty + 1) * g->tiles_w + tx] : NULL;
+            right = tx + 1 < g->tiles_w ?
+                    g->tiles[ty * g->tiles_w + tx + 1] : NULL;
+
+            for (r = 0; r < TILE_SIZE; ++r) {
+                filled += __builtin_popcountll(t->hedges[r]) +
+                        __builtin_popcountll(t->vedges[r]);
+
+                y = (ty << TILE_SHIFT) + r;
+                if (y >= g->height) {
+                    continue;
+                }
+
+                top = t->hedges[r];
+                bottom = r + 1 < TILE_SIZE ? t->hedges[r + 1] :
+                        below != NULL ? below->hedges[0] : 0;
+                left = t->vedges[r];
+                edge_right = (left >> 1) |
+                        (right != NULL ? right->vedges[r] << 63 : 0);
+                boxes = span_mask(tx << TILE_SHIFT, g->width);
+                owned = owned_mask(&t->owners[r * TILE_SIZE]);
+
+                bad |= (top & bottom & left & edge_right & boxes) != owned;
+                g->close_count += __builtin_popcountll(owned);
+                for (; owned != 0; owned &= owned - 1) {
+                    g->scores[t->owners[r * TILE_SIZE +
+                            __builtin_ctzll(owned)] - 1]++;
+                }
+
+                for (i = 0; i < TILE_SIZE && ((boxes >> i) & 1); ++i) {
+                    s = ((top >> i) & 1) + ((bottom >> i) & 1) +
+                            ((left >> i) & 1) + ((edge_right >> i) & 1);
+                    t->sides[r * TILE_SIZE + i] = s;
+                    g->side_totals[s]++;
+                    sided += s != 0;
+                }
+            }
+        }
+    }
+    g->side_totals[0] = (long)g->height * g->width - sided;
+
+    /*
+     * A free edge is unsafe if a box either side of it has two sides. Each
+     * one is counted from the box above or to the left of it, unless that
+     * box doesn't qualify.
+     */
+    for (ty = 0; ty < g->tiles_h; ++ty) {
+        for (tx = 0; tx < g->tiles_w; ++tx) {
+            if ((t = g->tiles[ty * g->tiles_w + tx]) == NULL) {
+                continue;
+            }
+            for (i = 0; i < TILE_SIZE * TILE_SIZE; ++i) {
+                x = (tx << TILE_SHIFT) + (i & TILE_MASK);
+                y = (ty << TILE_SHIFT) + (i >> TILE_SHIFT);
+                if (t->sides[i] < 2 || x >= g->width || y >= g->height) {
+                    continue;
+                }
+                unsafe += !hedge_filled(x, y + 1, g);
+                unsafe += !vedge_filled(x + 1, y, g);
+                unsafe += !hedge_filled(x, y, g) &&
+                        (y == 0 || box_sides(x, y - 1, g) < 2);
+                unsafe += !vedge_filled(x, y, g) &&
+                        (x == 0 || box_sides(x - 1, y, g) < 2);
+            }
+        }
+    }
+
+    g->safe_edges = edge_count(g) - filled - unsafe;
+
+    return bad;
+}
+
+/*
+ * Return the n (at most 64) bits of plane starting at bit pos.
+ */
+static uint64_t
+get_bits(uint64_t const *plane, size_t pos, int n)
+{
+    unsigned shift = pos % WORD_BITS;
+    uint64_t w = plane[pos / WORD_BITS] >> shift;
+
+    if (shift != 0 && shift + n > WORD_BITS) {
+        w |= plane[pos / WORD_BITS + 1] << (WORD_BITS - shift);
+    }
+
+    return n == WORD_BITS ? w : w & (((uint64_t)1 << n) - 1);
+}
+
+/*
+ * Load the planes of a version 1 binary save, which held every edge of
+ * the board as one dense bit plane each for horizontals and verticals
+ * followed by one owner byte per box. The caller has checked the size.
+ * Returns 1 if an owner is out of range, otherwise 0.
+ */
+static int
+read_dense_planes(unsigned char const *data, struct game *g)
+{
+    size_t hwords = WORDS_FOR((size_t)(g->height + 1) * g->width);
+    size_t vwords = WORDS_FOR((size_t)g->height * (g->width + 1));
+    uint64_t *planes = malloc((hwords + vwords) * sizeof(uint64_t)), bits;
+    unsigned char const *owners = data + (hwords + vwords) * sizeof(uint64_t);
+    long x, y;
+    int n;
+
+    memcpy(planes, data, (hwords + vwords) * sizeof(uint64_t));
+
+    for (y = 0; y <= g->height; ++y) {
+        for (x = 0; x <= g->width; x += TILE_SIZE) {
+            n = g->width - x < TILE_SIZE ? g->width - x : TILE_SIZE;
+            if (n > 0 && (bits = get_bits(planes, HEDGE(g, x, y), n))) {
+                touch_tile(x, y, g)->hedges[y & TILE_MASK] |= bits;
+            }
+            n = g->width + 1 - x < TILE_SIZE ? g->width + 1 - x : TILE_SIZE;
+            if (y < g->height &&
+                    (bits = get_bits(planes + hwords, VEDGE(g, x, y), n))) {
+                touch_tile(x, y, g)->vedges[y & TILE_MASK] |= bits;
+            }
+        }
+    }
+    free(planes);
+
+    for (y = 0; y < g->height; ++y) {
+        for (x = 0; x < g->width; ++x) {
+            if (owners[BOX(g, x, y)] > g->num_players) {
+                return 1;
+            } else if (owners[BOX(g, x, y)] != 0) {
+                touch_tile(x, y, g)->owners[TILE_BOX(x, y)] =
+                        owners[BOX(g, x, y)];
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Load the tile records of a version 2 binary save (see save_binary). The
+ * caller has checked the size. Returns 1 if a record is for a tile that is
+ * off the board or repeated, or has edges or owners that are off the board
+ * or owners that are out of range, otherwise 0.
+ */
+static int
+read_tiles(unsigned char const *data, long count, struct game *g)
+{
+    struct tile *t;
+    uint32_t coords[2];
+    uint64_t boxes;
+    long i, y;
+    int r, k;
+
+    for (i = 0; i < count; ++i, data += sizeof(coords) + TILE_RECORD) {
+        memcpy(coords, data, sizeof(coords));
+        if (coords[0] >= (uint32_t)g->tiles_w ||
+                coords[1] >= (uint32_t)g->tiles_h ||
+                g->tiles[coords[1] * g->tiles_w + coords[0]] != NULL) {
+            return 1;
+        }
+
+        t = touch_tile((long)coords[0] << TILE_SHIFT,
+                (long)coords[1] << TILE_SHIFT, g);
+        memcpy(t, data + sizeof(coords), TILE_RECORD);
+
+        for (r = 0; r < TILE_SIZE; ++r) {
+            y = ((long)coords[1] << TILE_SHIFT) + r;
+            boxes = y < g->height ?
+                    span_mask((long)coords[0] << TILE_SHIFT, g->width) : 0;
+
+            if ((t->hedges[r] & ~(y <= g->height ? span_mask(
+                    (long)coords[0] << TILE_SHIFT, g->width) : 0)) != 0 ||
+                    (t->vedges[r] & ~(y < g->height ? span_mask(
+                    (long)coords[0] << TILE_SHIFT, g->width + 1) : 0)) != 0) {
+                return 1;
+            }
+            for (k = 0; k < TILE_SIZE; ++k) {
+                if (t->owners[r * TILE_SIZE + k] > g->num_players ||
+                        (t->owners[r * TILE_SIZE + k] != 0 &&
+                        !((boxes >> k) & 1))) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Load a binary save (see save_binary) of len bytes at data into g. Saves
+ * from version 1, which stored the whole board densely, are still read.
+ *
+ * The header must match the dimensions of g and every player number in it
+ * must be valid for g, otherwise LOAD_CONTENTS is returned as for a bad
+ * text save. Returns LOAD_OK if it loaded.
+ */
+int
+read_binary_save(char const *data, size_t len, struct game *g)
+{
+    struct save_header hdr;
+    size_t dense = (WORDS_FOR((size_t)(g->height + 1) * g->width) +
+            WORDS_FOR((size_t)g->height * (g->width + 1))) * sizeof(uint64_t) +
+            (size_t)g->height * g->width;
+    int bad = 1;
+
+    if (len >= sizeof(hdr)) {
+        memcpy(&hdr, data, sizeof(hdr));
+        bad = memcmp(hdr.magic, SAVE_MAGIC, 4) != 0 ||
+                hdr.height != (uint32_t)g->height ||
+                hdr.width != (uint32_t)g->width ||
+                hdr.current_player >= (uint32_t)g->num_players;
+    }
+
+    if (bad) {
+        /* Already bad. */
+    } else if (hdr.version == 1 && len == sizeof(hdr) + dense) {
+        bad = read_dense_planes((unsigned char const *)data + sizeof(hdr), g);
+    } else if (hdr.version == SAVE_VERSION && len == sizeof(hdr) +
+            (size_t)hdr.tiles * (2 * sizeof(uint32_t) + TILE_RECORD)) {
+        bad = read_tiles((unsigned char const *)data + sizeof(hdr),
+                hdr.tiles, g);
+    } else {
+        bad = 1;
+    }
+
+    if (bad || rebuild_counters(g)) {
+        return LOAD_CONTENTS;
+    }
+
+    g->current_player = hdr.current_player;
+
+    return LOAD_OK;
+}
+
+/*
+ * Return the serial save_binary stamped the binary save at path with, or 0
+ * if it can't be read or isn't a binary save.
+ */
+uint32_t
+save_serial(char const *path)
+{
+    struct save_header hdr;
+    int fd = open(path, O_RDONLY);
+    ssize_t n = fd < 0 ? -1 : read(fd, &hdr, sizeof(hdr));
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (n != sizeof(hdr) || memcmp(hdr.magic, SAVE_MAGIC, 4) != 0) {
+        return 0;
+    }
+
+    return hdr.serial;
+}
+
+/*
+ * Load 8 bytes from p as a word with p[0] in the low byte.
+ */
+static uint64_t
+load_bytes(char const *p)
+{
+    uint64_t w;
+
+    memcpy(&w, p, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+/*
+ * Store w to p as 8 bytes with the low byte of w at p[0].
+ */
+static void
+store_bytes(char *p, uint64_t w)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    memcpy(p, &w, sizeof(w));
+}
+
+/*
+ * Write edge row y of g, horizontal or vertical, to out as '0'/'1'
+ * characters followed by a newline. Returns the number of bytes written.
+ *
+ * The row is taken a tile word at a time, missing tiles being all '0', and
+ * spread out to 8 characters at a time.
+ */
+static size_t
+format_edge_row(char *out, long y, int vertical, struct game *g)
+{
+    struct tile *t;
+    uint64_t word, w;
+    long len = g->width + vertical, x;
+    int i, n;
+
+    for (x = 0; x < len; x += TILE_SIZE) {
+        t = tile_at(x, y, g);
+        word = t == NULL ? 0 : vertical ? t->vedges[y & TILE_MASK] :
+                t->hedges[y & TILE_MASK];
+        n = len - x < TILE_SIZE ? len - x : TILE_SIZE;
+
+        for (i = 0; i + 8 <= n; i += 8) {
+            w = BYTES((word >> i) & 0xff) & 0x8040201008040201ULL;
+            w = ((w + BYTES(0x7f)) >> 7) & BYTES(1);
+            store_bytes(out + x + i, w | BYTES('0'));
+        }
+        for (; i < n; ++i) {
+            out[x + i] = (word >> i) & 1 ? '1' : '0';
+        }
+    }
+    out[len] = '\n';
+
+    return len + 1;
+}
+
+/*
+ * Write the owner number o followed by sep to out. Returns the number of
+ * bytes written.
+ */
+static size_t
+format_owner(char *out, int o, char sep)
+{
+    size_t n = 0;
+
+    if (o >= 100) {
+        out[n++] = '0' + o / 100;
+    }
+    if (o >= 10) {
+        out[n++] = '0' + o / 10 % 10;
+    }
+    out[n++] = '0' + o % 10;
+    out[n++] = sep;
+
+    return n;
+}
+
+/*
+ * Save the game state in g to file f. Will always succeed.
+ */
+void
+save_game(FILE *f, struct game *g)
+{
+    PROFILE_BEGIN(t);
+
+    write_game(write_stdio, f, g);
+
+    PROFILE_END(PROBE_SAVE_GAME, t);
+}
+
+/*
+ * Save the game state in g, in the text format, by handing it to write
+ * along with ctx a buffer at a time. write returns nonzero if it failed.
+ *
+ * Lines are built up in a large buffer rather than written a character at
+ * a time. Returns 1 if a write failed, otherwise 0.
+ */
+int
+write_game(int (*write)(void *ctx, char const *buf, size_t n), void *ctx,
+        struct game *g)
+{
+    char *buf = malloc(SAVE_BUFFER);
+    size_t n, row = g->width * 4 + 8;
+    long h = 0, v = 0, i;
+    int failed = 0;
+
+    /* Any line fits in row bytes, so the buffer must hold at least one. */
+    if (row > SAVE_BUFFER) {
+        buf = realloc(buf, row);
+    }
+    n = format_owner(buf, g->current_player + 1, '\n');
+
+    /* Need to do one extra for the horizontal only. */
+    while (!(h == g->height + 1 && v == g->height)) {
+        if (h != g->height + 1) {
+            if (n + row > SAVE_BUFFER) {
+                failed |= write(ctx, buf, n);
+                n = 0;
+            }
+            n += format_edge_row(buf + n, h, 0, g);
+            ++h;
+        }
+
+        if (v != g->height) {
+            if (n + row > SAVE_BUFFER) {
+                failed |= write(ctx, buf, n);
+                n = 0;
+            }
+            n += format_edge_row(buf + n, v, 1, g);
+            ++v;
+        }
+    }
+
+    /* Owners are already stored as player + 1, which is the file format. */
+    for (v = 0; v < g->height; ++v) {
+        if (n + row > SAVE_BUFFER) {
+            failed |= write(ctx, buf, n);
+            n = 0;
+        }
+        for (i = 0; i < g->width; ++i) {
+            n += format_owner(buf + n, box_owner(i, v, g),
+                    i == g->width - 1 ? '\n' : ',');
+        }
+    }
+
+    failed |= write(ctx, buf, n);
+    free(buf);
+
+    return failed;
+}
+
+/*
+ * Get the whole contents of the open file fd into memory, mapping it where
+ * possible and reading it otherwise (pipes and the like). The size is put in
+ * *len and *mapped says which of munmap or free gives it back.
+ *
+ * Anything that can't be read comes back as an empty file.
+ */
+static char *
+slurp_file(int fd, size_t *len, int *mapped)
+{
+    struct stat st;
+    char *data = NULL, *more;
+    size_t cap = 0;
+    ssize_t got;
+
+    *len = 0;
+    *mapped = 0;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            *len = st.st_size;
+            *mapped = 1;
+            return data;
+        }
+        data = NULL;
+    }
+
+    while (1) {
+        if (*len == cap) {
+            cap = cap ? cap * 2 : SAVE_BUFFER;
+            if ((more = realloc(data, cap)) == NULL) {
+                break;
+            }
+            data = more;
+        }
+        if ((got = read(fd, data + *len, cap - *len)) <= 0) {
+            break;
+        }
+        *len += got;
+    }
+
+    return data;
+}
+
+/*
+ * Try and read in the file from path as if it was a grid, as
+ * read_grid_data does.
+ *
+ * Returns LOAD_OPEN if the file can't be opened, otherwise what
+ * read_grid_data does.
+ */
+int
+read_grid_file(char const *path, struct game *g)
+{
+    char *data;
+    size_t len;
+    int fd, mapped, status;
+    PROFILE_BEGIN(t);
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        PROFILE_END(PROBE_READ_GRID_FILE, t);
+        return LOAD_OPEN;
+    }
+
+    data = slurp_file(fd, &len, &mapped);
+    close(fd);
+
+    status = read_grid_data(data, len, g);
+
+    if (mapped) {
+        munmap(data, len);
+    } else {
+        free(data);
+    }
+
+    PROFILE_END(PROBE_READ_GRID_FILE, t);
+    return status;
+}
+
+/*
+ * Read the len bytes of a save at data into g, which must be empty. Binary
+ * saves are told apart from text ones by their magic.
+ *
+ * Returns LOAD_CONTENTS if it isn't actually a valid grid for this game,
+ * in which case g is left part loaded and only fit to be freed. Otherwise
+ * returns LOAD_OK and g is ready to play games with.
+ */
+int
+read_grid_data(char const *data, size_t len, struct game *g)
+{
+    struct reader r;
+    int n = 0;
+
+    /* Text saves always start with a digit so one character is enough. */
+    if (len > 0 && data[0] == SAVE_MAGIC[0]) {
+        return read_binary_save(data, len, g);
+    }
+
+    r.p = data;
+    r.end = data + len;
+
+    if ((g->current_player = read_num_until(&r, '\n', g) - 1) < 0) {
+        return LOAD_CONTENTS;
+    }
+
+    while (n != 2 * g->height + 1) {
+        if (read_edges(&r, n++, g)) {
+            return LOAD_CONTENTS;
+        }
+    }
+
+    if (read_filled(&r, g) || r.p != r.end || rebuild_counters(g)) {
+        return LOAD_CONTENTS;
+    }
+
+    return LOAD_OK;
+}
+
+/*
+ * Work out the size of the board the len bytes of a save at data are for,
+ * and how many players it has, without loading it. Binary saves say so in
+ * their header. Text saves have a line per row of edges and boxes, the
+ * first row of edges being as long as the board is wide, but don't say how
+ * many players there are, so *players is set to 0 for them.
+ *
+ * Returns 1 if the save is too short or malformed to tell or the size is
+ * out of range, otherwise 0. The save can still fail to load.
+ */
+int
+save_dimensions(char const *data, size_t len, int *height, int *width,
+        int *players)
+{
+    struct save_header hdr;
+    char const *p, *end = data + len, *line;
+    long lines = 0;
+
+    if (len > 0 && data[0] == SAVE_MAGIC[0]) {
+        if (len < sizeof(hdr)) {
+            return 1;
+        }
+        memcpy(&hdr, data, sizeof(hdr));
+        *height = hdr.height;
+        *width = hdr.width;
+        *players = hdr.num_players;
+        return memcmp(hdr.magic, SAVE_MAGIC, 4) != 0 || hdr.height < 2 ||
+                hdr.height > MAX_DIM || hdr.width < 2 ||
+                hdr.width > MAX_DIM;
+    }
+
+    /* The player to move, then the first row of horizontals. */
+    if ((p = memchr(data, '\n', len)) == NULL ||
+            (line = memchr(p + 1, '\n', end - p - 1)) == NULL) {
+        return 1;
+    }
+    *width = line - p - 1 < MAX_DIM + 1 ? line - p - 1 : MAX_DIM + 1;
+    *players = 0;
+
+    /* 2 * height + 1 rows of edges and height of boxes, plus the player. */
+    for (p = data; p < end && (p = memchr(p, '\n', end - p)) != NULL; ++p) {
+        lines++;
+    }
+    lines += len > 0 && data[len - 1] != '\n';
+    *height = (lines - 2) % 3 == 0 && lines <= 3L * MAX_DIM + 2 ?
+            (lines - 2) / 3 : 0;
+
+    return *height < 2 || *width < 2 || *width > MAX_DIM;
+}
+
+/*
+ * Return the message boxes prints for status from read_grid_file.
+ */
+char const *
+load_message(int status)
+{
+    return status == LOAD_OPEN ? "Invalid grid file" :
+            "Error reading grid contents";
+}
+
+/*
+ * Read the filled boxes for the game in g from r. 
+ *
+ * Returns 1 as soon as any error is found, otherwise 0.
+ *
+ * On success the owners in g should be up to date with the current file's
+ * map. Only tiles with an owned box in them get allocated.
+ */
+int
+read_filled(struct reader *r, struct game *g)
+{
+    long n, i;
+    int p;
+
+    for (i = 0; i < g->height; ++i) { 
+        /* read_num_until does the bounds check for us... */
+        for (n = 0; n < g->width - 1; ++n) {
+            /* Runs of unowned boxes are by far the most common thing. */
+            if (n + 4 <= g->width - 1 && r->end - r->p >= 8 &&
+                    load_bytes(r->p) == ZERO_RUN) {
+                r->p += 8;
+                n += 3;
+                continue;
+            }
+            if ((p = read_num_until(r, ',', g)) < 0) {
+                return 1;
+            } else if (p != 0) {
+                touch_tile(n, i, g)->owners[TILE_BOX(n, i)] = p;
+            }
+        }
+        if ((p = read_num_until(r, '\n', g)) < 0) {
+            return 1;
+        } else if (p != 0) {
+            touch_tile(n, i, g)->owners[TILE_BOX(n, i)] = p;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Read a number from r up until delim is reached or the end of the input is
+ * encountered.
+ *
+ * If the number is too long to be any valid number for this game or the
+ * thing being read is not a number, then -1 is returned.
+ *
+ * Otherwise the number that was read is returned.
+ */
+int
+read_num_until(struct reader *r, char delim, struct game *g)
+{
+    int n = 0, value = 0;
+
+    /* Up to three digits, then the delimiter or the end of the input. */
+    while (n != 4 && r->p != r->end && *r->p != delim) {
+        if (*r->p < '0' || *r->p > '9') {
+            return -1;
+        }
+        value = value * 10 + *r->p++ - '0';
+        ++n;
+    }
+
+    if (n == 4 || n == 0) {
+        return -1;
+    }
+
+    if (r->p != r->end) {
+        r->p++;
+    }
+
+    /* We should never get a number larger than the number of players. */
+    if (value > g->num_players) {
+        return -1;
+    }
+
+    return value;
+}
+
+/*
+ * Read the edge positions for row n from r.
+ *
+ * If the next line in r does not contain a valid set of edges for the given
+ * n then 1 is returned, otherwise 0.
+ *
+ * On success edge row n of g should be appropriatly populated. The side
+ * counters are left for the caller to rebuild once every row is in.
+ */
+int
+read_edges(struct reader *r, int n, struct game *g)
+{
+    long y = n / 2, len = g->width + n % 2, x;
+    uint64_t w, word;
+    struct tile *t;
+    int i;
+
+    /* Odd rows are longer. The line plus its newline must all be there. */
+    if (r->end - r->p < len + 1) {
+        return 1;
+    }
+
+    /* A tile word at a time, only touching tiles that get an edge. */
+    for (x = 0; x < len; x += TILE_SIZE) {
+        word = 0;
+
+        /* Eight characters at a time: each byte must be exactly '0' or '1'. */
+        for (i = 0; i + 8 <= TILE_SIZE && x + i + 8 <= len; i += 8) {
+            w = load_bytes(r->p + x + i) ^ BYTES('0');
+            if (w & ~BYTES(1)) {
+                return 1;
+            }
+            word |= ((w * 0x0102040810204080ULL) >> 56) << i;
+        }
+
+        for (; i < TILE_SIZE && x + i < len; ++i) {
+            if (r->p[x + i] != '0' && r->p[x + i] != '1') {
+                return 1;
+            } else if (r->p[x + i] == '1') {
+                word |= (uint64_t)1 << i;
+            }
+        }
+
+        if (word != 0) {
+            t = touch_tile(x, y, g);
+            if (n % 2) {
+                t->vedges[y & TILE_MASK] |= word;
+            } else {
+                t->hedges[y & TILE_MASK] |= word;
+            }
+        }
+    }
+
+    if (r->p[len] != '\n') {
+        return 1;
+    }
+    r->p += len + 1;
+
+    return 0;
+}
@@ -0,0 +1,240 @@
+#ifndef BOARD_H_
+#define BOARD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define WORD_BITS 64
+#define WORDS_FOR(n) (((n) + WORD_BITS - 1) / WORD_BITS)
+#define TEST_BIT(p, i) (((p)[(i) / WORD_BITS] >> ((i) % WORD_BITS)) & 1)
+#define SET_BIT(p, i) ((p)[(i) / WORD_BITS] |= (uint64_t)1 << ((i) % WORD_BITS))
+#define CLEAR_BIT(p, i) \
+        ((p)[(i) / WORD_BITS] &= ~((uint64_t)1 << ((i) % WORD_BITS)))
+
+/* Binary move files start with this, followed by packed move records. */
+#define MOVE_MAGIC "BXMV"
+#define MOVE_VERTICAL 0x80000000u
+
+/* Largest height or width a board can have. */
+#define MAX_DIM 100000
+
+/* Number of the edge or box at (x, y) counting along rows. */
+#define HEDGE(g, x, y) ((long)(y) * (g)->width + (x))
+#define VEDGE(g, x, y) ((long)(y) * ((g)->width + 1) + (x))
+#define BOX(g, x, y) ((long)(y) * (g)->width + (x))
+
+/* Tiles are TILE_SIZE boxes on a side. */
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+#define TILE_MASK (TILE_SIZE - 1)
+
+/* Index of box (x, y) within its tile's owners and sides. */
+#define TILE_BOX(x, y) ((((y) & TILE_MASK) << TILE_SHIFT) | ((x) & TILE_MASK))
+
+/*
+ * One square of the board. hedges[r] has a bit for the horizontal along the
+ * top of each box in row r of the tile and vedges[r] one for the vertical
+ * down the left of each. owners holds 0 for nobody or player + 1 and sides
+ * how many sides of the box are filled.
+ *
+ * The horizontals along the bottom of the board and verticals down its
+ * right hand side belong to the tiles just past the last box, so the grid
+ * of tiles has one more row and column than it needs for boxes when the
+ * board is a multiple of TILE_SIZE.
+ */
+struct tile {
+    uint64_t hedges[TILE_SIZE];
+    uint64_t vedges[TILE_SIZE];
+    unsigned char owners[TILE_SIZE * TILE_SIZE];
+    unsigned char sides[TILE_SIZE * TILE_SIZE];
+};
+
+struct chain_index;
+struct edge_sets;
+
+/*
+ * The board is a grid of tiles_w by tiles_h pointers to tiles, each of
+ * which is only allocated the first time an edge in or around it is
+ * filled. A missing tile is all empty, so a huge board only costs memory
+ * where there has been play. The ASCII picture is only ever built when
+ * print_grid asks for it.
+ *
+ * Whenever a box has any side filled its tile exists, so sides and owners
+ * can be read as 0 from missing tiles.
+ *
+ * side_totals[n] counts the boxes with exactly n sides filled and
+ * safe_edges counts the free edges that would not hand anybody a third
+ * side. Both are kept up to date by fill_edge.
+ *
+ * dirty_rows has a bit for every row of the ASCII picture that has changed
+ * since print_view last drew it, and last_* is the most recent edge placed
+ * (last_x is -1 before the first).
+ *
+ * chains is NULL unless chains_enable has been asked to keep track of the
+ * chains and loops on the board, and edge_sets likewise for
+ * edge_sets_enable and the safe and capturing edges.
+ *
+ * spare holds spare_count tiles (with room for spare_cap) that reset_grid
+ * took off an old board, for touch_tile to hand out again before it
+ * allocates any more.
+ */
+struct game {
+    struct tile **tiles;
+    int tiles_w;
+    int tiles_h;
+    long tile_count;
+    int width;
+    int height;
+    int current_player;
+    int num_players;
+    long close_count;
+    long possible_closures;
+    long scores[100];
+    long side_totals[5];
+    long safe_edges;
+    uint64_t *dirty_rows;
+    int last_x;
+    int last_y;
+    int last_vertical;
+    struct chain_index *chains;
+    struct edge_sets *edge_sets;
+    struct tile **spare;
+    long spare_count;
+    long spare_cap;
+};
+
+/*
+ * Return the tile holding box (x, y), or the edges along its top and left,
+ * or NULL if it hasn't been needed yet.
+ */
+static inline struct tile *
+tile_at(long x, long y, struct game const *g)
+{
+    return g->tiles[(y >> TILE_SHIFT) * g->tiles_w + (x >> TILE_SHIFT)];
+}
+
+/*
+ * Return whether the horizontal at (x, y) is filled.
+ */
+static inline int
+hedge_filled(long x, long y, struct game const *g)
+{
+    struct tile *t = tile_at(x, y, g);
+
+    return t != NULL && (t->hedges[y & TILE_MASK] >> (x & TILE_MASK)) & 1;
+}
+
+/*
+ * Return whether the vertical at (x, y) is filled.
+ */
+static inline int
+vedge_filled(long x, long y, struct game const *g)
+{
+    struct tile *t = tile_at(x, y, g);
+
+    return t != NULL && (t->vedges[y & TILE_MASK] >> (x & TILE_MASK)) & 1;
+}
+
+/*
+ * Return the owner of box (x, y), 0 for nobody or player + 1.
+ */
+static inline int
+box_owner(long x, long y, struct game const *g)
+{
+    struct tile *t = tile_at(x, y, g);
+
+    return t != NULL ? t->owners[TILE_BOX(x, y)] : 0;
+}
+
+/*
+ * Return how many sides of box (x, y) are filled.
+ */
+static inline int
+box_sides(long x, long y, struct game const *g)
+{
+    struct tile *t = tile_at(x, y, g);
+
+    return t != NULL ? t->sides[TILE_BOX(x, y)] : 0;
+}
+
+/*
+ * What read_grid_file and read_grid_data return. Each failure is also the
+ * status boxes exits with for it.
+ */
+enum load_status {
+    LOAD_OK = 0,
+    LOAD_OPEN = 4,
+    LOAD_CONTENTS = 5,
+};
+
+/* How print_view draws the board each turn. */
+enum render_mode {
+    RENDER_FULL,
+    RENDER_DELTA,
+    RENDER_SUMMARY,
+};
+
+/*
+ * A render mode plus the window of boxes (x, y, width, height) it is
+ * limited to. A zero width means the whole board.
+ */
+struct view {
+    enum render_mode mode;
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+void allocate_empty_grid(struct game *g);
+void free_grid(struct game *g);
+void reset_grid(int height, int width, struct game *g);
+void copy_grid(struct game *to, struct game const *from);
+struct tile *touch_tile(long x, long y, struct game *g);
+void print_grid(FILE *f, struct game *g);
+int write_grid(int (*write)(void *ctx, char const *buf, size_t n), void *ctx,
+        struct game *g);
+void print_view(FILE *f, struct view *v, struct game *g);
+void print_scores(FILE *f, struct game *g);
+
+int make_move(int x, int y, int vertical, struct game *g);
+int check_game_over(struct game *g);
+int find_winners(struct game *g, int *winners);
+int place_horizontal_edge(int x, int y, struct game *g);
+int place_verticle_edge(int x, int y, struct game *g);
+void fill_edge(int x, int y, int vertical, struct game *g);
+void clear_edge(int x, int y, int vertical, struct game *g);
+int is_safe_edge(int x, int y, int vertical, struct game *g);
+long count_safe_edges(struct game *g);
+long filled_edges(struct game *g);
+long boxes_with_sides(int n, struct game *g);
+void check_closures(int x, int y, struct game *g);
+void check_single_closure(int x, int y, struct game *g);
+
+long edge_count(struct game *g);
+long edge_index(int x, int y, int vertical, struct game *g);
+long find_edge(long x, long y, int vertical, struct game *g);
+int parse_move(char const *m, long *x, long *y, int *vertical);
+void edge_coords(long e, int *x, int *y, int *vertical, struct game *g);
+int symmetry_count(struct game *g);
+long map_edge(int t, long e, struct game *g);
+int edge_filled(long e, struct game *g);
+long next_free_edge(long e, struct game *g);
+int edge_closes(long e, struct game *g);
+int take_edge(long e, long *closed, struct game *g);
+void untake_edge(long e, long const *closed, int n, int player,
+        struct game *g);
+
+void save_game(FILE *f, struct game *g);
+int write_game(int (*write)(void *ctx, char const *buf, size_t n), void *ctx,
+        struct game *g);
+int save_binary(int fd, uint32_t serial, struct game *g);
+uint32_t save_serial(char const *path);
+int read_grid_file(char const *path, struct game *g);
+int read_grid_data(char const *data, size_t len, struct game *g);
+int save_dimensions(char const *data, size_t len, int *height, int *width,
+        int *players);
+char const *load_message(int status);
+int rebuild_counters(struct game *g);
+
+#endif
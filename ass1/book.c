@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "book.h"
+
+/* Book files start with this, then a struct book_header. */
+#define BOOK_MAGIC "BXBK"
+#define BOOK_VERSION 1
+
+/*
+ * plies is the most filled edges of any position in the book, so lookups
+ * past the opening can give up without hashing the board.
+ */
+struct book_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t cap;
+    uint64_t count;
+    uint64_t plies;
+};
+
+/*
+ * Scramble x into something that looks random.
+ */
+static uint64_t
+mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/*
+ * Return the symmetry that undoes symmetry t. The two quarter turns undo
+ * each other and everything else undoes itself.
+ */
+static int
+inverse_symmetry(int t)
+{
+    return t == 5 ? 6 : t == 6 ? 5 : t;
+}
+
+/*
+ * Work out the book key of the position in g: two independent 64 bit
+ * hashes of its filled edges, taken in whichever orientation of the board
+ * gives the least, and put that orientation in *t. Scores and owners are
+ * left out since they don't change how the rest of the game should go.
+ * The player to move only matters with more than two players.
+ */
+void
+book_key(struct game *g, uint64_t *key, int *t)
+{
+    uint64_t h[8][2] = { { 0 } }, base;
+    long e, edges = edge_count(g);
+    int nsym = symmetry_count(g), i;
+
+    base = mix(((uint64_t)g->height << 40) ^ ((uint64_t)g->width << 20) ^
+            g->num_players);
+    if (g->num_players > 2) {
+        base = mix(base ^ g->current_player);
+    }
+    for (i = 0; i < nsym; ++i) {
+        h[i][0] = base;
+        h[i][1] = mix(base);
+    }
+
+    for (e = 0; e < edges; ++e) {
+        if (!edge_filled(e, g)) {
+            continue;
+        }
+        for (i = 0; i < nsym; ++i) {
+            h[i][0] ^= mix(map_edge(i, e, g) ^ base);
+            h[i][1] ^= mix(map_edge(i, e, g) + ~base);
+        }
+    }
+
+    *t = 0;
+    for (i = 1; i < nsym; ++i) {
+        if (h[i][0] < h[*t][0] ||
+                (h[i][0] == h[*t][0] && h[i][1] < h[*t][1])) {
+            *t = i;
+        }
+    }
+    key[0] = h[*t][0];
+    key[1] = h[*t][1] | 1;
+}
+
+/*
+ * Return the slot in the cap slots of table where key is, or the empty
+ * slot it would go in, or NULL if it isn't there and there is no room.
+ */
+static struct book_entry *
+find_slot(struct book_entry *table, long cap, uint64_t const *key)
+{
+    long i = key[0] & (cap - 1), n;
+
+    for (n = 0; n < cap; ++n, i = (i + 1) & (cap - 1)) {
+        if ((table[i].key[0] == key[0] && table[i].key[1] == key[1]) ||
+                table[i].key[1] == 0) {
+            return &table[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Map in the book at path. Returns 0 if it worked and -1 if there is no
+ * such file or it isn't a book. A book's table must have an empty slot
+ * for lookups of positions that aren't in it to stop at.
+ */
+int
+book_open(struct book *b, char const *path)
+{
+    struct book_header hdr;
+    struct book_entry *slots;
+    struct stat st;
+    void *map = MAP_FAILED;
+    uint64_t used = 0, i;
+    int fd;
+
+    memset(b, 0, sizeof(*b));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return -1;
+    }
+
+    if (fstat(fd, &st) == 0 && read(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+            memcmp(hdr.magic, BOOK_MAGIC, 4) == 0 &&
+            hdr.version == BOOK_VERSION && hdr.cap != 0 &&
+            (hdr.cap & (hdr.cap - 1)) == 0 && hdr.count < hdr.cap &&
+            (uint64_t)st.st_size ==
+            sizeof(hdr) + hdr.cap * sizeof(struct book_entry)) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    slots = (struct book_entry *)((char *)map + sizeof(hdr));
+    for (i = 0; i < hdr.cap; ++i) {
+        used += slots[i].key[1] != 0;
+    }
+    if (used == hdr.cap) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    b->map_len = st.st_size;
+    b->slots = slots;
+    b->cap = hdr.cap;
+    b->count = hdr.count;
+    b->plies = hdr.plies;
+
+    return 0;
+}
+
+/*
+ * Unmap b.
+ */
+void
+book_close(struct book *b)
+{
+    if (b->slots != NULL) {
+        munmap((char *)b->slots - sizeof(struct book_header), b->map_len);
+    }
+    b->slots = NULL;
+}
+
+/*
+ * Look the position in g up in b and put the move it gives, turned back to
+ * the way g is oriented, in *move. Returns 1 if the book had a move and 0
+ * if the position isn't in it (or it is and the move is somehow taken).
+ */
+int
+book_lookup(struct book const *b, struct game *g, long *move)
+{
+    struct book_entry *slot;
+    uint64_t key[2];
+    int t;
+
+    if (b->slots == NULL || filled_edges(g) > (long)b->plies) {
+        return 0;
+    }
+
+    book_key(g, key, &t);
+    slot = find_slot(b->slots, b->cap, key);
+    if (slot == NULL || slot->key[1] == 0 || slot->move < 0 ||
+            slot->move >= edge_count(g)) {
+        return 0;
+    }
+
+    *move = map_edge(inverse_symmetry(t), slot->move, g);
+    return !edge_filled(*move, g);
+}
+
+/*
+ * Write the count entries to a new book at path, none with more than
+ * plies filled edges. The table is kept no more than half full and goes
+ * to a temporary file that is renamed over path once it is complete.
+ * Returns 0 if it worked and -1 if not.
+ */
+int
+book_write(char const *path, struct book_entry const *entries, long count,
+        long plies)
+{
+    struct book_header hdr;
+    struct book_entry *table;
+    long cap = 1024, i;
+    char *tmp;
+    int fd, status = 0;
+
+    while (cap < 2 * count) {
+        cap *= 2;
+    }
+    table = calloc(cap, sizeof(struct book_entry));
+    for (i = 0; i < count; ++i) {
+        *find_slot(table, cap, entries[i].key) = entries[i];
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BOOK_MAGIC, 4);
+    hdr.version = BOOK_VERSION;
+    hdr.cap = cap;
+    hdr.count = count;
+    hdr.plies = plies;
+
+    tmp = malloc(strlen(path) + 5);
+    sprintf(tmp, "%s.tmp", path);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        status = -1;
+    } else {
+        if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+                write(fd, table, cap * sizeof(struct book_entry)) !=
+                (ssize_t)(cap * sizeof(struct book_entry))) {
+            status = -1;
+        }
+        if (close(fd) || status || rename(tmp, path)) {
+            unlink(tmp);
+            status = -1;
+        }
+    }
+    free(tmp);
+    free(table);
+
+    return status;
+}
@@ -0,0 +1,42 @@
+#ifndef BOOK_H_
+#define BOOK_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/*
+ * One book slot: a position's canonical key and what the solver made of
+ * it. move is in the orientation that gave the key, score is the margin
+ * for the side to move and depth how far the search got. Used slots have a
+ * key with a bit set somewhere.
+ */
+struct book_entry {
+    uint64_t key[2];
+    int32_t move;
+    int16_t score;
+    uint8_t exact;
+    uint8_t depth;
+};
+
+/*
+ * An opening book mapped in from disk: cap slots, open addressed with a
+ * power of two of them, holding count positions of no more than plies
+ * filled edges.
+ */
+struct book {
+    struct book_entry *slots;
+    long cap;
+    long count;
+    long plies;
+    size_t map_len;
+};
+
+void book_key(struct game *g, uint64_t *key, int *t);
+int book_open(struct book *b, char const *path);
+void book_close(struct book *b);
+int book_lookup(struct book const *b, struct game *g, long *move);
+int book_write(char const *path, struct book_entry const *entries,
+        long count, long plies);
+
+#endif
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "board.h"
+#include "chains.h"
+
+/*
+ * Return where the label of box b is kept, allocating its tile's labels if
+ * create is set, or NULL if they haven't been needed yet.
+ */
+static long *
+label_slot(long b, int create, struct game *g)
+{
+    long x = b % g->width, y = b / g->width;
+    long **labels = &g->chains->labels[(y >> TILE_SHIFT) * g->tiles_w +
+            (x >> TILE_SHIFT)];
+
+    if (*labels == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        *labels = calloc(TILE_SIZE * TILE_SIZE, sizeof(long));
+    }
+
+    return &(*labels)[TILE_BOX(x, y)];
+}
+
+/*
+ * Return the number of the chain box b is in, or -1 if it isn't in one.
+ */
+static long
+label(long b, struct game *g)
+{
+    long *slot = label_slot(b, 0, g);
+
+    return slot != NULL ? *slot - 1 : -1;
+}
+
+/*
+ * Put box b in chain c, or with c -1 take it out of its chain.
+ */
+static void
+set_label(long b, long c, struct game *g)
+{
+    *label_slot(b, 1, g) = c + 1;
+}
+
+/*
+ * Fill n with the boxes in a chain that box (x, y) is joined to by a free
+ * edge, and return how many there are.
+ */
+static int
+linked(long x, long y, long *n, struct game *g)
+{
+    int count = 0;
+
+    if (y > 0 && !hedge_filled(x, y, g) && label(BOX(g, x, y - 1), g) >= 0) {
+        n[count++] = BOX(g, x, y - 1);
+    }
+    if (y < g->height - 1 && !hedge_filled(x, y + 1, g) &&
+            label(BOX(g, x, y + 1), g) >= 0) {
+        n[count++] = BOX(g, x, y + 1);
+    }
+    if (x > 0 && !vedge_filled(x, y, g) && label(BOX(g, x - 1, y), g) >= 0) {
+        n[count++] = BOX(g, x - 1, y);
+    }
+    if (x < g->width - 1 && !vedge_filled(x + 1, y, g) &&
+            label(BOX(g, x + 1, y), g) >= 0) {
+        n[count++] = BOX(g, x + 1, y);
+    }
+
+    return count;
+}
+
+/*
+ * Return the box after b walking along its chain away from prev, or -1 if b
+ * is the end.
+ */
+static long
+step(long b, long prev, struct game *g)
+{
+    long n[4];
+    int count = linked(b % g->width, b / g->width, n, g), i;
+
+    for (i = 0; i < count; ++i) {
+        if (n[i] != prev) {
+            return n[i];
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Put every box from b onwards, walking away from prev, into chain c.
+ */
+static void
+relabel(long b, long prev, long c, struct game *g)
+{
+    long next;
+
+    while (b >= 0) {
+        set_label(b, c, g);
+        next = step(b, prev, g);
+        prev = b;
+        b = next;
+    }
+}
+
+/*
+ * Return the number of a new, empty chain.
+ */
+static long
+new_chain(struct game *g)
+{
+    struct chain_index *ci = g->chains;
+    long c;
+
+    if (ci->free_head >= 0) {
+        c = ci->free_head;
+        ci->free_head = ci->chains[c].next_free;
+    } else {
+        if (ci->used == ci->cap) {
+            ci->cap *= 2;
+            ci->chains = realloc(ci->chains, ci->cap * sizeof(struct chain));
+        }
+        c = ci->used++;
+    }
+
+    ci->chains[c].length = 0;
+    ci->chains[c].loop = 0;
+    ci->chains[c].next_free = -1;
+    ci->live++;
+
+    return c;
+}
+
+/*
+ * Give chain c back to be reused.
+ */
+static void
+free_chain(long c, struct game *g)
+{
+    struct chain_index *ci = g->chains;
+
+    ci->chains[c].length = 0;
+    ci->chains[c].next_free = ci->free_head;
+    ci->free_head = c;
+    ci->live--;
+}
+
+/*
+ * Return the end of chain c that isn't b, or b if it is both.
+ */
+static long
+other_end(struct chain const *c, long b)
+{
+    return c->ends[0] == b ? c->ends[1] : c->ends[0];
+}
+
+/*
+ * Add box (x, y), which has just got its second side, to the chains. It
+ * either starts a chain, goes on the end of one, closes a chain into a
+ * loop or joins two chains into one. Joining relabels the shorter of the
+ * two, so any one box is only relabelled a logarithmic number of times
+ * over a game.
+ */
+void
+chains_add_box(int x, int y, struct game *g)
+{
+    struct chain *chains = g->chains->chains, *big, *small;
+    long b = BOX(g, x, y), n[4], c, s, t;
+    int count = linked(x, y, n, g);
+
+    if (count == 0) {
+        c = new_chain(g);
+        chains = g->chains->chains;
+        chains[c].length = 1;
+        chains[c].ends[0] = b;
+        chains[c].ends[1] = b;
+    } else if (count == 1) {
+        c = label(n[0], g);
+        chains[c].length++;
+        chains[c].ends[chains[c].ends[0] == n[0] ? 0 : 1] = b;
+    } else if ((c = label(n[0], g)) == (s = label(n[1], g))) {
+        chains[c].length++;
+        chains[c].loop = 1;
+        chains[c].ends[0] = b;
+        chains[c].ends[1] = b;
+    } else {
+        if (chains[c].length < chains[s].length) {
+            t = c;
+            c = s;
+            s = t;
+            t = n[0];
+            n[0] = n[1];
+            n[1] = t;
+        }
+        big = &chains[c];
+        small = &chains[s];
+
+        relabel(n[1], -1, c, g);
+        big->ends[0] = other_end(big, n[0]);
+        big->ends[1] = other_end(small, n[1]);
+        big->length += small->length + 1;
+        free_chain(s, g);
+    }
+
+    set_label(b, c, g);
+}
+
+/*
+ * Take box (x, y), which is about to lose its second side, out of its
+ * chain. A loop opens up into a chain and a chain loses an end or is cut in
+ * two. Cutting walks out from the box both ways at once and relabels the
+ * side that ends first, so costs no more than the shorter piece.
+ */
+void
+chains_remove_box(int x, int y, struct game *g)
+{
+    struct chain *chains = g->chains->chains;
+    long b = BOX(g, x, y), n[4], c = label(b, g), cut, ends[2];
+    long walk[2], prev[2], next, k;
+    int count = linked(x, y, n, g), i;
+
+    set_label(b, -1, g);
+    chains[c].length--;
+
+    if (chains[c].loop) {
+        chains[c].loop = 0;
+        chains[c].ends[0] = n[0];
+        chains[c].ends[1] = n[1];
+    } else if (count == 0) {
+        free_chain(c, g);
+    } else if (count == 1) {
+        chains[c].ends[chains[c].ends[0] == b ? 0 : 1] = n[0];
+    } else {
+        /* b is already unlabelled, so the walks can't come back through. */
+        for (i = 0; i < 2; ++i) {
+            walk[i] = n[i];
+            prev[i] = b;
+        }
+        ends[0] = chains[c].ends[0];
+        ends[1] = chains[c].ends[1];
+
+        for (k = 1, i = 2; i == 2; ++k) {
+            for (i = 0; i < 2 && (next = step(walk[i], prev[i], g)) >= 0;
+                    ++i) {
+                prev[i] = walk[i];
+                walk[i] = next;
+            }
+        }
+        k--;
+
+        /* Piece i, k boxes from n[i] to walk[i], moves to a new chain. */
+        cut = new_chain(g);
+        chains = g->chains->chains;
+        relabel(n[i], b, cut, g);
+        chains[cut].length = k;
+        chains[cut].ends[0] = n[i];
+        chains[cut].ends[1] = walk[i];
+
+        chains[c].length -= k;
+        chains[c].ends[0] = n[1 - i];
+        chains[c].ends[1] = ends[0] == walk[i] ? ends[1] : ends[0];
+    }
+}
+
+/*
+ * Return the number of the chain box (x, y) is in, or -1 if it isn't in
+ * one or chains aren't being kept.
+ */
+long
+chains_of(int x, int y, struct game *g)
+{
+    return g->chains != NULL ? label(BOX(g, x, y), g) : -1;
+}
+
+/*
+ * Start keeping the chains of g up to date, finding the ones already on
+ * the board. Boxes with a side filled are always in a tile, so only tiles
+ * that exist need looking at.
+ */
+void
+chains_enable(struct game *g)
+{
+    struct chain_index *ci;
+    long tx, ty, x, y;
+
+    if (g->chains != NULL) {
+        return;
+    }
+
+    ci = g->chains = malloc(sizeof(struct chain_index));
+    ci->labels = calloc((size_t)g->tiles_w * g->tiles_h, sizeof(long *));
+    ci->cap = 64;
+    ci->chains = malloc(ci->cap * sizeof(struct chain));
+    ci->used = 0;
+    ci->free_head = -1;
+    ci->live = 0;
+
+    for (ty = 0; ty < g->tiles_h; ++ty) {
+        for (tx = 0; tx < g->tiles_w; ++tx) {
+            if (g->tiles[ty * g->tiles_w + tx] == NULL) {
+                continue;
+            }
+            for (y = ty * TILE_SIZE;
+                    y < (ty + 1) * TILE_SIZE && y < g->height; ++y) {
+                for (x = tx * TILE_SIZE;
+                        x < (tx + 1) * TILE_SIZE && x < g->width; ++x) {
+                    if (box_sides(x, y, g) == 2) {
+                        chains_add_box(x, y, g);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Stop keeping the chains of g and give back their memory.
+ */
+void
+chains_disable(struct game *g)
+{
+    long i;
+
+    if (g->chains == NULL) {
+        return;
+    }
+
+    for (i = 0; i < (long)g->tiles_w * g->tiles_h; ++i) {
+        free(g->chains->labels[i]);
+    }
+    free(g->chains->labels);
+    free(g->chains->chains);
+    free(g->chains);
+    g->chains = NULL;
+}
+
+/*
+ * Print a line to f for each chain of g, as "chain length y x y x" giving
+ * its ends, or for each loop, as "loop length y x" giving one of its boxes.
+ * Starts keeping the chains if that hasn't already been asked for.
+ */
+void
+print_chains(FILE *f, struct game *g)
+{
+    struct chain *c;
+    long i;
+
+    chains_enable(g);
+
+    if (g->chains->live == 0) {
+        fprintf(f, "No chains\n");
+    }
+
+    for (i = 0; i < g->chains->used; ++i) {
+        c = &g->chains->chains[i];
+        if (c->length == 0) {
+            continue;
+        } else if (c->loop) {
+            fprintf(f, "loop %ld %ld %ld\n", c->length,
+                    c->ends[0] / g->width, c->ends[0] % g->width);
+        } else {
+            fprintf(f, "chain %ld %ld %ld %ld %ld\n", c->length,
+                    c->ends[0] / g->width, c->ends[0] % g->width,
+                    c->ends[1] / g->width, c->ends[1] % g->width);
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef CHAINS_H_
+#define CHAINS_H_
+
+#include <stdio.h>
+
+#include "board.h"
+
+/*
+ * A run of boxes with exactly two sides filled, each joined to the next by
+ * the free edge between them. A chain's ends are the boxes at either end
+ * (the same box for a chain of one); a loop has no ends and ends[0] is just
+ * one of its boxes. Boxes are numbered as BOX numbers them.
+ */
+struct chain {
+    long length;
+    long ends[2];
+    int loop;
+    long next_free;
+};
+
+/*
+ * The chains and loops of a game, kept up to date by fill_edge and
+ * clear_edge once chains_enable has been called.
+ *
+ * labels has a lazily allocated array per tile holding, for each of its
+ * boxes, 0 or the number of the chain it is in plus one. Unused entries of
+ * chains are linked from free_head through next_free.
+ */
+struct chain_index {
+    long **labels;
+    struct chain *chains;
+    long cap;
+    long used;
+    long free_head;
+    long live;
+};
+
+void chains_enable(struct game *g);
+void chains_disable(struct game *g);
+void chains_add_box(int x, int y, struct game *g);
+void chains_remove_box(int x, int y, struct game *g);
+long chains_of(int x, int y, struct game *g);
+void print_chains(FILE *f, struct game *g);
+
+#endif
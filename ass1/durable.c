@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "durable.h"
+#include "journal.h"
+
+/*
+ * The journal is a binary move file (see run_batch) whose first record is
+ * a mark with the generation in place of x. Undos and redos are records
+ * of their own, so a replay is left able to redo what the crashed run could.
+ */
+#define JOURNAL_MARK 0xffffffffu
+#define JOURNAL_UNDO 0xfffffffeu
+#define JOURNAL_REDO 0xfffffffdu
+
+/* Records written between each fdatasync. */
+#define SYNC_EVERY 64
+
+/*
+ * Give up on the journal, it can't be kept.
+ */
+static void
+journal_failed(void)
+{
+    fprintf(stderr, "Can not write journal\n");
+    exit(10);
+}
+
+/*
+ * Get everything written to the journal so far onto the disk.
+ */
+void
+durable_sync(struct durable *d)
+{
+    if (d->unsynced > 0 && fdatasync(d->fd)) {
+        journal_failed();
+    }
+    d->unsynced = 0;
+}
+
+/*
+ * Add the record (y, x) to the end of the journal. It reaches the file
+ * straight away, so only losing the whole machine can lose it, and the disk
+ * is caught up every SYNC_EVERY records.
+ */
+static void
+append_record(struct durable *d, uint32_t y, uint32_t x)
+{
+    uint32_t rec[2] = { y, x };
+
+    if (write(d->fd, rec, sizeof(rec)) != sizeof(rec)) {
+        journal_failed();
+    }
+    if (++d->unsynced >= SYNC_EVERY) {
+        durable_sync(d);
+    }
+}
+
+/*
+ * Empty the journal down to its magic and the mark for the current
+ * generation.
+ */
+static void
+reset_journal(struct durable *d)
+{
+    if (ftruncate(d->fd, 0) || write(d->fd, MOVE_MAGIC, 4) != 4) {
+        journal_failed();
+    }
+    append_record(d, JOURNAL_MARK, d->generation);
+    d->unsynced = 1;
+    durable_sync(d);
+    d->since_snapshot = 0;
+}
+
+/*
+ * fsync the directory path is in, so a rename in it sticks.
+ */
+static void
+sync_dir(char const *path)
+{
+    char *dir = strdup(path), *slash = strrchr(dir, '/');
+    int fd;
+
+    if (slash == NULL) {
+        strcpy(dir, ".");
+    } else {
+        slash[slash == dir] = '\0';
+    }
+
+    if ((fd = open(dir, O_RDONLY)) >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/*
+ * Write all of g out as the snapshot for the next generation and start the
+ * journal over behind it. The snapshot goes to a temporary file that is
+ * renamed into place, so a crash part way leaves the old snapshot and its
+ * journal alone. Undo can't reach back past a snapshot, since recovery
+ * couldn't either, so j is emptied.
+ */
+static void
+take_snapshot(struct durable *d, struct journal *j, struct game *g)
+{
+    char *tmp = malloc(strlen(d->snap_path) + 5);
+    int fd;
+
+    sprintf(tmp, "%s.tmp", d->snap_path);
+    d->generation++;
+
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 ||
+            save_binary(fd, d->generation, g) || fsync(fd) || close(fd) ||
+            rename(tmp, d->snap_path)) {
+        journal_failed();
+    }
+    sync_dir(d->snap_path);
+    free(tmp);
+
+    reset_journal(d);
+    j->count = 0;
+    j->top = 0;
+}
+
+/*
+ * Play the records of the journal held in data (len bytes, past its magic
+ * and mark) onto g through j. A record cut short by a crash never happened
+ * and is cut off the file.
+ */
+static void
+replay(struct durable *d, char const *data, size_t len, struct journal *j,
+        struct game *g)
+{
+    uint32_t rec[2];
+    size_t off;
+
+    for (off = 4 + sizeof(rec); off + sizeof(rec) <= len;
+            off += sizeof(rec)) {
+        memcpy(rec, data + off, sizeof(rec));
+        if (rec[0] == JOURNAL_UNDO) {
+            journal_undo(j, g);
+        } else if (rec[0] == JOURNAL_REDO) {
+            journal_redo(j, g);
+        } else {
+            journal_make(j, find_edge(rec[1] & ~MOVE_VERTICAL, rec[0],
+                    (rec[1] & MOVE_VERTICAL) != 0, g), g);
+        }
+        d->since_snapshot++;
+    }
+
+    if (off != len && ftruncate(d->fd, off)) {
+        journal_failed();
+    }
+}
+
+/*
+ * Start keeping g safe in the journal at path, snapshotting every every
+ * moves, and bring g back to where it was if an earlier run crashed.
+ *
+ * If there is a snapshot beside the journal it is loaded (load_path is
+ * ignored) and the journal's moves since then are played again through j.
+ * Otherwise the game starts from load_path, if given, or empty, and that
+ * is snapshotted straight away.
+ *
+ * Exits with status 10 if the journal is not one of ours or can't be
+ * written, and as read_grid_file does if the snapshot is bad.
+ */
+void
+durable_open(struct durable *d, char const *path, long every,
+        char *load_path, struct journal *j, struct game *g)
+{
+    struct stat st;
+    uint32_t mark[2];
+    char *data;
+    ssize_t got;
+    size_t len = 0;
+    int status = LOAD_OK;
+
+    d->snap_path = malloc(strlen(path) + 6);
+    sprintf(d->snap_path, "%s.snap", path);
+    d->every = every;
+    d->generation = 0;
+    d->since_snapshot = 0;
+    d->unsynced = 0;
+
+    if ((d->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0666)) < 0 ||
+            fstat(d->fd, &st)) {
+        journal_failed();
+    }
+
+    if (access(d->snap_path, F_OK) == 0) {
+        status = read_grid_file(d->snap_path, g);
+        d->generation = save_serial(d->snap_path);
+    } else if (load_path != NULL) {
+        status = read_grid_file(load_path, g);
+    }
+    if (status != LOAD_OK) {
+        fprintf(stderr, "%s\n", load_message(status));
+        exit(status);
+    }
+
+    data = malloc(st.st_size + 1);
+    while (len < (size_t)st.st_size &&
+            (got = pread(d->fd, data + len, st.st_size - len, len)) > 0) {
+        len += got;
+    }
+
+    if (len > 0 && (len < 4 || memcmp(data, MOVE_MAGIC, 4) != 0)) {
+        fprintf(stderr, "Invalid journal file\n");
+        exit(10);
+    }
+
+    if (len >= 4 + sizeof(mark)) {
+        memcpy(mark, data + 4, sizeof(mark));
+    }
+
+    /* A journal from before the snapshot was finished with is stale. */
+    if (d->generation == 0) {
+        take_snapshot(d, j, g);
+    } else if (len >= 4 + sizeof(mark) && mark[0] == JOURNAL_MARK &&
+            mark[1] == d->generation) {
+        replay(d, data, len, j, g);
+    } else {
+        reset_journal(d);
+    }
+
+    free(data);
+}
+
+/*
+ * Record in the journal what the prompt just did to g through j, which
+ * held before moves until then: a move, an undo or a redo. Takes a fresh
+ * snapshot once enough have built up.
+ */
+void
+durable_note(struct durable *d, long before, struct journal *j,
+        struct game *g)
+{
+    struct journal_entry *m;
+
+    if (j->count < before) {
+        append_record(d, JOURNAL_UNDO, 0);
+    } else if (j->count < j->top) {
+        append_record(d, JOURNAL_REDO, 0);
+    } else {
+        m = &j->entries[j->count - 1];
+        append_record(d, m->y, m->x | (m->vertical ? MOVE_VERTICAL : 0));
+    }
+
+    if (++d->since_snapshot >= d->every) {
+        take_snapshot(d, j, g);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef DURABLE_H_
+#define DURABLE_H_
+
+#include <stdint.h>
+
+#include "board.h"
+#include "journal.h"
+
+/*
+ * Crash safety for an interactive game. Every move is appended to the
+ * journal file fd as it is made, and every every moves the whole game goes
+ * to snap_path after which the journal starts over. generation ties a
+ * journal to the snapshot it follows on from.
+ */
+struct durable {
+    int fd;
+    char *snap_path;
+    uint32_t generation;
+    long every;
+    long since_snapshot;
+    long unsynced;
+};
+
+void durable_open(struct durable *d, char const *path, long every,
+        char *load_path, struct journal *j, struct game *g);
+void durable_note(struct durable *d, long before, struct journal *j,
+        struct game *g);
+void durable_sync(struct durable *d);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+
+#include "board.h"
+#include "edgeset.h"
+
+/*
+ * Set s up empty for a board with edges edges.
+ */
+static void
+init_set(struct edge_set *s, long edges)
+{
+    long e;
+
+    s->edges = malloc(edges * sizeof(long));
+    s->pos = malloc(edges * sizeof(long));
+    s->count = 0;
+    for (e = 0; e < edges; ++e) {
+        s->pos[e] = -1;
+    }
+}
+
+/*
+ * Put edge e in s if want is set and take it out otherwise. Taking an edge
+ * out moves the last one into its place.
+ */
+static void
+set_member(struct edge_set *s, long e, int want)
+{
+    long last;
+
+    if (want && s->pos[e] < 0) {
+        s->pos[e] = s->count;
+        s->edges[s->count++] = e;
+    } else if (!want && s->pos[e] >= 0) {
+        last = s->edges[--s->count];
+        s->edges[s->pos[e]] = last;
+        s->pos[last] = s->pos[e];
+        s->pos[e] = -1;
+    }
+}
+
+/*
+ * Bring the edge at (x, y) up to date in the sets of g, if g has such an
+ * edge.
+ */
+static void
+refresh(int x, int y, int vertical, struct game *g)
+{
+    long e = find_edge(x, y, vertical, g);
+    int open, capture;
+
+    if (e < 0) {
+        return;
+    }
+
+    open = vertical ? !vedge_filled(x, y, g) : !hedge_filled(x, y, g);
+    if (vertical) {
+        capture = (x > 0 && box_sides(x - 1, y, g) == 3) ||
+                (x < g->width && box_sides(x, y, g) == 3);
+    } else {
+        capture = (y > 0 && box_sides(x, y - 1, g) == 3) ||
+                (y < g->height && box_sides(x, y, g) == 3);
+    }
+
+    set_member(&g->edge_sets->safe, e, is_safe_edge(x, y, vertical, g));
+    set_member(&g->edge_sets->capture, e, open && capture);
+}
+
+/*
+ * Bring the edges of box (x, y) up to date, if g has such a box.
+ */
+static void
+refresh_box(int x, int y, struct game *g)
+{
+    if (x < 0 || y < 0 || x >= g->width || y >= g->height) {
+        return;
+    }
+
+    refresh(x, y, 0, g);
+    refresh(x, y + 1, 0, g);
+    refresh(x, y, 1, g);
+    refresh(x + 1, y, 1, g);
+}
+
+/*
+ * Start keeping the safe and capturing edges of g, finding the ones already
+ * on the board. Takes room for four numbers per edge of the board, so is
+ * meant for boards that are played out in full.
+ */
+void
+edge_sets_enable(struct game *g)
+{
+    long e, edges = edge_count(g);
+    int x, y, vertical;
+
+    if (g->edge_sets != NULL) {
+        return;
+    }
+
+    g->edge_sets = malloc(sizeof(struct edge_sets));
+    init_set(&g->edge_sets->safe, edges);
+    init_set(&g->edge_sets->capture, edges);
+
+    for (e = next_free_edge(0, g); e >= 0; e = next_free_edge(e + 1, g)) {
+        edge_coords(e, &x, &y, &vertical, g);
+        refresh(x, y, vertical, g);
+    }
+}
+
+/*
+ * Stop keeping the sets of g and give back their memory.
+ */
+void
+edge_sets_disable(struct game *g)
+{
+    if (g->edge_sets == NULL) {
+        return;
+    }
+
+    free(g->edge_sets->safe.edges);
+    free(g->edge_sets->safe.pos);
+    free(g->edge_sets->capture.edges);
+    free(g->edge_sets->capture.pos);
+    free(g->edge_sets);
+    g->edge_sets = NULL;
+}
+
+/*
+ * Bring the sets of g up to date after the edge at (x, y) has been filled
+ * or cleared. Only that edge and the edges round the boxes either side of
+ * it can have changed.
+ */
+void
+edge_sets_update(int x, int y, int vertical, struct game *g)
+{
+    refresh(x, y, vertical, g);
+    if (vertical) {
+        refresh_box(x - 1, y, g);
+        refresh_box(x, y, g);
+    } else {
+        refresh_box(x, y - 1, g);
+        refresh_box(x, y, g);
+    }
+}
+
+/*
+ * Return whether edge e is in s.
+ */
+int
+edge_set_has(struct edge_set const *s, long e)
+{
+    return s->pos[e] >= 0;
+}
+
+/*
+ * Return the edge of s that the random number r picks, all being equally
+ * likely, or -1 if s is empty.
+ */
+long
+edge_set_pick(struct edge_set const *s, uint64_t r)
+{
+    return s->count > 0 ? s->edges[r % s->count] : -1;
+}
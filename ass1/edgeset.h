@@ -0,0 +1,35 @@
+#ifndef EDGESET_H_
+#define EDGESET_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/*
+ * A set of edges, numbered as by edge_index, in no particular order. pos[e]
+ * is where edge e sits in edges, or -1 if it isn't in the set, so testing,
+ * adding and removing an edge and picking one at random are all O(1).
+ */
+struct edge_set {
+    long *edges;
+    long *pos;
+    long count;
+};
+
+/*
+ * The free edges of a game that are safe (see is_safe_edge) and those that
+ * would close a box, kept up to date by fill_edge and clear_edge once
+ * edge_sets_enable has been called.
+ */
+struct edge_sets {
+    struct edge_set safe;
+    struct edge_set capture;
+};
+
+void edge_sets_enable(struct game *g);
+void edge_sets_disable(struct game *g);
+void edge_sets_update(int x, int y, int vertical, struct game *g);
+int edge_set_has(struct edge_set const *s, long e);
+long edge_set_pick(struct edge_set const *s, uint64_t r);
+
+#endif
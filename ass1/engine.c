@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "board.h"
+#include "engine.h"
+#include "journal.h"
+
+/* Longest command a binary frame may hold. */
+#define ENGINE_LINE 256
+
+/*
+ * A reply being put together. It goes out in one piece once the command
+ * is done.
+ */
+struct reply {
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+/*
+ * Add text, formatted as by printf, to the end of r.
+ */
+static void
+add(struct reply *r, char const *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (r->len + n + 1 > r->cap) {
+        r->cap = (r->len + n + 1) * 2;
+        r->buf = realloc(r->buf, r->cap);
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(r->buf + r->len, n + 1, fmt, ap);
+    va_end(ap);
+
+    r->len += n;
+}
+
+/*
+ * Read the next command from in into line, without its newline or a
+ * carriage return before that. A binary frame is a native endian 32 bit
+ * length and then that many bytes. Frames too long to take are skipped
+ * and leave line empty with *too_long set.
+ *
+ * Returns -1 once in runs out, otherwise the length of the command.
+ */
+static long
+read_command(enum engine_framing framing, FILE *in, char **line, size_t *cap,
+        int *too_long)
+{
+    uint32_t len, i;
+    ssize_t n;
+
+    *too_long = 0;
+    if (framing == ENGINE_TEXT) {
+        if ((n = getline(line, cap, in)) < 0) {
+            return -1;
+        }
+        if (n > 0 && (*line)[n - 1] == '\n') {
+            (*line)[--n] = '\0';
+        }
+        if (n > 0 && (*line)[n - 1] == '\r') {
+            (*line)[--n] = '\0';
+        }
+        return n;
+    }
+
+    if (*cap < ENGINE_LINE) {
+        *cap = ENGINE_LINE;
+        *line = realloc(*line, *cap);
+    }
+    if (fread(&len, sizeof(len), 1, in) != 1) {
+        return -1;
+    }
+    if (len >= ENGINE_LINE) {
+        for (i = 0; i < len && fgetc(in) != EOF; ++i);
+        *too_long = 1;
+        len = 0;
+    } else if (fread(*line, 1, len, in) != len) {
+        return -1;
+    }
+    (*line)[len] = '\0';
+
+    return len;
+}
+
+/*
+ * Send r to out as one line or one frame and empty it.
+ */
+static void
+send_reply(enum engine_framing framing, FILE *out, struct reply *r)
+{
+    uint32_t len = r->len;
+
+    if (framing == ENGINE_BINARY) {
+        fwrite(&len, sizeof(len), 1, out);
+        fwrite(r->buf, 1, r->len, out);
+    } else {
+        fwrite(r->buf, 1, r->len, out);
+        fputc('\n', out);
+    }
+    fflush(out);
+    r->len = 0;
+}
+
+/*
+ * Say whose turn it is in g, or who won if the game is over.
+ */
+static void
+add_turn(struct reply *r, struct game *g)
+{
+    int winners[100], n, i;
+
+    if (!check_game_over(g)) {
+        add(r, "ok %c", g->current_player + 'A');
+        return;
+    }
+
+    n = find_winners(g, winners);
+    add(r, "over");
+    for (i = 0; i < n; ++i) {
+        add(r, " %c", winners[i] + 'A');
+    }
+}
+
+/*
+ * Describe g as "position height width players turn edges", where edges
+ * is the filled edges in hex, numbered as by edge_index with edge e in bit
+ * e % 4 of digit e / 4.
+ */
+static void
+add_position(struct reply *r, struct game *g)
+{
+    long edges = edge_count(g), e, i;
+    int digit;
+
+    add(r, "position %d %d %d %c ", g->height, g->width, g->num_players,
+            g->current_player + 'A');
+    for (e = 0; e < edges; e += 4) {
+        for (digit = 0, i = 0; i < 4 && e + i < edges; ++i) {
+            digit |= edge_filled(e + i, g) << i;
+        }
+        add(r, "%x", digit);
+    }
+}
+
+/*
+ * List the free edges of g as "legal count" then "y x h|v" for each.
+ */
+static void
+add_legal(struct reply *r, struct game *g)
+{
+    long e, count = edge_count(g) - filled_edges(g);
+    int x, y, vertical;
+
+    add(r, "legal %ld", count);
+    for (e = next_free_edge(0, g); e >= 0; e = next_free_edge(e + 1, g)) {
+        edge_coords(e, &x, &y, &vertical, g);
+        add(r, " %d %d %c", y, x, vertical ? 'v' : 'h');
+    }
+}
+
+/*
+ * Carry out one command on g, putting the reply in r. Moves are recorded
+ * in j so they can be undone.
+ *
+ * Returns 1 if the command was quit, otherwise 0.
+ */
+static int
+run_command(char const *line, struct reply *r, struct journal *j,
+        struct game *g)
+{
+    long x, y;
+    int vertical, i;
+
+    if (strncmp(line, "move ", 5) == 0) {
+        if (check_game_over(g)) {
+            add(r, "error game over");
+        } else if (parse_move(line + 5, &x, &y, &vertical) ||
+                journal_make(j, find_edge(x, y, vertical, g), g) < 0) {
+            add(r, "error bad move");
+        } else {
+            add_turn(r, g);
+        }
+    } else if (strcmp(line, "position") == 0) {
+        add_position(r, g);
+    } else if (strcmp(line, "scores") == 0) {
+        add(r, "scores");
+        for (i = 0; i < g->num_players; ++i) {
+            add(r, " %ld", g->scores[i]);
+        }
+    } else if (strcmp(line, "legal") == 0) {
+        add_legal(r, g);
+    } else if (strcmp(line, "undo") == 0) {
+        if (journal_undo(j, g)) {
+            add(r, "error nothing to undo");
+        } else {
+            add_turn(r, g);
+        }
+    } else if (strcmp(line, "redo") == 0) {
+        if (journal_redo(j, g)) {
+            add(r, "error nothing to redo");
+        } else {
+            add_turn(r, g);
+        }
+    } else if (strcmp(line, "quit") == 0) {
+        add(r, "bye");
+        return 1;
+    } else {
+        add(r, "error unknown command");
+    }
+
+    return 0;
+}
+
+/*
+ * Play g by commands read from in, answering each with exactly one line
+ * (or frame) on out and printing nothing else, until quit or the end of
+ * in. The commands are:
+ *
+ *     move y x h|v    ok T, with T to move next, or over and the winners
+ *     position        position height width players turn edges
+ *     scores          scores and one score per player
+ *     legal           legal, the number of free edges and each one
+ *     undo, redo      as for move
+ *     quit            bye
+ *
+ * and anything that can't be done gets "error" and the reason.
+ */
+void
+run_engine(enum engine_framing framing, FILE *in, FILE *out,
+        struct game *g)
+{
+    struct reply r = { NULL, 0, 0 };
+    struct journal j;
+    char *line = NULL;
+    size_t cap = 0;
+    int too_long, done = 0;
+
+    journal_init(&j, 0);
+    while (!done && read_command(framing, in, &line, &cap, &too_long) >= 0) {
+        if (too_long) {
+            add(&r, "error line too long");
+        } else {
+            done = run_command(line, &r, &j, g);
+        }
+        send_reply(framing, out, &r);
+    }
+
+    journal_free(&j);
+    free(line);
+    free(r.buf);
+}
@@ -0,0 +1,17 @@
+#ifndef ENGINE_H_
+#define ENGINE_H_
+
+#include <stdio.h>
+
+#include "board.h"
+
+/* How engine commands and replies are told apart on the wire. */
+enum engine_framing {
+    ENGINE_TEXT,
+    ENGINE_BINARY,
+};
+
+void run_engine(enum engine_framing framing, FILE *in, FILE *out,
+        struct game *g);
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+
+#include "board.h"
+#include "journal.h"
+
+/*
+ * Set up an empty journal with room for cap moves before it has to grow.
+ * Search code that knows how deep it can go sizes it up front so making a
+ * move never allocates.
+ */
+void
+journal_init(struct journal *j, long cap)
+{
+    j->count = 0;
+    j->top = 0;
+    j->cap = cap > 0 ? cap : 64;
+    j->entries = malloc(j->cap * sizeof(struct journal_entry));
+}
+
+/*
+ * Give back the memory held by j.
+ */
+void
+journal_free(struct journal *j)
+{
+    free(j->entries);
+    j->entries = NULL;
+}
+
+/*
+ * Play entries[j->count].edge for the current player and record what it
+ * did there, passing the turn on unless a box was closed.
+ *
+ * Returns -1 if the edge is already filled, otherwise the number of boxes
+ * it closed.
+ */
+static int
+apply_entry(struct journal *j, struct game *g)
+{
+    struct journal_entry *m = &j->entries[j->count];
+
+    m->player = g->current_player;
+    if ((m->closed_count = take_edge(m->edge, m->closed, g)) < 0) {
+        return -1;
+    }
+    if (m->closed_count == 0) {
+        g->current_player = (g->current_player + 1) % g->num_players;
+    }
+
+    m->x = g->last_x;
+    m->y = g->last_y;
+    m->vertical = g->last_vertical;
+    j->count++;
+
+    return m->closed_count;
+}
+
+/*
+ * Fill edge number e for the current player, pass the turn on as make_move
+ * does and record the move at the end of j.
+ *
+ * Returns -1 if e is not an edge of g or is already filled, otherwise the
+ * number of boxes it closed.
+ */
+int
+journal_make(struct journal *j, long e, struct game *g)
+{
+    int closed;
+
+    /* A move that can't be made must leave anything to redo alone. */
+    if (e < 0 || e >= edge_count(g) || edge_filled(e, g)) {
+        return -1;
+    }
+
+    if (j->count == j->cap) {
+        j->cap *= 2;
+        j->entries = realloc(j->entries,
+                j->cap * sizeof(struct journal_entry));
+    }
+
+    j->entries[j->count].edge = e;
+    closed = apply_entry(j, g);
+    j->top = j->count;
+
+    return closed;
+}
+
+/*
+ * Take back the newest move in j, reopening any boxes it closed and giving
+ * the turn back to whoever made it.
+ *
+ * Returns 1 if there was nothing to undo, otherwise 0.
+ */
+int
+journal_undo(struct journal *j, struct game *g)
+{
+    struct journal_entry *m;
+
+    if (j->count == 0) {
+        return 1;
+    }
+
+    m = &j->entries[--j->count];
+    untake_edge(m->edge, m->closed, m->closed_count, m->player, g);
+    g->current_player = m->player;
+
+    if (j->count == 0) {
+        g->last_x = -1;
+    } else {
+        g->last_x = m[-1].x;
+        g->last_y = m[-1].y;
+        g->last_vertical = m[-1].vertical;
+    }
+
+    return 0;
+}
+
+/*
+ * Play again the move most recently undone in j.
+ *
+ * Returns 1 if there was nothing to redo or it couldn't be played,
+ * otherwise 0.
+ */
+int
+journal_redo(struct journal *j, struct game *g)
+{
+    if (j->count == j->top || apply_entry(j, g) < 0) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "board.h"
+
+/*
+ * One move in a journal: the edge filled (also as a position, so the last
+ * move can be put back without working it out), whose turn it was and the
+ * boxes (numbered as by BOX) it closed for them.
+ */
+struct journal_entry {
+    long edge;
+    long closed[2];
+    int x;
+    int y;
+    int vertical;
+    int player;
+    int closed_count;
+};
+
+/*
+ * The moves made on a game, oldest first. entries[0..count) are on the
+ * board and entries[count..top) have been undone and can be redone. Making
+ * a fresh move throws away anything that could have been redone.
+ */
+struct journal {
+    struct journal_entry *entries;
+    long count;
+    long top;
+    long cap;
+};
+
+void journal_init(struct journal *j, long cap);
+void journal_free(struct journal *j);
+int journal_make(struct journal *j, long e, struct game *g);
+int journal_undo(struct journal *j, struct game *g);
+int journal_redo(struct journal *j, struct game *g);
+
+#endif
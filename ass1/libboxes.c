@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "journal.h"
+#include "libboxes.h"
+
+/* Bytes a load asks read for at a time, to start with. */
+#define READ_CHUNK 65536
+
+/* A game and the moves made in it, so they can be taken back. */
+struct boxes {
+    struct game g;
+    struct journal j;
+};
+
+/*
+ * Set g up as an empty board of the given size.
+ */
+static void
+new_board(int height, int width, int players, struct game *g)
+{
+    memset(g, 0, sizeof(*g));
+    g->width = width;
+    g->height = height;
+    g->num_players = players;
+    g->possible_closures = (long)width * height;
+    allocate_empty_grid(g);
+}
+
+/*
+ * Start a new game on an empty board height by width boxes between players
+ * players, as boxes does with the same arguments.
+ *
+ * Returns the game, or NULL with the reason (BOXES_DIMENSIONS or
+ * BOXES_PLAYERS) in *status, if status isn't NULL.
+ */
+struct boxes *
+boxes_create(int height, int width, int players, int *status)
+{
+    struct boxes *b;
+    int err = BOXES_OK;
+
+    if (height < 2 || height > MAX_DIM || width < 2 || width > MAX_DIM) {
+        err = BOXES_DIMENSIONS;
+    } else if (players < 2 || players > 100) {
+        err = BOXES_PLAYERS;
+    }
+    if (status != NULL) {
+        *status = err;
+    }
+    if (err != BOXES_OK) {
+        return NULL;
+    }
+
+    b = malloc(sizeof(struct boxes));
+    new_board(height, width, players, &b->g);
+    journal_init(&b->j, 0);
+
+    return b;
+}
+
+/*
+ * Give back everything b holds, and b itself.
+ */
+void
+boxes_destroy(struct boxes *b)
+{
+    if (b != NULL) {
+        free_grid(&b->g);
+        journal_free(&b->j);
+        free(b);
+    }
+}
+
+/*
+ * Finish loading a save onto g, a fresh board the size of b's, which went
+ * as status says. Saves are loaded onto a board of their own first so that
+ * a bad one leaves b as it was. If it loaded g replaces b's board, and the
+ * moves that could have been undone go with the old one.
+ *
+ * Returns status as one of ours.
+ */
+static int
+take_board(struct boxes *b, struct game *g, int status)
+{
+    if (status != LOAD_OK) {
+        free_grid(g);
+        return status == LOAD_OPEN ? BOXES_OPEN : BOXES_CONTENTS;
+    }
+
+    free_grid(&b->g);
+    b->g = *g;
+    b->j.count = 0;
+    b->j.top = 0;
+
+    return BOXES_OK;
+}
+
+/*
+ * Load a save, text or binary as boxes writes them, for a game the size of
+ * b from io->read into b.
+ *
+ * Returns BOXES_READ if reading failed and BOXES_CONTENTS if the save
+ * isn't valid for b, leaving b alone either way. Otherwise returns
+ * BOXES_OK.
+ */
+int
+boxes_load(struct boxes *b, struct boxes_io const *io)
+{
+    struct game g;
+    char *data = NULL, *more;
+    size_t len = 0, cap = 0;
+    long got;
+    int status;
+
+    do {
+        if (len == cap) {
+            cap = cap ? cap * 2 : READ_CHUNK;
+            if ((more = realloc(data, cap)) == NULL) {
+                free(data);
+                return BOXES_READ;
+            }
+            data = more;
+        }
+        if ((got = io->read(io->ctx, data + len, cap - len)) < 0) {
+            free(data);
+            return BOXES_READ;
+        }
+        len += got;
+    } while (got > 0);
+
+    new_board(b->g.height, b->g.width, b->g.num_players, &g);
+    status = read_grid_data(data, len, &g);
+    free(data);
+
+    return take_board(b, &g, status);
+}
+
+/*
+ * Load the save at path into b as boxes_load does, but straight from the
+ * file.
+ *
+ * Returns BOXES_OPEN if the file can't be opened, otherwise as
+ * boxes_load.
+ */
+int
+boxes_load_file(struct boxes *b, char const *path)
+{
+    struct game g;
+
+    new_board(b->g.height, b->g.width, b->g.num_players, &g);
+
+    return take_board(b, &g, read_grid_file(path, &g));
+}
+
+/*
+ * Write b to io->write as a text save, the same as the w command.
+ *
+ * Returns BOXES_WRITE if a write failed, otherwise BOXES_OK.
+ */
+int
+boxes_save(struct boxes *b, struct boxes_io const *io)
+{
+    return write_game(io->write, io->ctx, &b->g) ? BOXES_WRITE : BOXES_OK;
+}
+
+/*
+ * Write the picture of b that boxes prints every turn to io->write.
+ *
+ * Returns BOXES_WRITE if a write failed, otherwise BOXES_OK.
+ */
+int
+boxes_print(struct boxes *b, struct boxes_io const *io)
+{
+    return write_grid(io->write, io->ctx, &b->g) ? BOXES_WRITE : BOXES_OK;
+}
+
+/*
+ * Fill the edge at (x, y), down the left of box (x, y) if vertical is set
+ * and along its top otherwise, for the player to move. The turn passes on
+ * unless a box was closed.
+ *
+ * Returns BOXES_OVER if the game has finished, BOXES_MOVE if there is no
+ * such edge or it is already filled, otherwise BOXES_OK.
+ */
+int
+boxes_move(struct boxes *b, int y, int x, int vertical)
+{
+    if (check_game_over(&b->g)) {
+        return BOXES_OVER;
+    }
+
+    return journal_make(&b->j, find_edge(x, y, vertical, &b->g), &b->g) < 0 ?
+            BOXES_MOVE : BOXES_OK;
+}
+
+/*
+ * Make the move in the string move, "y x h|v" as typed at the boxes
+ * prompt, as boxes_move does. A badly formed move is BOXES_MOVE.
+ */
+int
+boxes_play(struct boxes *b, char const *move)
+{
+    long x, y;
+    int vertical;
+
+    if (parse_move(move, &x, &y, &vertical)) {
+        return BOXES_MOVE;
+    }
+
+    return boxes_move(b, y, x, vertical);
+}
+
+/*
+ * Take back the last move made on b.
+ *
+ * Returns BOXES_NOTHING if there isn't one, otherwise BOXES_OK.
+ */
+int
+boxes_undo(struct boxes *b)
+{
+    return journal_undo(&b->j, &b->g) ? BOXES_NOTHING : BOXES_OK;
+}
+
+/*
+ * Put back the last move taken back on b, if nothing has been played since.
+ *
+ * Returns BOXES_NOTHING if there isn't one, otherwise BOXES_OK.
+ */
+int
+boxes_redo(struct boxes *b)
+{
+    return journal_redo(&b->j, &b->g) ? BOXES_NOTHING : BOXES_OK;
+}
+
+/*
+ * Return the player to move in b, counting from 0 for A.
+ */
+int
+boxes_player(struct boxes *b)
+{
+    return b->g.current_player;
+}
+
+/*
+ * Return how many boxes player (from 0) has in b, or -1 if there is no
+ * such player.
+ */
+long
+boxes_score(struct boxes *b, int player)
+{
+    if (player < 0 || player >= b->g.num_players) {
+        return -1;
+    }
+
+    return b->g.scores[player];
+}
+
+/*
+ * Return whether every box in b has been taken.
+ */
+int
+boxes_over(struct boxes *b)
+{
+    return check_game_over(&b->g);
+}
+
+/*
+ * Put the players with the highest score in b into winners, which needs
+ * room for every player, in order. Returns how many there are.
+ */
+int
+boxes_winners(struct boxes *b, int *winners)
+{
+    return find_winners(&b->g, winners);
+}
+
+/*
+ * Return a line describing status, without a newline. Failures boxes
+ * exits with get the message boxes prints for them.
+ */
+char const *
+boxes_message(int status)
+{
+    switch (status) {
+        case BOXES_OK:
+            return "OK";
+        case BOXES_DIMENSIONS:
+            return "Invalid grid dimensions";
+        case BOXES_PLAYERS:
+            return "Invalid player count";
+        case BOXES_OPEN:
+            return load_message(LOAD_OPEN);
+        case BOXES_CONTENTS:
+            return load_message(LOAD_CONTENTS);
+        case BOXES_MOVE:
+            return "Invalid move";
+        case BOXES_OVER:
+            return "Game over";
+        case BOXES_NOTHING:
+            return "Nothing to undo or redo";
+        case BOXES_READ:
+            return "Can not read save";
+        case BOXES_WRITE:
+            return "Can not write save";
+        default:
+            return "Unknown error";
+    }
+}
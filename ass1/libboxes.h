@@ -0,0 +1,60 @@
+#ifndef LIBBOXES_H_
+#define LIBBOXES_H_
+
+#include <stddef.h>
+
+/*
+ * A game of boxes that can be played without a terminal. Each one owns
+ * everything it uses, so any number can be going at once in one process,
+ * one thread to a game.
+ */
+struct boxes;
+
+/*
+ * What the library functions return. Failures boxes has an exit status
+ * for are numbered the same.
+ */
+enum boxes_status {
+    BOXES_OK = 0,
+    BOXES_DIMENSIONS = 2,
+    BOXES_PLAYERS = 3,
+    BOXES_OPEN = 4,
+    BOXES_CONTENTS = 5,
+    BOXES_MOVE = 12,
+    BOXES_OVER = 13,
+    BOXES_NOTHING = 14,
+    BOXES_READ = 15,
+    BOXES_WRITE = 16,
+};
+
+/*
+ * Where a save comes from or goes to. read puts up to n bytes in buf and
+ * returns how many, 0 at the end or -1 if it failed. write takes all n
+ * bytes at buf and returns nonzero if it failed. Both are handed ctx. Only
+ * the one being used needs to be set.
+ */
+struct boxes_io {
+    void *ctx;
+    long (*read)(void *ctx, char *buf, size_t n);
+    int (*write)(void *ctx, char const *buf, size_t n);
+};
+
+struct boxes *boxes_create(int height, int width, int players, int *status);
+void boxes_destroy(struct boxes *b);
+int boxes_load(struct boxes *b, struct boxes_io const *io);
+int boxes_load_file(struct boxes *b, char const *path);
+int boxes_save(struct boxes *b, struct boxes_io const *io);
+int boxes_print(struct boxes *b, struct boxes_io const *io);
+
+int boxes_move(struct boxes *b, int y, int x, int vertical);
+int boxes_play(struct boxes *b, char const *move);
+int boxes_undo(struct boxes *b);
+int boxes_redo(struct boxes *b);
+
+int boxes_player(struct boxes *b);
+long boxes_score(struct boxes *b, int player);
+int boxes_over(struct boxes *b);
+int boxes_winners(struct boxes *b, int *winners);
+char const *boxes_message(int status);
+
+#endif
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "mcts.h"
+#include "policy.h"
+
+/* Nodes each thread's tree starts with room for, on top of the root's. */
+#define TREE_NODES (1L << 19)
+
+/* Exploration constant for UCT. */
+#define EXPLORE 1.0
+
+/* Random edges a playout looks at for a safe one before taking any. */
+#define SAFE_TRIES 8
+
+/*
+ * A position in compact form: a bit per edge, a side count per box and the
+ * scores and player to move.
+ */
+struct pos {
+    uint64_t *filled;
+    unsigned char *sides;
+    long scores[100];
+    int player;
+    long free_count;
+};
+
+/*
+ * What every thread shares, read only: how edges and boxes are joined and
+ * the position being searched. edge_boxes[e] holds the boxes either side
+ * of edge e (-1 past the edge of the board) and box_edges[b] the four
+ * edges round box b.
+ */
+struct shared {
+    long edges;
+    long boxes;
+    long words;
+    int players;
+    long (*edge_boxes)[2];
+    long (*box_edges)[4];
+    struct pos root;
+    struct timespec deadline;
+};
+
+/*
+ * One node of a tree. Its children are the count nodes from first_child
+ * on (first_child is -1 until it is expanded), move is the edge played to
+ * get to it and player who played it, and reward is the total that player
+ * got out of the visits through it.
+ */
+struct node {
+    long first_child;
+    int32_t move;
+    int32_t count;
+    uint32_t visits;
+    int player;
+    double reward;
+};
+
+/*
+ * One thread's search. Its tree lives in nodes, and work, path and the
+ * playout lists are all sized up front so that no playout allocates.
+ */
+struct searcher {
+    pthread_t thread;
+    struct shared *sh;
+    uint64_t rng;
+    struct pos work;
+    struct node *nodes;
+    long used;
+    long cap;
+    long *path;
+    long *free_list;
+    long *free_pos;
+    long *captures;
+    long playouts;
+};
+
+/*
+ * Get p ready to hold a position of sh.
+ */
+static void
+pos_init(struct pos *p, struct shared *sh)
+{
+    p->filled = calloc(sh->words, sizeof(uint64_t));
+    p->sides = calloc(sh->boxes, 1);
+}
+
+/*
+ * Make to the same position as from.
+ */
+static void
+pos_copy(struct pos *to, struct pos const *from, struct shared *sh)
+{
+    memcpy(to->filled, from->filled, sh->words * sizeof(uint64_t));
+    memcpy(to->sides, from->sides, sh->boxes);
+    memcpy(to->scores, from->scores, sh->players * sizeof(long));
+    to->player = from->player;
+    to->free_count = from->free_count;
+}
+
+/*
+ * Fill edge e of p for the player to move, passing the turn on unless a
+ * box was closed. Boxes that get a third side are pushed on *captures if
+ * it isn't NULL.
+ */
+static void
+play(struct shared *sh, struct pos *p, long e, long **captures)
+{
+    int closed = 0, k;
+    long b;
+
+    SET_BIT(p->filled, e);
+    p->free_count--;
+
+    for (k = 0; k < 2; ++k) {
+        if ((b = sh->edge_boxes[e][k]) < 0) {
+            continue;
+        }
+        if (++p->sides[b] == 4) {
+            p->scores[p->player]++;
+            closed = 1;
+        } else if (p->sides[b] == 3 && captures != NULL) {
+            *(*captures)++ = b;
+        }
+    }
+
+    if (!closed) {
+        p->player = (p->player + 1) % sh->players;
+    }
+}
+
+/*
+ * Return whether filling e in p would give no box its third side.
+ */
+static int
+is_safe(struct shared *sh, struct pos const *p, long e)
+{
+    return (sh->edge_boxes[e][0] < 0 || p->sides[sh->edge_boxes[e][0]] < 2)
+            && (sh->edge_boxes[e][1] < 0 ||
+            p->sides[sh->edge_boxes[e][1]] < 2);
+}
+
+/*
+ * Play the work position of s out to the end: take a box whenever one is
+ * there, otherwise fill a random safe edge if one turns up in a few tries,
+ * otherwise any random edge. Fills reward with each player's share of the
+ * win.
+ */
+static void
+playout(struct searcher *s, double *reward)
+{
+    struct shared *sh = s->sh;
+    struct pos *p = &s->work;
+    long n = 0, e, b, i, best, *top = s->captures;
+    int k, tries, winners = 0;
+
+    for (e = 0; e < sh->edges; ++e) {
+        if (!TEST_BIT(p->filled, e)) {
+            s->free_pos[e] = n;
+            s->free_list[n++] = e;
+        }
+    }
+    for (b = 0; b < sh->boxes; ++b) {
+        if (p->sides[b] == 3) {
+            *top++ = b;
+        }
+    }
+
+    while (n > 0) {
+        e = -1;
+        while (e < 0 && top > s->captures) {
+            b = *--top;
+            for (k = 0; k < 4 && p->sides[b] == 3; ++k) {
+                if (!TEST_BIT(p->filled, sh->box_edges[b][k])) {
+                    e = sh->box_edges[b][k];
+                    break;
+                }
+            }
+        }
+        for (tries = 0; e < 0 && tries < SAFE_TRIES; ++tries) {
+            e = s->free_list[next_rand(&s->rng) % n];
+            if (!is_safe(sh, p, e) && tries < SAFE_TRIES - 1) {
+                e = -1;
+            }
+        }
+
+        /* Swap e out of the free list. */
+        i = s->free_pos[e];
+        s->free_list[i] = s->free_list[--n];
+        s->free_pos[s->free_list[i]] = i;
+
+        play(sh, p, e, &top);
+    }
+
+    best = p->scores[0];
+    for (k = 1; k < sh->players; ++k) {
+        best = p->scores[k] > best ? p->scores[k] : best;
+    }
+    for (k = 0; k < sh->players; ++k) {
+        winners += p->scores[k] == best;
+    }
+    for (k = 0; k < sh->players; ++k) {
+        reward[k] = p->scores[k] == best ? 1.0 / winners : 0.0;
+    }
+}
+
+/*
+ * Give node n of s a child for every free edge of the work position, if
+ * there is room for them.
+ */
+static void
+expand(struct searcher *s, long n)
+{
+    struct shared *sh = s->sh;
+    struct node *c;
+    long e;
+
+    if (s->used + s->work.free_count > s->cap) {
+        return;
+    }
+
+    s->nodes[n].first_child = s->used;
+    s->nodes[n].count = s->work.free_count;
+    for (e = 0; e < sh->edges; ++e) {
+        if (!TEST_BIT(s->work.filled, e)) {
+            c = &s->nodes[s->used++];
+            c->first_child = -1;
+            c->move = e;
+            c->count = 0;
+            c->visits = 0;
+            c->player = s->work.player;
+            c->reward = 0;
+        }
+    }
+}
+
+/*
+ * Return the child of node n to try next by UCT, trying each once first.
+ */
+static long
+select_child(struct searcher *s, long n)
+{
+    struct node *parent = &s->nodes[n], *c;
+    double log_n = log(parent->visits + 1), score, best = -1;
+    long i, pick = parent->first_child;
+
+    for (i = 0; i < parent->count; ++i) {
+        c = &s->nodes[parent->first_child + i];
+        if (c->visits == 0) {
+            return parent->first_child + i;
+        }
+        score = c->reward / c->visits + EXPLORE * sqrt(log_n / c->visits);
+        if (score > best) {
+            best = score;
+            pick = parent->first_child + i;
+        }
+    }
+
+    return pick;
+}
+
+/*
+ * Return whether the search's time is up.
+ */
+static int
+out_of_time(struct shared *sh)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec > sh->deadline.tv_sec ||
+            (now.tv_sec == sh->deadline.tv_sec &&
+            now.tv_nsec >= sh->deadline.tv_nsec);
+}
+
+/*
+ * Thread body: grow s's own tree from the root until time runs out. Each
+ * round walks down by UCT, expands the node it stops at if that has been
+ * visited before, plays out and passes the result back up the path.
+ */
+static void *
+run_searcher(void *arg)
+{
+    struct searcher *s = arg;
+    struct shared *sh = s->sh;
+    double reward[100];
+    long n, depth, i;
+
+    do {
+        pos_copy(&s->work, &sh->root, sh);
+        n = 0;
+        depth = 0;
+        s->path[depth++] = n;
+
+        while (s->nodes[n].first_child >= 0 && s->nodes[n].count > 0) {
+            n = select_child(s, n);
+            play(sh, &s->work, s->nodes[n].move, NULL);
+            s->path[depth++] = n;
+        }
+
+        if (s->work.free_count > 0 && (n == 0 || s->nodes[n].visits > 0)) {
+            expand(s, n);
+            if (s->nodes[n].first_child >= 0) {
+                n = s->nodes[n].first_child +
+                        next_rand(&s->rng) % s->nodes[n].count;
+                play(sh, &s->work, s->nodes[n].move, NULL);
+                s->path[depth++] = n;
+            }
+        }
+
+        playout(s, reward);
+        s->playouts++;
+
+        for (i = 0; i < depth; ++i) {
+            s->nodes[s->path[i]].visits++;
+            s->nodes[s->path[i]].reward += reward[s->nodes[s->path[i]].player];
+        }
+    } while (!out_of_time(sh));
+
+    return NULL;
+}
+
+/*
+ * Build the shared tables and root position for g.
+ */
+static void
+setup(struct shared *sh, struct game *g)
+{
+    long e, b;
+    int x, y, vertical;
+
+    sh->edges = edge_count(g);
+    sh->boxes = (long)g->height * g->width;
+    sh->words = WORDS_FOR(sh->edges);
+    sh->players = g->num_players;
+    sh->edge_boxes = malloc(sh->edges * sizeof(*sh->edge_boxes));
+    sh->box_edges = malloc(sh->boxes * sizeof(*sh->box_edges));
+
+    pos_init(&sh->root, sh);
+    memcpy(sh->root.scores, g->scores, sh->players * sizeof(long));
+    sh->root.player = g->current_player;
+    sh->root.free_count = 0;
+
+    for (e = 0; e < sh->edges; ++e) {
+        edge_coords(e, &x, &y, &vertical, g);
+        sh->edge_boxes[e][0] = -1;
+        sh->edge_boxes[e][1] = -1;
+        if (vertical) {
+            if (x > 0) {
+                sh->edge_boxes[e][0] = BOX(g, x - 1, y);
+            }
+            if (x < g->width) {
+                sh->edge_boxes[e][1] = BOX(g, x, y);
+            }
+        } else {
+            if (y > 0) {
+                sh->edge_boxes[e][0] = BOX(g, x, y - 1);
+            }
+            if (y < g->height) {
+                sh->edge_boxes[e][1] = BOX(g, x, y);
+            }
+        }
+
+        if (edge_filled(e, g)) {
+            SET_BIT(sh->root.filled, e);
+        } else {
+            sh->root.free_count++;
+        }
+    }
+
+    for (b = 0; b < sh->boxes; ++b) {
+        x = b % g->width;
+        y = b / g->width;
+        sh->box_edges[b][0] = edge_index(x, y, 0, g);
+        sh->box_edges[b][1] = edge_index(x, y + 1, 0, g);
+        sh->box_edges[b][2] = edge_index(x, y, 1, g);
+        sh->box_edges[b][3] = edge_index(x + 1, y, 1, g);
+        sh->root.sides[b] = box_sides(x, y, g);
+    }
+}
+
+/*
+ * Pick a move for the player to move in g by Monte Carlo tree search,
+ * thinking for budget seconds on threads threads. Each thread grows its own
+ * tree from the current position; at the end the visits to each root move
+ * are added up over the trees and the most visited move is played. g is
+ * left alone.
+ *
+ * Returns 1 (and leaves res alone) if the board is too big, otherwise 0.
+ * res->move is -1 if the game is over.
+ */
+int
+mcts(struct game *g, double budget, int threads, struct mcts_result *res)
+{
+    struct shared sh;
+    struct searcher *s;
+    struct timespec start, stop;
+    struct node *c;
+    long *visits, e, i;
+    int t;
+
+    if (edge_count(g) > MCTS_MAX_EDGES) {
+        return 1;
+    }
+
+    setup(&sh, g);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sh.deadline = start;
+    sh.deadline.tv_sec += (time_t)budget;
+    sh.deadline.tv_nsec += (long)((budget - (time_t)budget) * 1e9);
+    if (sh.deadline.tv_nsec >= 1000000000L) {
+        sh.deadline.tv_sec++;
+        sh.deadline.tv_nsec -= 1000000000L;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->move = -1;
+
+    s = calloc(threads, sizeof(struct searcher));
+    for (t = 0; sh.root.free_count > 0 && t < threads; ++t) {
+        s[t].sh = &sh;
+        s[t].rng = (t + 1) * 0x9e3779b97f4a7c15ULL | 1;
+        pos_init(&s[t].work, &sh);
+        s[t].cap = TREE_NODES + sh.root.free_count + 1;
+        s[t].nodes = malloc(s[t].cap * sizeof(struct node));
+        s[t].nodes[0].first_child = -1;
+        s[t].nodes[0].count = 0;
+        s[t].nodes[0].visits = 0;
+        s[t].nodes[0].player = 0;
+        s[t].nodes[0].reward = 0;
+        s[t].used = 1;
+        s[t].path = malloc((sh.root.free_count + 2) * sizeof(long));
+        s[t].free_list = malloc(sh.edges * sizeof(long));
+        s[t].free_pos = malloc(sh.edges * sizeof(long));
+        s[t].captures = malloc((sh.boxes + 2 * sh.edges) * sizeof(long));
+        pthread_create(&s[t].thread, NULL, run_searcher, &s[t]);
+    }
+
+    visits = calloc(sh.edges, sizeof(long));
+    for (t = 0; sh.root.free_count > 0 && t < threads; ++t) {
+        pthread_join(s[t].thread, NULL);
+        for (i = 0; i < s[t].nodes[0].count; ++i) {
+            c = &s[t].nodes[s[t].nodes[0].first_child + i];
+            visits[c->move] += c->visits;
+        }
+        res->playouts += s[t].playouts;
+
+        free(s[t].work.filled);
+        free(s[t].work.sides);
+        free(s[t].nodes);
+        free(s[t].path);
+        free(s[t].free_list);
+        free(s[t].free_pos);
+        free(s[t].captures);
+    }
+
+    for (e = 0; e < sh.edges; ++e) {
+        if (!TEST_BIT(sh.root.filled, e) &&
+                (res->move < 0 || visits[e] > res->visits)) {
+            res->move = e;
+            res->visits = visits[e];
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    res->seconds = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    free(visits);
+    free(s);
+    free(sh.edge_boxes);
+    free(sh.box_edges);
+    free(sh.root.filled);
+    free(sh.root.sides);
+
+    return 0;
+}
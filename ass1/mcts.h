@@ -0,0 +1,22 @@
+#ifndef MCTS_H_
+#define MCTS_H_
+
+#include "board.h"
+
+/* Largest board, in edges, the computer player will take on. */
+#define MCTS_MAX_EDGES (1L << 22)
+
+/*
+ * What a search did. visits is how often the chosen move was tried, over
+ * every thread.
+ */
+struct mcts_result {
+    long move;
+    long playouts;
+    long visits;
+    double seconds;
+};
+
+int mcts(struct game *g, double budget, int threads, struct mcts_result *res);
+
+#endif
@@ -0,0 +1,714 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "board.h"
+#include "nimstring.h"
+
+/* Memo files start with this, then a struct memo_header. */
+#define MEMO_MAGIC "BXNV"
+#define MEMO_VERSION 1
+
+/* A connected component can't have more coins than strings plus one. */
+#define MAX_COINS (NIM_MAX_STRINGS + 1)
+
+struct memo_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t cap;
+    uint64_t count;
+};
+
+/*
+ * One component as strings and coins. String s joins coins ends[s][0] and
+ * ends[s][1], the second of which is -1 if it goes to the ground. at[c] has
+ * a bit for every string of coin c. A set of strings still uncut is a mask
+ * over the string numbers.
+ */
+struct graph {
+    int coins;
+    int strings;
+    int ends[NIM_MAX_STRINGS][2];
+    uint64_t at[MAX_COINS];
+};
+
+/*
+ * Search state for valuing one component.
+ */
+struct nim_search {
+    struct graph *gr;
+    struct nim_memo *m;
+    struct timespec deadline;
+    long nodes;
+    long probes;
+    long hits;
+    int aborted;
+};
+
+/*
+ * Return how many of the strings in mask coin c still has.
+ */
+static int
+degree(struct graph const *gr, uint64_t mask, int c)
+{
+    return __builtin_popcountll(mask & gr->at[c]);
+}
+
+/*
+ * Return the coin, or -1 for the ground, at the other end from c of the
+ * string of c in mask that isn't s.
+ */
+static int
+far_end(struct graph const *gr, uint64_t mask, int c, int s)
+{
+    int t = __builtin_ctzll(mask & gr->at[c] & ~((uint64_t)1 << s));
+
+    return gr->ends[t][0] == c ? gr->ends[t][1] : gr->ends[t][0];
+}
+
+/*
+ * Return whether the player to move in mask has been offered a loony
+ * move: a coin to take whose last string leads on to a coin with two, the
+ * second of which doesn't lead to a coin to take. They can then either take
+ * both or decline the pair by cutting that second string.
+ */
+static int
+is_loony(struct graph const *gr, uint64_t mask)
+{
+    uint64_t rest;
+    int s, k, c, d, e;
+
+    for (rest = mask; rest != 0; rest &= rest - 1) {
+        s = __builtin_ctzll(rest);
+        for (k = 0; k < 2; ++k) {
+            c = gr->ends[s][k];
+            d = gr->ends[s][1 - k];
+            if (c >= 0 && d >= 0 && degree(gr, mask, c) == 1 &&
+                    degree(gr, mask, d) == 2 &&
+                    ((e = far_end(gr, mask, d, s)) < 0 ||
+                    degree(gr, mask, e) > 1)) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Take every coin in *mask that can be taken, one after another, which is
+ * always right in nimstring unless it would be loony. Taking one coin can
+ * leave a loony offer that wasn't there before, so that is checked for
+ * before each.
+ *
+ * Returns 1 if a loony offer turned up, with *mask as far as it got, or 0
+ * once there is nothing left to take.
+ */
+static int
+capture(struct graph const *gr, uint64_t *mask)
+{
+    uint64_t rest;
+    int s, c0, c1;
+
+    while (!is_loony(gr, *mask)) {
+        for (rest = *mask; rest != 0; rest &= rest - 1) {
+            s = __builtin_ctzll(rest);
+            c0 = gr->ends[s][0];
+            c1 = gr->ends[s][1];
+            if ((c0 >= 0 && degree(gr, *mask, c0) == 1) ||
+                    (c1 >= 0 && degree(gr, *mask, c1) == 1)) {
+                break;
+            }
+        }
+        if (rest == 0) {
+            return 0;
+        }
+        *mask &= ~((uint64_t)1 << s);
+    }
+
+    return 1;
+}
+
+/*
+ * Return the strings of mask connected to string s through coins.
+ */
+static uint64_t
+component_of(struct graph const *gr, uint64_t mask, int s)
+{
+    uint64_t comp = (uint64_t)1 << s, todo = comp, add;
+    int t, k;
+
+    while (todo != 0) {
+        t = __builtin_ctzll(todo);
+        todo &= todo - 1;
+        for (k = 0; k < 2; ++k) {
+            if (gr->ends[t][k] >= 0) {
+                add = gr->at[gr->ends[t][k]] & mask & ~comp;
+                comp |= add;
+                todo |= add;
+            }
+        }
+    }
+
+    return comp;
+}
+
+/*
+ * Describe the connected component mask into out, numbering its coins in
+ * breadth first order from start, and return the length. Each coin gets
+ * its number of ground strings, its number of coin neighbours and then
+ * their numbers in order. Equal descriptions mean equal components, and
+ * taking the least over several starts makes the same component drawn
+ * another way round usually come out the same too.
+ */
+static int
+describe(struct graph const *gr, uint64_t mask, int start,
+        unsigned char *out)
+{
+    int order[MAX_COINS], number[MAX_COINS], nbr[4], ground, count;
+    int head = 0, tail = 0, len = 0, c, d, s, i, j, t;
+    uint64_t rest;
+
+    for (c = 0; c < gr->coins; ++c) {
+        number[c] = -1;
+    }
+    number[start] = tail;
+    order[tail++] = start;
+
+    while (head < tail) {
+        c = order[head++];
+        ground = count = 0;
+        for (rest = mask & gr->at[c]; rest != 0; rest &= rest - 1) {
+            s = __builtin_ctzll(rest);
+            d = gr->ends[s][0] == c ? gr->ends[s][1] : gr->ends[s][0];
+            if (d < 0) {
+                ground++;
+            } else {
+                if (number[d] < 0) {
+                    number[d] = tail;
+                    order[tail++] = d;
+                }
+                nbr[count++] = number[d];
+            }
+        }
+
+        /* At most four, so an insertion sort does. */
+        for (i = 1; i < count; ++i) {
+            for (j = i; j > 0 && nbr[j - 1] > nbr[j]; --j) {
+                t = nbr[j];
+                nbr[j] = nbr[j - 1];
+                nbr[j - 1] = t;
+            }
+        }
+
+        out[len++] = ground;
+        out[len++] = count;
+        for (i = 0; i < count; ++i) {
+            out[len++] = nbr[i];
+        }
+    }
+
+    return len;
+}
+
+/*
+ * Work out the memo key of the connected component mask: two independent
+ * 64 bit hashes of its least description, started from each of the coins
+ * with the fewest strings.
+ */
+static void
+component_key(struct graph const *gr, uint64_t mask, uint64_t *key)
+{
+    unsigned char best[MAX_COINS * 6], desc[MAX_COINS * 6];
+    int best_len = 0, len, c, least = 5, i;
+
+    for (c = 0; c < gr->coins; ++c) {
+        if ((mask & gr->at[c]) != 0 && degree(gr, mask, c) < least) {
+            least = degree(gr, mask, c);
+        }
+    }
+
+    for (c = 0; c < gr->coins; ++c) {
+        if ((mask & gr->at[c]) == 0 || degree(gr, mask, c) != least) {
+            continue;
+        }
+        len = describe(gr, mask, c, desc);
+        if (best_len == 0 || len < best_len ||
+                (len == best_len && memcmp(desc, best, len) < 0)) {
+            memcpy(best, desc, len);
+            best_len = len;
+        }
+    }
+
+    /* FNV-1a both ways, from different offsets. */
+    key[0] = 0xcbf29ce484222325ULL;
+    key[1] = 0x84222325cbf29ce4ULL;
+    for (i = 0; i < best_len; ++i) {
+        key[0] = (key[0] ^ best[i]) * 0x100000001b3ULL;
+        key[1] = (key[1] ^ best[best_len - 1 - i]) * 0x100000001b3ULL;
+    }
+    key[1] |= 1;
+}
+
+/*
+ * Return the slot in the cap slots of table where key is, or the empty
+ * slot it would go in. nim_memo_open makes sure there is always one.
+ */
+static struct nim_slot *
+find_slot(struct nim_slot *table, long cap, uint64_t const *key)
+{
+    long i = key[0] & (cap - 1);
+
+    while ((table[i].key[0] != key[0] || table[i].key[1] != key[1]) &&
+            table[i].key[1] != 0) {
+        i = (i + 1) & (cap - 1);
+    }
+
+    return &table[i];
+}
+
+/*
+ * Look key up in m, returning its value or -1 if it isn't there.
+ */
+static int
+memo_get(struct nim_memo *m, uint64_t const *key)
+{
+    struct nim_slot *slot;
+
+    if (m->file != NULL &&
+            (slot = find_slot(m->file, m->file_cap, key))->key[1] != 0) {
+        return slot->value;
+    }
+
+    slot = find_slot(m->table, m->cap, key);
+    return slot->key[1] != 0 ? (int)slot->value : -1;
+}
+
+/*
+ * Put key and value in the cap slots of table.
+ */
+static void
+store(struct nim_slot *table, long cap, uint64_t const *key, uint32_t value)
+{
+    struct nim_slot *slot = find_slot(table, cap, key);
+
+    slot->key[0] = key[0];
+    slot->key[1] = key[1];
+    slot->value = value;
+}
+
+/*
+ * Remember that key has value in m, growing its table to keep it no more
+ * than half full.
+ */
+static void
+memo_put(struct nim_memo *m, uint64_t const *key, int value)
+{
+    struct nim_slot *old = m->table;
+    long old_cap = m->cap, i;
+
+    if (2 * (m->count + 1) > m->cap) {
+        m->cap *= 2;
+        m->table = calloc(m->cap, sizeof(struct nim_slot));
+        for (i = 0; i < old_cap; ++i) {
+            if (old[i].key[1] != 0) {
+                store(m->table, m->cap, old[i].key, old[i].value);
+            }
+        }
+        free(old);
+    }
+
+    store(m->table, m->cap, key, value);
+    m->count++;
+}
+
+/*
+ * Check the clock every so often and give up once the budget is spent.
+ */
+static int
+out_of_time(struct nim_search *n)
+{
+    struct timespec now;
+
+    if (!n->aborted && (n->nodes & 1023) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        n->aborted = now.tv_sec > n->deadline.tv_sec ||
+                (now.tv_sec == n->deadline.tv_sec &&
+                now.tv_nsec >= n->deadline.tv_nsec);
+    }
+
+    return n->aborted;
+}
+
+/*
+ * Return the nimstring value of the strings in mask, none of whose coins
+ * can be taken, or NIM_UNKNOWN if time ran out.
+ *
+ * Disconnected parts are valued on their own and nim summed. A connected
+ * one is worth the least value none of its moves lead to, skipping loony
+ * moves (which lose) and letting the opponent take whatever a move gives
+ * away before valuing what is left.
+ */
+static int
+value(struct nim_search *n, uint64_t mask)
+{
+    uint64_t first, rest, after, seen[2] = { 0, 0 }, key[2];
+    int a, b, v, s;
+
+    if (mask == 0) {
+        return 0;
+    }
+
+    first = component_of(n->gr, mask, __builtin_ctzll(mask));
+    if (first != mask) {
+        a = value(n, first);
+        b = a < 0 ? a : value(n, mask & ~first);
+        return b < 0 ? b : a ^ b;
+    }
+
+    component_key(n->gr, mask, key);
+    n->probes++;
+    if ((v = memo_get(n->m, key)) >= 0) {
+        n->hits++;
+        return v;
+    }
+
+    n->nodes++;
+    if (out_of_time(n)) {
+        return NIM_UNKNOWN;
+    }
+
+    for (rest = mask; rest != 0; rest &= rest - 1) {
+        s = __builtin_ctzll(rest);
+        after = mask & ~((uint64_t)1 << s);
+        if (capture(n->gr, &after)) {
+            continue;
+        }
+        if ((v = value(n, after)) < 0) {
+            return v;
+        }
+        seen[v >> 6] |= (uint64_t)1 << (v & 63);
+    }
+
+    v = ~seen[0] != 0 ? __builtin_ctzll(~seen[0]) :
+            64 + __builtin_ctzll(~seen[1]);
+    memo_put(n->m, key, v);
+
+    return v;
+}
+
+/*
+ * Load the memo at path if there is one, mapping it in, and get ready to
+ * add to it. With path NULL the memo lives only as long as m.
+ *
+ * Exits with status 11 if path isn't a memo file, including one with a
+ * value no component can have or with no empty slot for lookups to stop
+ * at.
+ */
+void
+nim_memo_open(struct nim_memo *m, char const *path)
+{
+    struct memo_header hdr;
+    struct nim_slot *file;
+    struct stat st;
+    void *map;
+    uint64_t used = 0, i;
+    int fd;
+
+    m->path = path != NULL ? strdup(path) : NULL;
+    m->file = NULL;
+    m->file_cap = 0;
+    m->cap = 1024;
+    m->count = 0;
+    m->table = calloc(m->cap, sizeof(struct nim_slot));
+
+    if (path == NULL || (fd = open(path, O_RDONLY)) < 0) {
+        return;
+    }
+
+    if (fstat(fd, &st) || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+            memcmp(hdr.magic, MEMO_MAGIC, 4) != 0 ||
+            hdr.version != MEMO_VERSION || hdr.cap == 0 ||
+            (hdr.cap & (hdr.cap - 1)) != 0 ||
+            (uint64_t)st.st_size !=
+            sizeof(hdr) + hdr.cap * sizeof(struct nim_slot) ||
+            (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+            MAP_FAILED) {
+        fprintf(stderr, "Invalid nimstring memo\n");
+        exit(11);
+    }
+    close(fd);
+
+    file = (struct nim_slot *)((char *)map + sizeof(hdr));
+    for (i = 0; i < hdr.cap; ++i) {
+        if (file[i].key[1] != 0) {
+            used++;
+            if (file[i].value > NIM_MAX_STRINGS) {
+                break;
+            }
+        }
+    }
+    if (i < hdr.cap || used == hdr.cap) {
+        fprintf(stderr, "Invalid nimstring memo\n");
+        exit(11);
+    }
+
+    m->map_len = st.st_size;
+    m->file = file;
+    m->file_cap = hdr.cap;
+}
+
+/*
+ * Write m back to its file, if it has one and anything new was learned,
+ * and give back its memory. The merged table goes to a temporary file that
+ * is renamed over the old one, so a crash leaves the old one alone.
+ *
+ * Exits with status 11 if the memo can't be written.
+ */
+void
+nim_memo_close(struct nim_memo *m)
+{
+    struct memo_header hdr;
+    struct nim_slot *merged;
+    long total = m->count, cap = 1024, i;
+    char *tmp;
+    int fd;
+
+    if (m->path != NULL && m->count > 0) {
+        for (i = 0; i < m->file_cap; ++i) {
+            total += m->file[i].key[1] != 0;
+        }
+        while (cap < 2 * total) {
+            cap *= 2;
+        }
+
+        merged = calloc(cap, sizeof(struct nim_slot));
+        for (i = 0; i < m->file_cap; ++i) {
+            if (m->file[i].key[1] != 0) {
+                store(merged, cap, m->file[i].key, m->file[i].value);
+            }
+        }
+        for (i = 0; i < m->cap; ++i) {
+            if (m->table[i].key[1] != 0) {
+                store(merged, cap, m->table[i].key, m->table[i].value);
+            }
+        }
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, MEMO_MAGIC, 4);
+        hdr.version = MEMO_VERSION;
+        hdr.cap = cap;
+        hdr.count = total;
+
+        tmp = malloc(strlen(m->path) + 5);
+        sprintf(tmp, "%s.tmp", m->path);
+        if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0 ||
+                write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+                write(fd, merged, cap * sizeof(struct nim_slot)) !=
+                (ssize_t)(cap * sizeof(struct nim_slot)) ||
+                close(fd) || rename(tmp, m->path)) {
+            fprintf(stderr, "Can not write nimstring memo\n");
+            exit(11);
+        }
+        free(tmp);
+        free(merged);
+    }
+
+    if (m->file != NULL) {
+        munmap((char *)m->file - sizeof(struct memo_header), m->map_len);
+    }
+    free(m->table);
+    free(m->path);
+}
+
+/*
+ * Fill nb with the box across each free side of box b, and ground with
+ * whether that side is on the edge of the board instead, and return how
+ * many free sides there are.
+ */
+static int
+free_sides(long b, long *nb, int *ground, struct game *g)
+{
+    long x = b % g->width, y = b / g->width;
+    int k = 0;
+
+    if (!hedge_filled(x, y, g)) {
+        ground[k] = y == 0;
+        nb[k++] = b - g->width;
+    }
+    if (!hedge_filled(x, y + 1, g)) {
+        ground[k] = y == g->height - 1;
+        nb[k++] = b + g->width;
+    }
+    if (!vedge_filled(x, y, g)) {
+        ground[k] = x == 0;
+        nb[k++] = b - 1;
+    }
+    if (!vedge_filled(x + 1, y, g)) {
+        ground[k] = x == g->width - 1;
+        nb[k++] = b + 1;
+    }
+
+    return k;
+}
+
+/*
+ * Build the component of the board holding box start into gr, marking its
+ * boxes in seen and numbering them in local. Returns the number of strings
+ * it has; if that's more than NIM_MAX_STRINGS gr is left unfinished.
+ */
+static long
+build_component(long start, char *seen, int *local, long *queue,
+        struct graph *gr, struct game *g)
+{
+    long head = 0, tail = 0, strings = 0, b, nb[4];
+    int ground[4], i, k;
+
+    seen[start] = 1;
+    queue[tail++] = start;
+
+    while (head < tail) {
+        b = queue[head++];
+        k = free_sides(b, nb, ground, g);
+
+        for (i = 0; i < k; ++i) {
+            if (!ground[i] && !seen[nb[i]]) {
+                seen[nb[i]] = 1;
+                queue[tail++] = nb[i];
+            }
+            if (ground[i] || nb[i] > b) {
+                strings++;
+            }
+        }
+    }
+
+    if (strings > NIM_MAX_STRINGS) {
+        return strings;
+    }
+
+    memset(gr, 0, sizeof(*gr));
+    gr->coins = tail;
+    for (i = 0; i < tail; ++i) {
+        local[queue[i]] = i;
+    }
+
+    /* Go round again now every coin has its number. */
+    for (head = 0; head < tail; ++head) {
+        b = queue[head];
+        k = free_sides(b, nb, ground, g);
+
+        for (i = 0; i < k; ++i) {
+            if (ground[i] || nb[i] > b) {
+                gr->ends[gr->strings][0] = head;
+                gr->ends[gr->strings][1] = ground[i] ? -1 : local[nb[i]];
+                gr->at[head] |= (uint64_t)1 << gr->strings;
+                if (!ground[i]) {
+                    gr->at[local[nb[i]]] |= (uint64_t)1 << gr->strings;
+                }
+                gr->strings++;
+            }
+        }
+    }
+
+    return strings;
+}
+
+/*
+ * Work out the nimstring value of the position in g for the player to
+ * move, spending at most budget seconds and remembering component values
+ * in m. Each part of the board not yet taken is split off as strings (free
+ * edges) and coins (boxes), valued on its own through m and the values nim
+ * summed, so nothing like a whole game tree is searched.
+ *
+ * Returns 1 (and leaves res alone) if the board has too many boxes to look
+ * at, otherwise 0. res->components must be freed.
+ */
+int
+nimstring(struct game *g, double budget, struct nim_memo *m,
+        struct nim_result *res)
+{
+    struct nim_search n;
+    struct nim_component *c;
+    struct graph gr;
+    struct timespec start, stop;
+    long boxes = (long)g->height * g->width, cap = 16, b;
+    long *queue;
+    int *local;
+    char *seen;
+    uint64_t mask;
+
+    if (boxes > NIM_MAX_BOXES) {
+        return 1;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->components = malloc(cap * sizeof(struct nim_component));
+    res->decided = 1;
+
+    memset(&n, 0, sizeof(n));
+    n.gr = &gr;
+    n.m = m;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    n.deadline = start;
+    n.deadline.tv_sec += (time_t)budget;
+    n.deadline.tv_nsec += (long)((budget - (time_t)budget) * 1e9);
+    if (n.deadline.tv_nsec >= 1000000000L) {
+        n.deadline.tv_sec++;
+        n.deadline.tv_nsec -= 1000000000L;
+    }
+
+    seen = calloc(boxes, 1);
+    local = malloc(boxes * sizeof(int));
+    queue = malloc(boxes * sizeof(long));
+
+    for (b = 0; b < boxes; ++b) {
+        if (seen[b] || box_sides(b % g->width, b / g->width, g) == 4) {
+            continue;
+        }
+
+        if (res->count == cap) {
+            cap *= 2;
+            res->components = realloc(res->components,
+                    cap * sizeof(struct nim_component));
+        }
+        c = &res->components[res->count++];
+        c->strings = build_component(b, seen, local, queue, &gr, g);
+        c->coins = 0;
+        c->value = NIM_UNKNOWN;
+
+        if (c->strings <= NIM_MAX_STRINGS) {
+            c->coins = gr.coins;
+            mask = gr.strings == 64 ? ~(uint64_t)0 :
+                    ((uint64_t)1 << gr.strings) - 1;
+            c->value = capture(&gr, &mask) ? NIM_LOONY : value(&n, mask);
+        }
+
+        if (c->value == NIM_LOONY) {
+            res->loony = 1;
+        } else if (c->value == NIM_UNKNOWN) {
+            res->decided = 0;
+        } else {
+            res->value ^= c->value;
+        }
+    }
+
+    free(seen);
+    free(local);
+    free(queue);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    res->seconds = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+    res->nodes = n.nodes;
+    res->probes = n.probes;
+    res->hits = n.hits;
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#ifndef NIMSTRING_H_
+#define NIMSTRING_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/* Most strings a component can have and still be valued. */
+#define NIM_MAX_STRINGS 64
+
+/* Most boxes a board can have for nimstring to look at it. */
+#define NIM_MAX_BOXES (1L << 22)
+
+/* Component values that aren't nimbers. */
+#define NIM_LOONY (-1)
+#define NIM_UNKNOWN (-2)
+
+/*
+ * One memo slot: a component's canonical key and its value. Used slots
+ * have a key with a bit set somewhere.
+ */
+struct nim_slot {
+    uint64_t key[2];
+    uint32_t value;
+    uint32_t pad;
+};
+
+/*
+ * Component values already worked out. file is a table read from disk and
+ * mapped in (file_cap slots, NULL if there was none) and table holds what
+ * has been worked out since, to be merged into the file on close. Both are
+ * open addressed with a power of two number of slots.
+ */
+struct nim_memo {
+    char *path;
+    struct nim_slot *file;
+    long file_cap;
+    size_t map_len;
+    struct nim_slot *table;
+    long cap;
+    long count;
+};
+
+/*
+ * One independent part of the strings and coins picture of a board, with
+ * its nimstring value, NIM_LOONY if the player to move has just been
+ * offered a loony move in it, or NIM_UNKNOWN if it was too big or time ran
+ * out.
+ */
+struct nim_component {
+    long coins;
+    long strings;
+    int value;
+};
+
+/*
+ * What nimstring found out about a position. value is the nim sum of the
+ * components, which is only meaningful when decided is set and loony is
+ * not. The player to move wins nimstring if loony is set or value is not 0.
+ */
+struct nim_result {
+    struct nim_component *components;
+    long count;
+    int loony;
+    int decided;
+    unsigned value;
+    long nodes;
+    long probes;
+    long hits;
+    double seconds;
+};
+
+void nim_memo_open(struct nim_memo *m, char const *path);
+void nim_memo_close(struct nim_memo *m);
+int nimstring(struct game *g, double budget, struct nim_memo *m,
+        struct nim_result *res);
+
+#endif
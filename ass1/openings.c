@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "book.h"
+#include "solver.h"
+
+/* Boards the book covers when none are named. */
+static char const *standard_sizes[] = { "3x3", "4x4", "5x5" };
+
+/*
+ * One opening to solve: the moves that lead to it from an empty height by
+ * width board, and what the solver made of it once it has been.
+ */
+struct position {
+    int height;
+    int width;
+    int plies;
+    long *moves;
+    struct book_entry entry;
+    int solved;
+};
+
+/*
+ * Everything about a run. Positions are handed out to the workers by
+ * bumping next. seen is an open addressed index into positions by key, with
+ * -1 for empty slots, used to keep only one of each set of positions that
+ * are the same up to symmetry.
+ */
+struct builder {
+    struct position *positions;
+    long count;
+    long cap;
+    long *seen;
+    long seen_cap;
+    long next;
+    int players;
+    int plies;
+    double budget;
+    int num_workers;
+};
+
+void usage(void);
+void add_openings(struct builder *b, int height, int width);
+void *run_worker(void *arg);
+
+int
+main(int argc, char **argv)
+{
+    struct builder b;
+    struct book_entry *entries;
+    struct timespec start, stop;
+    pthread_t *threads;
+    char const *path;
+    char extra;
+    long count = 0, exact = 0, i;
+    int opt, h, w;
+    double secs;
+    char *err;
+
+    memset(&b, 0, sizeof(b));
+    b.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    b.players = 2;
+    b.plies = 2;
+    b.budget = 1;
+
+    while ((opt = getopt(argc, argv, "j:d:t:p:")) != -1) {
+        switch (opt) {
+            case 'j':
+                b.num_workers = strtol(optarg, &err, 10);
+                if (*err != '\0' || b.num_workers < 1) {
+                    usage();
+                }
+                break;
+            case 'd':
+                b.plies = strtol(optarg, &err, 10);
+                if (*err != '\0' || b.plies < 0 || b.plies > 16) {
+                    usage();
+                }
+                break;
+            case 't':
+                b.budget = strtod(optarg, &err);
+                if (*err != '\0' || b.budget <= 0) {
+                    usage();
+                }
+                break;
+            case 'p':
+                b.players = strtol(optarg, &err, 10);
+                if (*err != '\0' || b.players < 2 || b.players > 100) {
+                    fprintf(stderr, "Invalid player count\n");
+                    exit(3);
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    if (argc - optind < 1) {
+        usage();
+    }
+    path = argv[optind++];
+
+    for (i = 0; i < (argc > optind ? argc - optind : 3); ++i) {
+        if (sscanf(argc > optind ? argv[optind + i] : standard_sizes[i],
+                "%dx%d%c", &h, &w, &extra) != 2 || h < 2 || w < 2 ||
+                (long)(h + 1) * w + (long)h * (w + 1) > SOLVE_MAX_EDGES) {
+            fprintf(stderr, "Invalid grid dimensions\n");
+            exit(2);
+        }
+        add_openings(&b, h, w);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    threads = malloc(b.num_workers * sizeof(pthread_t));
+    for (i = 0; i < b.num_workers; ++i) {
+        pthread_create(&threads[i], NULL, run_worker, &b);
+    }
+    for (i = 0; i < b.num_workers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    entries = malloc(b.count * sizeof(struct book_entry));
+    for (i = 0; i < b.count; ++i) {
+        if (b.positions[i].solved) {
+            entries[count++] = b.positions[i].entry;
+            exact += b.positions[i].entry.exact;
+        }
+        free(b.positions[i].moves);
+    }
+
+    if (book_write(path, entries, count, b.plies)) {
+        fprintf(stderr, "Can not write opening book\n");
+        exit(4);
+    }
+
+    secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "Solved %ld positions (%ld exact) in %.3fs on %d "
+            "threads\n", count, exact, secs, b.num_workers);
+
+    free(entries);
+    free(threads);
+    free(b.positions);
+    free(b.seen);
+
+    return 0;
+}
+
+/*
+ * Print the usage message and exit.
+ */
+void
+usage(void)
+{
+    fprintf(stderr, "Usage: boxes-book [-j threads] [-d plies] [-t seconds] "
+            "[-p playercount] book [HxW ...]\n");
+    exit(1);
+}
+
+/*
+ * Set g up as the position p leads to.
+ */
+static void
+replay(struct position const *p, struct game *g)
+{
+    int x, y, vertical, i;
+
+    reset_grid(p->height, p->width, g);
+    for (i = 0; i < p->plies; ++i) {
+        edge_coords(p->moves[i], &x, &y, &vertical, g);
+        make_move(x, y, vertical, g);
+    }
+}
+
+/*
+ * Add the position reached by playing e after parent (or the empty board
+ * if parent is NULL) to the ones to solve, unless one the same up to
+ * symmetry is already there. key is its book key.
+ */
+static void
+add_position(struct builder *b, struct position const *parent, long e,
+        int height, int width, uint64_t const *key)
+{
+    struct position *p;
+    long *old = b->seen, old_cap = b->seen_cap, i, j;
+
+    if (2 * (b->count + 1) > b->seen_cap) {
+        b->seen_cap = b->seen_cap ? 2 * b->seen_cap : 1024;
+        b->seen = malloc(b->seen_cap * sizeof(long));
+        memset(b->seen, 0xff, b->seen_cap * sizeof(long));
+        for (i = 0; i < old_cap; ++i) {
+            if (old[i] < 0) {
+                continue;
+            }
+            j = b->positions[old[i]].entry.key[0] & (b->seen_cap - 1);
+            while (b->seen[j] >= 0) {
+                j = (j + 1) & (b->seen_cap - 1);
+            }
+            b->seen[j] = old[i];
+        }
+        free(old);
+    }
+
+    for (j = key[0] & (b->seen_cap - 1); b->seen[j] >= 0;
+            j = (j + 1) & (b->seen_cap - 1)) {
+        p = &b->positions[b->seen[j]];
+        if (p->entry.key[0] == key[0] && p->entry.key[1] == key[1]) {
+            return;
+        }
+    }
+
+    if (b->count == b->cap) {
+        b->cap = b->cap ? 2 * b->cap : 1024;
+        b->positions = realloc(b->positions,
+                b->cap * sizeof(struct position));
+    }
+    p = &b->positions[b->count];
+    memset(p, 0, sizeof(*p));
+    p->height = height;
+    p->width = width;
+    p->plies = parent != NULL ? parent->plies + 1 : 0;
+    p->moves = malloc((p->plies + 1) * sizeof(long));
+    if (parent != NULL) {
+        memcpy(p->moves, parent->moves, parent->plies * sizeof(long));
+        p->moves[parent->plies] = e;
+    }
+    p->entry.key[0] = key[0];
+    p->entry.key[1] = key[1];
+    b->seen[j] = b->count++;
+}
+
+/*
+ * Add every opening of a height by width board up to b's number of plies,
+ * one ply at a time from the empty board, keeping one of each set of
+ * positions that are the same up to symmetry. Finished games are left
+ * out.
+ */
+void
+add_openings(struct builder *b, int height, int width)
+{
+    struct game g = { 0 };
+    struct position parent;
+    uint64_t key[2];
+    long start = b->count, first = b->count, last, i, e, closed[2];
+    int depth, t, n, player;
+
+    g.height = height;
+    g.width = width;
+    g.num_players = b->players;
+    g.possible_closures = (long)height * width;
+    allocate_empty_grid(&g);
+
+    book_key(&g, key, &t);
+    add_position(b, NULL, -1, height, width, key);
+
+    for (depth = 0; depth < b->plies; ++depth) {
+        last = b->count;
+        for (i = first; i < last; ++i) {
+            /* Adding positions can move the array, so work from a copy. */
+            parent = b->positions[i];
+            replay(&parent, &g);
+            player = g.current_player;
+            for (e = next_free_edge(0, &g); e >= 0;
+                    e = next_free_edge(e + 1, &g)) {
+                n = take_edge(e, closed, &g);
+                if (n == 0) {
+                    g.current_player = (player + 1) % g.num_players;
+                }
+                if (!check_game_over(&g)) {
+                    book_key(&g, key, &t);
+                    add_position(b, &parent, e, height, width, key);
+                }
+                untake_edge(e, closed, n, player, &g);
+                g.current_player = player;
+            }
+        }
+        first = last;
+    }
+
+    free_grid(&g);
+    fprintf(stderr, "%dx%d: %ld positions\n", height, width,
+            b->count - start);
+}
+
+/*
+ * Thread body: solve positions until there are none left, each on the
+ * worker's own board, and note the best move in the orientation of the
+ * position's key.
+ */
+void *
+run_worker(void *arg)
+{
+    struct builder *b = arg;
+    struct game g = { 0 };
+    struct solve_result res;
+    struct position *p;
+    uint64_t key[2];
+    long i;
+    int t;
+
+    g.num_players = b->players;
+    while ((i = __sync_fetch_and_add(&b->next, 1)) < b->count) {
+        p = &b->positions[i];
+        replay(p, &g);
+        if (solve(&g, b->budget, &res) || res.best_move < 0) {
+            continue;
+        }
+        book_key(&g, key, &t);
+        p->entry.move = map_edge(t, res.best_move, &g);
+        p->entry.score = res.score;
+        p->entry.exact = res.exact;
+        p->entry.depth = res.depth < 255 ? res.depth : 255;
+        p->solved = 1;
+    }
+    free_grid(&g);
+
+    return NULL;
+}
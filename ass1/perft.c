@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "perft.h"
+
+/*
+ * One thread's share of the count. Threads take root moves off the shared
+ * list one at a time and play each one out on their own copy of the board.
+ */
+struct counter {
+    pthread_t thread;
+    struct game board;
+    long const *roots;
+    long root_count;
+    long *next_root;
+    int depth;
+    struct perft_result res;
+};
+
+static void play(long e, int depth, long free, long *closed,
+        struct perft_result *res, struct game *g);
+
+/*
+ * Add the move sequences depth moves long from g, which has free edges
+ * left, to res, where depth is at least 1. closed has room for two boxes
+ * per move still to go.
+ *
+ * With one move to go and no box on three sides nothing can be captured,
+ * so every free edge is a leaf and they are counted in one go.
+ */
+static void
+count(int depth, long free, long *closed, struct perft_result *res,
+        struct game *g)
+{
+    long e;
+    int last_x = g->last_x, last_y = g->last_y,
+            last_vertical = g->last_vertical;
+
+    if (depth == 1 && g->side_totals[3] == 0) {
+        res->nodes += free;
+        return;
+    }
+
+    for (e = next_free_edge(0, g); e >= 0; e = next_free_edge(e + 1, g)) {
+        play(e, depth, free, closed, res, g);
+    }
+
+    g->last_x = last_x;
+    g->last_y = last_y;
+    g->last_vertical = last_vertical;
+}
+
+/*
+ * Add the sequences starting with edge e of g, which has free edges left,
+ * and going on for depth moves in all to res. depth is never more than
+ * free, so the board only fills on the last move, which is tallied as a
+ * leaf without being made.
+ */
+static void
+play(long e, int depth, long free, long *closed, struct perft_result *res,
+        struct game *g)
+{
+    int n, player = g->current_player;
+
+    if (depth == 1) {
+        n = edge_closes(e, g);
+        res->nodes++;
+        res->captures += n != 0;
+        res->doubles += n == 2;
+        return;
+    }
+
+    n = take_edge(e, closed, g);
+    if (n == 0) {
+        g->current_player = (player + 1) % g->num_players;
+    }
+    count(depth - 1, free - 1, closed + 2, res, g);
+    g->current_player = player;
+    untake_edge(e, closed, n, player, g);
+}
+
+/*
+ * Count everything under root moves until there are none left.
+ */
+static void *
+run_counter(void *arg)
+{
+    struct counter *c = arg;
+    long *closed = malloc(2 * c->depth * sizeof(long)), i;
+
+    while ((i = __sync_fetch_and_add(c->next_root, 1)) < c->root_count) {
+        play(c->roots[i], c->depth, c->root_count, closed, &c->res,
+                &c->board);
+    }
+
+    free(closed);
+
+    return NULL;
+}
+
+/*
+ * Count the move sequences of depth moves from g, with threads threads
+ * sharing out the moves from g between them, and put what was found in
+ * res. Asking for more moves than there are free edges counts the ways
+ * of filling the board. g is left as it was.
+ */
+void
+perft(struct game *g, int depth, int threads, struct perft_result *res)
+{
+    struct timespec start, stop;
+    struct counter *c;
+    long *roots, root_count = 0, next_root = 0, e;
+    int t;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(res, 0, sizeof(*res));
+    res->depth = depth;
+
+    roots = malloc((edge_count(g) + 1) * sizeof(long));
+    for (e = next_free_edge(0, g); e >= 0; e = next_free_edge(e + 1, g)) {
+        roots[root_count++] = e;
+    }
+
+    /* Nothing goes deeper than the board fills up. */
+    if (depth > root_count) {
+        depth = root_count;
+    }
+
+    if (depth == 0) {
+        res->nodes = 1;
+        threads = 0;
+    } else if (threads > root_count) {
+        threads = root_count;
+    }
+
+    c = calloc(threads > 0 ? threads : 1, sizeof(struct counter));
+    for (t = 0; t < threads; ++t) {
+        copy_grid(&c[t].board, g);
+        c[t].roots = roots;
+        c[t].root_count = root_count;
+        c[t].next_root = &next_root;
+        c[t].depth = depth;
+        pthread_create(&c[t].thread, NULL, run_counter, &c[t]);
+    }
+
+    for (t = 0; t < threads; ++t) {
+        pthread_join(c[t].thread, NULL);
+        res->nodes += c[t].res.nodes;
+        res->captures += c[t].res.captures;
+        res->doubles += c[t].res.doubles;
+        free_grid(&c[t].board);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    res->seconds = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+
+    free(c);
+    free(roots);
+}
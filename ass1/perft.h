@@ -0,0 +1,23 @@
+#ifndef PERFT_H_
+#define PERFT_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/*
+ * What perft counted: the move sequences depth moves long from the
+ * position (or shorter ones that fill the board), and how many of their
+ * last moves closed a box and how many closed two.
+ */
+struct perft_result {
+    int depth;
+    uint64_t nodes;
+    uint64_t captures;
+    uint64_t doubles;
+    double seconds;
+};
+
+void perft(struct game *g, int depth, int threads, struct perft_result *res);
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "edgeset.h"
+#include "policy.h"
+
+static char const *const names[NUM_POLICIES] = {
+    "random",
+    "greedy",
+    "safe",
+};
+
+/*
+ * Return the policy called name, or -1 if there isn't one.
+ */
+int
+parse_policy(char const *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_POLICIES; ++i) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Return the name of policy p.
+ */
+char const *
+policy_name(enum policy p)
+{
+    return names[p];
+}
+
+/*
+ * xorshift64*, advancing *state. state must not be 0.
+ */
+uint64_t
+next_rand(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * Fill m with every free edge of g.
+ */
+void
+init_move_list(struct move_list *m, struct game *g)
+{
+    long e, edges = edge_count(g);
+
+    m->edges = malloc(edges * sizeof(long));
+    m->pos = malloc(edges * sizeof(long));
+    m->count = 0;
+
+    for (e = 0; e < edges; ++e) {
+        if (edge_filled(e, g)) {
+            m->pos[e] = -1;
+        } else {
+            m->pos[e] = m->count;
+            m->edges[m->count++] = e;
+        }
+    }
+}
+
+/*
+ * Take edge e out of m.
+ */
+void
+remove_move(struct move_list *m, long e)
+{
+    long last = m->edges[--m->count];
+
+    m->edges[m->pos[e]] = last;
+    m->pos[last] = m->pos[e];
+    m->pos[e] = -1;
+}
+
+/*
+ * Give back what init_move_list got for m.
+ */
+void
+free_move_list(struct move_list *m)
+{
+    free(m->edges);
+    free(m->pos);
+}
+
+/*
+ * Pick a free edge of g (there must be one) from m the way p says to:
+ *
+ * POLICY_RANDOM picks any free edge.
+ * POLICY_GREEDY closes a box if it can and otherwise picks at random.
+ * POLICY_SAFE closes a box if it can, then avoids giving a box a third side
+ *     if it can, and otherwise picks at random.
+ *
+ * The policies that look at edges start g keeping its safe and capturing
+ * edges, so each choice is a single random draw from the right set.
+ */
+long
+choose_move(enum policy p, struct move_list *m, struct game *g,
+        uint64_t *rng)
+{
+    long e = -1;
+
+    if (p != POLICY_RANDOM) {
+        edge_sets_enable(g);
+        e = edge_set_pick(&g->edge_sets->capture, next_rand(rng));
+    }
+    if (e < 0 && p == POLICY_SAFE) {
+        e = edge_set_pick(&g->edge_sets->safe, next_rand(rng));
+    }
+    if (e < 0) {
+        e = m->edges[next_rand(rng) % m->count];
+    }
+
+    return e;
+}
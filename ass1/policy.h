@@ -0,0 +1,35 @@
+#ifndef POLICY_H_
+#define POLICY_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/* The built in ways of picking a move. */
+enum policy {
+    POLICY_RANDOM,
+    POLICY_GREEDY,
+    POLICY_SAFE,
+    NUM_POLICIES,
+};
+
+/*
+ * The free edges of a game in no particular order. pos[e] is where edge e
+ * sits in edges, so removing one is a swap with the last.
+ */
+struct move_list {
+    long *edges;
+    long *pos;
+    long count;
+};
+
+int parse_policy(char const *name);
+char const *policy_name(enum policy p);
+uint64_t next_rand(uint64_t *state);
+void init_move_list(struct move_list *m, struct game *g);
+void remove_move(struct move_list *m, long e);
+void free_move_list(struct move_list *m);
+long choose_move(enum policy p, struct move_list *m, struct game *g,
+        uint64_t *rng);
+
+#endif
@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "profile.h"
+
+/* Histogram buckets: bucket b counts calls of 2^b up to 2^(b+1) ticks. */
+#define NUM_BUCKETS 64
+
+/*
+ * What one probe has seen. Probes can fire on several threads at once, so
+ * everything is added to atomically.
+ */
+struct probe_stats {
+    uint64_t calls;
+    uint64_t ticks;
+    uint64_t max;
+    uint64_t buckets[NUM_BUCKETS];
+};
+
+static char const *probe_names[NUM_PROBES] = {
+    "process_move",
+    "place_edge",
+    "check_closures",
+    "print_grid",
+    "save_game",
+    "read_grid_file",
+};
+
+int profile_enabled;
+
+static struct probe_stats stats[NUM_PROBES];
+
+/* Clock and cycle counter when profiling started, to convert between them. */
+static struct timespec start_time;
+static uint64_t start_ticks;
+
+/*
+ * Start counting from now.
+ */
+void
+profile_start(void)
+{
+    memset(stats, 0, sizeof(stats));
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    start_ticks = profile_clock();
+    profile_enabled = 1;
+}
+
+/*
+ * Count one call to probe that took ticks.
+ */
+void
+profile_record(enum profile_probe probe, uint64_t ticks)
+{
+    struct probe_stats *s = &stats[probe];
+    uint64_t max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->ticks, ticks, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->buckets[63 - __builtin_clzll(ticks | 1)], 1,
+            __ATOMIC_RELAXED);
+    while (ticks > max && !__atomic_compare_exchange_n(&s->max, &max, ticks,
+            1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+ * Return how many ticks of the counter there have been per nanosecond
+ * since profiling started.
+ */
+static double
+ticks_per_ns(void)
+{
+    struct timespec now;
+    uint64_t ticks = profile_clock();
+    double ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start_time.tv_sec) * 1e9 +
+            (now.tv_nsec - start_time.tv_nsec);
+
+    return ns > 0 && ticks > start_ticks ? (ticks - start_ticks) / ns : 1;
+}
+
+/*
+ * Return the top of the histogram bucket s's fraction q of calls fall in
+ * or below, in ticks, or the longest call if that is less.
+ */
+static uint64_t
+quantile(struct probe_stats const *s, double q)
+{
+    uint64_t seen = 0;
+    int b;
+
+    for (b = 0; b < NUM_BUCKETS - 1; ++b) {
+        seen += s->buckets[b];
+        if (seen >= q * s->calls) {
+            break;
+        }
+    }
+
+    return b == NUM_BUCKETS - 1 || (uint64_t)2 << b > s->max ? s->max :
+            (uint64_t)2 << b;
+}
+
+/*
+ * Print a table of what every probe that fired has seen to f, with times
+ * in nanoseconds. The quantiles are the tops of histogram buckets, so they
+ * are only good to within a factor of two.
+ */
+void
+profile_report(FILE *f)
+{
+    double rate = ticks_per_ns();
+    struct probe_stats *s;
+    int i;
+
+    fprintf(f, "%-16s %10s %12s %10s %10s %10s %10s\n", "probe", "calls",
+            "total ms", "mean ns", "p50 ns", "p99 ns", "max ns");
+    for (i = 0; i < NUM_PROBES; ++i) {
+        if ((s = &stats[i])->calls == 0) {
+            continue;
+        }
+        fprintf(f, "%-16s %10" PRIu64 " %12.3f %10.0f %10.0f %10.0f %10.0f\n",
+                probe_names[i], s->calls, s->ticks / rate / 1e6,
+                s->ticks / rate / s->calls, quantile(s, 0.5) / rate,
+                quantile(s, 0.99) / rate, s->max / rate);
+    }
+}
+
+/*
+ * Write what every probe has seen to path as JSON, the same numbers as
+ * profile_report and the non-empty histogram buckets as [top ns, calls]
+ * pairs. Returns 0 if it worked and
+ * -1 if not.
+ */
+int
+profile_write_json(char const *path)
+{
+    double rate = ticks_per_ns();
+    struct probe_stats *s;
+    FILE *f;
+    int i, b, first;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        return -1;
+    }
+
+    fprintf(f, "{\"ticks_per_ns\": %.6f, \"probes\": [", rate);
+    for (i = 0; i < NUM_PROBES; ++i) {
+        s = &stats[i];
+        fprintf(f, "%s\n  {\"name\": \"%s\", \"calls\": %" PRIu64 ", "
+                "\"total_ns\": %.0f, \"mean_ns\": %.0f, \"p50_ns\": %.0f, "
+                "\"p99_ns\": %.0f, \"max_ns\": %.0f, \"histogram\": [",
+                i ? "," : "", probe_names[i], s->calls, s->ticks / rate,
+                s->calls ? s->ticks / rate / s->calls : 0,
+                quantile(s, 0.5) / rate, quantile(s, 0.99) / rate,
+                s->max / rate);
+        for (first = 1, b = 0; b < NUM_BUCKETS; ++b) {
+            if (s->buckets[b] != 0) {
+                fprintf(f, "%s[%.0f, %" PRIu64 "]", first ? "" : ", ",
+                        2.0 * ((uint64_t)1 << b) / rate, s->buckets[b]);
+                first = 0;
+            }
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+
+    return fclose(f) ? -1 : 0;
+}
@@ -0,0 +1,71 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* The places timed when profiling. */
+enum profile_probe {
+    PROBE_PROCESS_MOVE,
+    PROBE_PLACE_EDGE,
+    PROBE_CHECK_CLOSURES,
+    PROBE_PRINT_GRID,
+    PROBE_SAVE_GAME,
+    PROBE_READ_GRID_FILE,
+    NUM_PROBES,
+};
+
+#ifdef BOXES_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+extern int profile_enabled;
+
+/*
+ * Return the cycle counter, or on machines without one that can be read
+ * cheaply the time in nanoseconds.
+ */
+static inline uint64_t
+profile_clock(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/*
+ * Start timing in a function: declares t, which PROFILE_END takes. Both do
+ * nothing unless profile_start has been called.
+ */
+#define PROFILE_BEGIN(t) \
+        uint64_t t = __builtin_expect(profile_enabled, 0) ? profile_clock() : 0
+#define PROFILE_END(probe, t) \
+        do { \
+            if (__builtin_expect(profile_enabled, 0)) { \
+                profile_record((probe), profile_clock() - (t)); \
+            } \
+        } while (0)
+
+void profile_start(void);
+void profile_record(enum profile_probe probe, uint64_t ticks);
+void profile_report(FILE *f);
+int profile_write_json(char const *path);
+
+#else
+
+/* Built without profiling the probes are nothing at all. */
+#define PROFILE_BEGIN(t)
+#define PROFILE_END(probe, t)
+
+#endif
+
+#endif
@@ -0,0 +1,488 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "replay.h"
+
+/* Moves taken on in one go, which bounds the memory used on the side. */
+#define REPLAY_WINDOW (1L << 22)
+
+/* What a move turned out to do, set in its state byte. */
+#define MOVE_ACCEPTED 1
+#define MOVE_CLOSES_BEFORE 2
+#define MOVE_CLOSES_AFTER 4
+
+/*
+ * Window positions of the moves one worker routed to another, in order.
+ * Only the routing worker writes to it.
+ */
+struct queue {
+    uint32_t *items;
+    long count;
+    long cap;
+};
+
+/*
+ * What the moves in one worker's share of a window came to. passes counts
+ * the moves that handed the turn on, and last and last_close are the
+ * newest moves that were made and that closed a box (-1 if none).
+ */
+struct chunk_stats {
+    long accepted;
+    long passes;
+    long closes;
+    long last;
+    long last_close;
+};
+
+/*
+ * A parallel replay. Tile i belongs to worker i % threads, which alone
+ * sets its edges and side counts. A move is sent to the worker with the
+ * tile the edge is in and to the one with the box on its other side, if
+ * that is another tile. That is only the case for the horizontals along
+ * the top row of a tile and the verticals down its left column, and for
+ * those the second worker keeps its own copy of whether they are filled
+ * in seam_h (the row below each tile) and seam_v (the column to its
+ * right). Both see every move on such an edge in order, so they agree
+ * which one filled it.
+ *
+ * Moves are taken window by window: routed into queues[from * threads +
+ * to], applied, counted, then given their players and boxes. player and
+ * left carry the turn and the boxes still open from one window to the
+ * next.
+ */
+struct replay {
+    struct game *g;
+    uint32_t const *moves;
+    long count;
+    int threads;
+    long start;
+    long len;
+    unsigned char *state;
+    struct queue *queues;
+    struct chunk_stats *stats;
+    uint64_t *seam_h;
+    uint64_t *seam_v;
+    int player;
+    long left;
+    long last;
+    int done;
+    struct replay_result *res;
+    pthread_barrier_t barrier;
+};
+
+struct replay_worker {
+    pthread_t thread;
+    struct replay *r;
+    int id;
+    long allocated;
+};
+
+/*
+ * Turn move record rec into its position and direction. Returns 1 if it
+ * is an edge of g and 0 if not.
+ */
+static int
+decode(uint32_t const *rec, int *x, int *y, int *vertical, struct game *g)
+{
+    *y = rec[0] & ~MOVE_VERTICAL;
+    *x = rec[1] & ~MOVE_VERTICAL;
+    *vertical = (rec[1] & MOVE_VERTICAL) != 0;
+
+    return find_edge(*x, *y, *vertical, g) >= 0;
+}
+
+/*
+ * Return the number of the tile holding box (x, y).
+ */
+static long
+tile_index(long x, long y, struct game *g)
+{
+    return (y >> TILE_SHIFT) * g->tiles_w + (x >> TILE_SHIFT);
+}
+
+/*
+ * Return the tile the box before the edge at (x, y) (above a horizontal,
+ * left of a vertical) is in if that isn't the edge's own tile, otherwise
+ * -1.
+ */
+static long
+seam_tile(int x, int y, int vertical, struct game *g)
+{
+    if (vertical && x > 0 && (x & TILE_MASK) == 0) {
+        return tile_index(x - 1, y, g);
+    } else if (!vertical && y > 0 && (y & TILE_MASK) == 0) {
+        return tile_index(x, y - 1, g);
+    }
+
+    return -1;
+}
+
+/*
+ * Return tile i, which must belong to w, allocating it if need be. This
+ * stays off the board's spare tiles and tile count, which aren't w's to
+ * touch.
+ */
+static struct tile *
+own_tile(struct replay_worker *w, long i)
+{
+    struct tile **t = &w->r->g->tiles[i];
+
+    if (*t == NULL) {
+        *t = calloc(1, sizeof(struct tile));
+        w->allocated++;
+    }
+
+    return *t;
+}
+
+/*
+ * Add window position i to q.
+ */
+static void
+push(struct queue *q, uint32_t i)
+{
+    if (q->count == q->cap) {
+        q->cap = q->cap ? 2 * q->cap : 1024;
+        q->items = realloc(q->items, q->cap * sizeof(uint32_t));
+    }
+    q->items[q->count++] = i;
+}
+
+/*
+ * Record what move i of the window did. The byte can be shared with the
+ * worker on the other side of a seam.
+ */
+static void
+mark(struct replay *r, long i, unsigned char bits)
+{
+    __sync_fetch_and_or(&r->state[i], bits);
+}
+
+/*
+ * Send each move in [lo, hi) of the window to the workers it concerns.
+ */
+static void
+route(struct replay_worker *w, long lo, long hi)
+{
+    struct replay *r = w->r;
+    struct queue *out = &r->queues[w->id * r->threads];
+    long i, te, other;
+    int x, y, vertical, d;
+
+    for (d = 0; d < r->threads; ++d) {
+        out[d].count = 0;
+    }
+
+    for (i = lo; i < hi; ++i) {
+        r->state[i - r->start] = 0;
+        if (!decode(&r->moves[2 * i], &x, &y, &vertical, r->g)) {
+            continue;
+        }
+        te = tile_index(x, y, r->g);
+        push(&out[te % r->threads], i - r->start);
+        other = seam_tile(x, y, vertical, r->g);
+        if (other >= 0 && other % r->threads != te % r->threads) {
+            push(&out[other % r->threads], i - r->start);
+        }
+    }
+}
+
+/*
+ * Play move i of the window as far as w's tiles go: fill its edge if the
+ * edge is w's, and count the side on any of w's boxes it borders, noting
+ * each box that it finishes.
+ */
+static void
+apply_move(struct replay_worker *w, long i)
+{
+    struct replay *r = w->r;
+    struct game *g = r->g;
+    long te, b;
+    int x, y, vertical, bx, by, k;
+    uint64_t *row, bit;
+    unsigned char *s;
+
+    decode(&r->moves[2 * (r->start + i)], &x, &y, &vertical, g);
+    te = tile_index(x, y, g);
+
+    if (te % r->threads == w->id) {
+        row = vertical ? &own_tile(w, te)->vedges[y & TILE_MASK] :
+                &own_tile(w, te)->hedges[y & TILE_MASK];
+        bit = (uint64_t)1 << (x & TILE_MASK);
+    } else if (vertical) {
+        row = &r->seam_v[te - 1];
+        bit = (uint64_t)1 << (y & TILE_MASK);
+    } else {
+        row = &r->seam_h[te - g->tiles_w];
+        bit = (uint64_t)1 << (x & TILE_MASK);
+    }
+    if (*row & bit) {
+        return;
+    }
+    *row |= bit;
+    if (te % r->threads == w->id) {
+        mark(r, i, MOVE_ACCEPTED);
+    }
+
+    /* The box before the edge, then the one after it. */
+    for (k = 0; k < 2; ++k) {
+        bx = x - (k == 0 && vertical);
+        by = y - (k == 0 && !vertical);
+        if (bx < 0 || by < 0 || bx >= g->width || by >= g->height ||
+                (b = tile_index(bx, by, g)) % r->threads != w->id) {
+            continue;
+        }
+        s = &own_tile(w, b)->sides[TILE_BOX(bx, by)];
+        if (++*s == 4) {
+            mark(r, i, k == 0 ? MOVE_CLOSES_BEFORE : MOVE_CLOSES_AFTER);
+        }
+    }
+}
+
+/*
+ * Total up what the moves in [lo, hi) of the window did.
+ */
+static void
+count_moves(struct replay_worker *w, long lo, long hi)
+{
+    struct replay *r = w->r;
+    struct chunk_stats *c = &r->stats[w->id];
+    unsigned char s;
+    long i;
+
+    memset(c, 0, sizeof(*c));
+    c->last = c->last_close = -1;
+    for (i = lo; i < hi; ++i) {
+        if (!((s = r->state[i - r->start]) & MOVE_ACCEPTED)) {
+            continue;
+        }
+        c->accepted++;
+        c->last = i;
+        if (s & (MOVE_CLOSES_BEFORE | MOVE_CLOSES_AFTER)) {
+            c->closes += ((s & MOVE_CLOSES_BEFORE) != 0) +
+                    ((s & MOVE_CLOSES_AFTER) != 0);
+            c->last_close = i;
+        } else {
+            c->passes++;
+        }
+    }
+}
+
+/*
+ * Work out who made each move in [lo, hi) of the window, from the turns
+ * handed on before it, and give them the boxes it closed.
+ */
+static void
+assign_boxes(struct replay_worker *w, long lo, long hi)
+{
+    struct replay *r = w->r;
+    struct game *g = r->g;
+    long passes = r->player, i;
+    int x, y, vertical, player, k;
+    unsigned char s;
+
+    for (k = 0; k < w->id; ++k) {
+        passes += r->stats[k].passes;
+    }
+    player = passes % g->num_players;
+
+    for (i = lo; i < hi; ++i) {
+        if (!((s = r->state[i - r->start]) & MOVE_ACCEPTED)) {
+            continue;
+        }
+        if (!(s & (MOVE_CLOSES_BEFORE | MOVE_CLOSES_AFTER))) {
+            player = (player + 1) % g->num_players;
+            continue;
+        }
+        decode(&r->moves[2 * i], &x, &y, &vertical, g);
+        if (s & MOVE_CLOSES_BEFORE) {
+            tile_at(x - vertical, y - !vertical, g)->owners[
+                    TILE_BOX(x - vertical, y - !vertical)] = player + 1;
+        }
+        if (s & MOVE_CLOSES_AFTER) {
+            tile_at(x, y, g)->owners[TILE_BOX(x, y)] = player + 1;
+        }
+    }
+}
+
+/*
+ * Fold the window's totals into the replay and move on to the next one,
+ * unless the game ended in this one or there are no more moves. Nothing
+ * after the move that closes the last box can be made, since the board is
+ * then full, so only the count of rejected moves needs cutting short.
+ */
+static void
+finish_window(struct replay *r)
+{
+    long accepted = 0, passes = 0, closes = 0, last_close = -1, end, i;
+
+    for (i = 0; i < r->threads; ++i) {
+        accepted += r->stats[i].accepted;
+        passes += r->stats[i].passes;
+        closes += r->stats[i].closes;
+        if (r->stats[i].last > r->last) {
+            r->last = r->stats[i].last;
+        }
+        if (r->stats[i].last_close > last_close) {
+            last_close = r->stats[i].last_close;
+        }
+    }
+
+    end = r->start + r->len;
+    if (closes == r->left) {
+        end = last_close + 1;
+        r->done = 1;
+    }
+
+    r->res->applied += accepted;
+    r->res->rejected += end - r->start - accepted;
+    r->player = (r->player + passes) % r->g->num_players;
+    r->left -= closes;
+    r->start += r->len;
+    r->len = r->count - r->start < REPLAY_WINDOW ?
+            r->count - r->start : REPLAY_WINDOW;
+    r->done |= r->len == 0;
+}
+
+/*
+ * Thread body: take the worker's part in each step of each window, with
+ * every worker waiting for the rest between steps.
+ */
+static void *
+run_worker(void *arg)
+{
+    struct replay_worker *w = arg;
+    struct replay *r = w->r;
+    struct game *g = r->g;
+    struct queue *q;
+    struct tile *t;
+    long lo, hi, i, src;
+    int row;
+
+    /* Take copies of the seams before anybody starts filling edges. */
+    for (i = w->id; i < (long)g->tiles_w * g->tiles_h; i += r->threads) {
+        if (i + g->tiles_w < (long)g->tiles_w * g->tiles_h &&
+                (t = g->tiles[i + g->tiles_w]) != NULL) {
+            r->seam_h[i] = t->hedges[0];
+        }
+        if ((i + 1) % g->tiles_w != 0 && (t = g->tiles[i + 1]) != NULL) {
+            for (row = 0; row < TILE_SIZE; ++row) {
+                r->seam_v[i] |= (t->vedges[row] & 1) << row;
+            }
+        }
+    }
+    pthread_barrier_wait(&r->barrier);
+
+    while (!r->done) {
+        lo = r->start + r->len * w->id / r->threads;
+        hi = r->start + r->len * (w->id + 1) / r->threads;
+
+        route(w, lo, hi);
+        pthread_barrier_wait(&r->barrier);
+
+        for (src = 0; src < r->threads; ++src) {
+            q = &r->queues[src * r->threads + w->id];
+            for (i = 0; i < q->count; ++i) {
+                apply_move(w, q->items[i]);
+            }
+        }
+        pthread_barrier_wait(&r->barrier);
+
+        count_moves(w, lo, hi);
+        pthread_barrier_wait(&r->barrier);
+
+        assign_boxes(w, lo, hi);
+        pthread_barrier_wait(&r->barrier);
+
+        if (w->id == 0) {
+            finish_window(r);
+        }
+        pthread_barrier_wait(&r->barrier);
+    }
+
+    return NULL;
+}
+
+/*
+ * Make the count moves, stored as in binary move files (y, then x with
+ * MOVE_VERTICAL set for verticals), on g using threads threads, skipping
+ * those that aren't on the board or are already filled without using up
+ * the turn, and stopping once the game is over. The board, scores and turn
+ * come out just as if the moves had been made one at a time. g must not
+ * be keeping chains or edge sets.
+ *
+ * Each move only changes its own edge and the two boxes beside it, so the
+ * board is split up by tile between the threads, which fill edges and
+ * count sides at the same time. Who made each move, and so who owns the
+ * boxes it closed, then only depends on which earlier moves closed boxes
+ * and is worked out from running totals. The side counts and everything
+ * derived from them are rebuilt at the end.
+ */
+void
+replay_moves(uint32_t const *moves, long count, int threads,
+        struct replay_result *res, struct game *g)
+{
+    struct replay r;
+    struct replay_worker *workers;
+    long tiles = (long)g->tiles_w * g->tiles_h, allocated = 0, i;
+    int x, y, vertical;
+
+    memset(res, 0, sizeof(*res));
+    memset(&r, 0, sizeof(r));
+    r.g = g;
+    r.moves = moves;
+    r.count = count;
+    r.threads = threads;
+    r.len = count < REPLAY_WINDOW ? count : REPLAY_WINDOW;
+    r.player = g->current_player;
+    r.left = g->possible_closures - g->close_count;
+    r.last = -1;
+    r.res = res;
+    if (r.len == 0 || r.left == 0) {
+        return;
+    }
+
+    r.state = malloc(r.len);
+    r.queues = calloc(threads * threads, sizeof(struct queue));
+    r.stats = calloc(threads, sizeof(struct chunk_stats));
+    r.seam_h = calloc(tiles, sizeof(uint64_t));
+    r.seam_v = calloc(tiles, sizeof(uint64_t));
+    pthread_barrier_init(&r.barrier, NULL, threads);
+
+    workers = calloc(threads, sizeof(struct replay_worker));
+    for (i = 0; i < threads; ++i) {
+        workers[i].r = &r;
+        workers[i].id = i;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+    for (i = 0; i < threads; ++i) {
+        pthread_join(workers[i].thread, NULL);
+        allocated += workers[i].allocated;
+    }
+
+    g->tile_count += allocated;
+    g->current_player = r.player;
+    if (r.last >= 0) {
+        decode(&moves[2 * r.last], &x, &y, &vertical, g);
+        g->last_x = x;
+        g->last_y = y;
+        g->last_vertical = vertical;
+    }
+    memset(g->dirty_rows, 0xff,
+            WORDS_FOR(g->height * 2 + 1) * sizeof(uint64_t));
+    rebuild_counters(g);
+
+    pthread_barrier_destroy(&r.barrier);
+    for (i = 0; i < threads * threads; ++i) {
+        free(r.queues[i].items);
+    }
+    free(workers);
+    free(r.queues);
+    free(r.stats);
+    free(r.seam_h);
+    free(r.seam_v);
+    free(r.state);
+}
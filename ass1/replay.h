@@ -0,0 +1,20 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+
+#include <stdint.h>
+
+#include "board.h"
+
+/*
+ * What replay_moves did: how many moves it made and how many it skipped as
+ * off the board or already filled, up to the end of the game.
+ */
+struct replay_result {
+    long applied;
+    long rejected;
+};
+
+void replay_moves(uint32_t const *moves, long count, int threads,
+        struct replay_result *res, struct game *g);
+
+#endif
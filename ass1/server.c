@@ -0,0 +1,720 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "board.h"
+#include "server.h"
+
+/* Longest line a client may send, newline included. */
+#define CLIENT_LINE 256
+
+/* Clients this far behind on reading what they are sent get dropped. */
+#define OUT_LIMIT (1 << 20)
+
+/*
+ * Longest line play_move sends: "over" and a letter for each of up to 100
+ * winners, with room to spare for the edge and box lines.
+ */
+#define MOVE_LINE (64 + 100 * 2)
+
+/* Matches are carved out of blocks of this many. */
+#define POOL_BLOCK 256
+
+/* Events taken from epoll per wait. */
+#define MAX_EVENTS 256
+
+struct shard;
+
+/*
+ * One connection. Until it makes or joins a game match is NULL. Lines are
+ * gathered in in until they are complete and replies queue up in out until
+ * the socket takes them.
+ */
+struct client {
+    int fd;
+    struct shard *shard;
+    struct match *match;
+    int seat;
+    struct client *next;
+    char in[CLIENT_LINE];
+    size_t in_len;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    int want_out;
+    int closing;
+};
+
+/*
+ * A game being hosted and the clients in it. taken[p] is set once player p
+ * has a client, and play starts when every seat has been filled. Free
+ * matches are chained through next_free.
+ */
+struct match {
+    long id;
+    int live;
+    struct game g;
+    struct client *clients;
+    unsigned char taken[100];
+    int seated;
+    struct match *next_free;
+};
+
+/*
+ * One event loop and the games it owns. A game only ever gets touched by
+ * the thread running its shard, and clients are handed over through
+ * handoff to the shard of the game they join, so there is no locking.
+ *
+ * Game ids are local * num_shards + shard, where local numbers the match
+ * within the shard's pool.
+ */
+struct shard {
+    int id;
+    int epfd;
+    int handoff[2];
+    pthread_t thread;
+    struct server *server;
+    struct match **blocks;
+    long block_count;
+    struct match *free_matches;
+};
+
+struct server {
+    int listen_fd;
+    int num_shards;
+    struct shard *shards;
+    long next_shard;
+};
+
+static void flush_client(struct client *c);
+
+/*
+ * Append a line, formatted as by printf, to what is waiting to go out to c.
+ * Clients that are already being dropped get nothing.
+ */
+static void
+send_line(struct client *c, char const *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (c->closing) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if (c->out_len + n + 2 > c->out_cap) {
+        c->out_cap = (c->out_len + n + 2) * 2;
+        c->out = realloc(c->out, c->out_cap);
+    }
+
+    va_start(ap, fmt);
+    vsnprintf(c->out + c->out_len, n + 1, fmt, ap);
+    va_end(ap);
+
+    c->out_len += n;
+    c->out[c->out_len++] = '\n';
+}
+
+/*
+ * Stop talking to c. The socket is shut down rather than closed so that
+ * epoll reports it and it gets cleaned up through the normal path.
+ */
+static void
+close_client(struct client *c)
+{
+    c->closing = 1;
+    shutdown(c->fd, SHUT_RDWR);
+}
+
+/*
+ * Write as much of what is waiting for c as the socket will take, and ask
+ * epoll to say when it can take more if there is any left.
+ */
+static void
+flush_client(struct client *c)
+{
+    struct epoll_event ev;
+    ssize_t n;
+    size_t done = 0;
+
+    while (done < c->out_len) {
+        n = send(c->fd, c->out + done, c->out_len - done, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_client(c);
+                c->out_len = done = 0;
+            }
+            break;
+        }
+        done += n;
+    }
+
+    memmove(c->out, c->out + done, c->out_len - done);
+    c->out_len -= done;
+
+    if (c->out_len > OUT_LIMIT) {
+        close_client(c);
+    }
+
+    if ((c->out_len > 0) != c->want_out) {
+        c->want_out = c->out_len > 0;
+        ev.events = EPOLLIN | (c->want_out ? EPOLLOUT : 0);
+        ev.data.ptr = c;
+        epoll_ctl(c->shard->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    }
+}
+
+/*
+ * Send the same line to everybody in m.
+ */
+static void
+broadcast(struct match *m, char const *line)
+{
+    struct client *c;
+
+    for (c = m->clients; c != NULL; c = c->next) {
+        send_line(c, "%s", line);
+        flush_client(c);
+    }
+}
+
+/*
+ * Take a free match from s's pool, adding another block of them if it has
+ * run out.
+ */
+static struct match *
+take_match(struct shard *s)
+{
+    struct match *m;
+    long i;
+
+    if (s->free_matches == NULL) {
+        s->blocks = realloc(s->blocks,
+                (s->block_count + 1) * sizeof(struct match *));
+        m = calloc(POOL_BLOCK, sizeof(struct match));
+        s->blocks[s->block_count] = m;
+
+        for (i = POOL_BLOCK - 1; i >= 0; --i) {
+            m[i].id = (s->block_count * POOL_BLOCK + i) *
+                    s->server->num_shards + s->id;
+            m[i].next_free = s->free_matches;
+            s->free_matches = &m[i];
+        }
+        s->block_count++;
+    }
+
+    m = s->free_matches;
+    s->free_matches = m->next_free;
+    m->live = 1;
+
+    return m;
+}
+
+/*
+ * Give m back to s's pool along with its board.
+ */
+static void
+release_match(struct shard *s, struct match *m)
+{
+    free_grid(&m->g);
+    memset(&m->g, 0, sizeof(m->g));
+    memset(m->taken, 0, sizeof(m->taken));
+    m->seated = 0;
+    m->live = 0;
+    m->clients = NULL;
+    m->next_free = s->free_matches;
+    s->free_matches = m;
+}
+
+/*
+ * Return the live match with the given id in s, or NULL if there isn't
+ * one.
+ */
+static struct match *
+find_match(struct shard *s, long id)
+{
+    long local = id / s->server->num_shards;
+    struct match *m;
+
+    if (local < 0 || local >= s->block_count * POOL_BLOCK) {
+        return NULL;
+    }
+
+    m = &s->blocks[local / POOL_BLOCK][local % POOL_BLOCK];
+
+    return m->live ? m : NULL;
+}
+
+/*
+ * Move c over to shard to, which will pick up its unprocessed input from
+ * where this one left off. c must not be touched afterwards.
+ */
+static void
+hand_off(struct client *c, int to)
+{
+    struct shard *target = &c->shard->server->shards[to];
+
+    epoll_ctl(c->shard->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    c->shard = target;
+    if (write(target->handoff[1], &c, sizeof(c)) != sizeof(c)) {
+        fprintf(stderr, "Lost a client in handoff\n");
+        exit(9);
+    }
+}
+
+/*
+ * Put c in seat p of m and start the game if that was the last one.
+ */
+static void
+seat_client(struct match *m, int p, struct client *c)
+{
+    char line[16];
+
+    c->match = m;
+    c->seat = p;
+    c->next = m->clients;
+    m->clients = c;
+    m->taken[p] = 1;
+    m->seated++;
+
+    send_line(c, "game %ld", m->id);
+    send_line(c, "seat %c", p + 'A');
+    flush_client(c);
+
+    if (m->seated == m->g.num_players) {
+        snprintf(line, sizeof(line), "turn %c", m->g.current_player + 'A');
+        broadcast(m, "start");
+        broadcast(m, line);
+    }
+}
+
+/*
+ * Play the move y, x, vertical for c and tell everybody in its game what
+ * happened: the edge, any boxes it closed and then whose turn it is or who
+ * won.
+ */
+static void
+play_move(struct client *c, int y, int x, int vertical)
+{
+    struct match *m = c->match;
+    struct game *g = &m->g;
+    long closed[2], e = find_edge(x, y, vertical, g);
+    char line[MOVE_LINE];
+    int winners[100], n, i, len;
+
+    if (m->seated != g->num_players) {
+        send_line(c, "error waiting for players");
+        return;
+    } else if (check_game_over(g)) {
+        send_line(c, "error game over");
+        return;
+    } else if (c->seat != g->current_player) {
+        send_line(c, "error not your turn");
+        return;
+    } else if (e < 0 || (n = take_edge(e, closed, g)) < 0) {
+        send_line(c, "error bad move");
+        return;
+    }
+
+    snprintf(line, sizeof(line), "edge %d %d %c %c", y, x,
+            vertical ? 'v' : 'h', c->seat + 'A');
+    broadcast(m, line);
+    for (i = 0; i < n; ++i) {
+        snprintf(line, sizeof(line), "box %ld %ld %c", closed[i] / g->width,
+                closed[i] % g->width, c->seat + 'A');
+        broadcast(m, line);
+    }
+
+    if (n == 0) {
+        g->current_player = (g->current_player + 1) % g->num_players;
+    }
+
+    if (check_game_over(g)) {
+        n = find_winners(g, winners);
+        len = snprintf(line, sizeof(line), "over");
+        for (i = 0; i < n; ++i) {
+            len += snprintf(line + len, sizeof(line) - len, " %c",
+                    winners[i] + 'A');
+        }
+    } else {
+        snprintf(line, sizeof(line), "turn %c", g->current_player + 'A');
+    }
+    broadcast(m, line);
+}
+
+/*
+ * Send c the whole board of its game followed by "end", or an error if it
+ * would be more than c can be sent before being dropped. A drawn board is
+ * 2 * height + 1 lines of up to 2 * width + 2 characters, and the scores
+ * take up to 100 more lines.
+ */
+static void
+send_board(struct client *c)
+{
+    struct game *g = &c->match->g;
+    char *text;
+    size_t len;
+    FILE *f;
+
+    if ((2 * (double)g->height + 1) * (2 * (double)g->width + 2) +
+            100 * 32 > OUT_LIMIT - (double)c->out_len) {
+        send_line(c, "error board too large");
+        return;
+    }
+
+    f = open_memstream(&text, &len);
+
+    print_grid(f, g);
+    print_scores(f, g);
+    fclose(f);
+
+    /* print_grid ends every line, so drop the last newline. */
+    send_line(c, "%.*s", (int)len - 1, text);
+    send_line(c, "end");
+    free(text);
+}
+
+/*
+ * Carry out one line from c.
+ *
+ * Returns the shard c has to be handed to if the line is for a game
+ * somewhere else, in which case it is left for that shard to run,
+ * otherwise -1.
+ */
+static int
+run_command(struct client *c, char *line)
+{
+    struct shard *s = c->shard;
+    struct match *m;
+    long h, w, p, id;
+    int x, y, i;
+    char dir, extra;
+
+    if (sscanf(line, "new %ld %ld %ld%c", &h, &w, &p, &extra) == 3) {
+        if (c->match != NULL) {
+            send_line(c, "error already in a game");
+        } else if (h < 2 || h > MAX_DIM || w < 2 || w > MAX_DIM ||
+                p < 2 || p > 100) {
+            send_line(c, "error bad game");
+        } else {
+            m = take_match(s);
+            m->g.height = h;
+            m->g.width = w;
+            m->g.num_players = p;
+            m->g.possible_closures = h * w;
+            allocate_empty_grid(&m->g);
+            seat_client(m, 0, c);
+        }
+    } else if (sscanf(line, "join %ld%c", &id, &extra) == 1) {
+        if (c->match != NULL) {
+            send_line(c, "error already in a game");
+        } else if (id >= 0 && id % s->server->num_shards != s->id) {
+            return id % s->server->num_shards;
+        } else if ((m = find_match(s, id)) == NULL) {
+            send_line(c, "error no such game");
+        } else if (m->seated == m->g.num_players) {
+            send_line(c, "error game full");
+        } else {
+            for (i = 0; m->taken[i]; ++i);
+            seat_client(m, i, c);
+        }
+    } else if (sscanf(line, "move %d %d %c%c", &y, &x, &dir, &extra) == 3 &&
+            (dir == 'h' || dir == 'v')) {
+        if (c->match == NULL) {
+            send_line(c, "error not in a game");
+        } else {
+            play_move(c, y, x, dir == 'v');
+        }
+    } else if (strcmp(line, "board") == 0) {
+        if (c->match == NULL) {
+            send_line(c, "error not in a game");
+        } else {
+            send_board(c);
+        }
+    } else if (strcmp(line, "quit") == 0) {
+        send_line(c, "bye");
+        flush_client(c);
+        close_client(c);
+    } else {
+        send_line(c, "error unknown command");
+    }
+
+    flush_client(c);
+
+    return -1;
+}
+
+/*
+ * Run every complete line waiting in c's input, stopping early if c gets
+ * handed to another shard. A line that fills the whole buffer without
+ * ending gets c dropped.
+ *
+ * Returns 1 if c was handed off, otherwise 0.
+ */
+static int
+process_input(struct client *c)
+{
+    char *nl;
+    size_t used;
+    int to;
+
+    while (!c->closing && (nl = memchr(c->in, '\n', c->in_len)) != NULL) {
+        *nl = '\0';
+        if ((to = run_command(c, c->in)) >= 0) {
+            *nl = '\n';
+            hand_off(c, to);
+            return 1;
+        }
+        used = nl + 1 - c->in;
+        memmove(c->in, nl + 1, c->in_len - used);
+        c->in_len -= used;
+    }
+
+    if (c->in_len == CLIENT_LINE) {
+        send_line(c, "error line too long");
+        flush_client(c);
+        close_client(c);
+    }
+
+    return 0;
+}
+
+/*
+ * Forget about c, giving up its seat (and its game if nobody is left in
+ * it).
+ */
+static void
+drop_client(struct client *c)
+{
+    struct match *m = c->match;
+    struct client **p;
+    char line[16];
+
+    if (m != NULL) {
+        for (p = &m->clients; *p != c; p = &(*p)->next);
+        *p = c->next;
+        m->taken[c->seat] = 0;
+        m->seated--;
+
+        if (m->clients == NULL) {
+            release_match(c->shard, m);
+        } else {
+            snprintf(line, sizeof(line), "left %c", c->seat + 'A');
+            broadcast(m, line);
+        }
+    }
+
+    close(c->fd);
+    free(c->out);
+    free(c);
+}
+
+/*
+ * Read what c has sent and act on it. c is dropped if it hung up.
+ */
+static void
+read_client(struct client *c)
+{
+    ssize_t n = read(c->fd, c->in + c->in_len, CLIENT_LINE - c->in_len);
+
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        drop_client(c);
+        return;
+    } else if (n > 0) {
+        c->in_len += n;
+        process_input(c);
+    }
+}
+
+/*
+ * Start watching c from shard s and run any input it brought with it.
+ */
+static void
+adopt_client(struct shard *s, struct client *c)
+{
+    struct epoll_event ev;
+
+    c->shard = s;
+    c->want_out = c->out_len > 0;
+    ev.events = EPOLLIN | (c->want_out ? EPOLLOUT : 0);
+    ev.data.ptr = c;
+    epoll_ctl(s->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+
+    process_input(c);
+}
+
+/*
+ * Accept every waiting connection, spreading them round robin across the
+ * shards.
+ */
+static void
+accept_clients(struct shard *s)
+{
+    struct server *srv = s->server;
+    struct client *c;
+    int fd;
+
+    while ((fd = accept(srv->listen_fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        c = calloc(1, sizeof(*c));
+        c->fd = fd;
+        c->shard = s;
+
+        if (srv->next_shard == s->id) {
+            adopt_client(s, c);
+        } else if (write(srv->shards[srv->next_shard].handoff[1], &c,
+                sizeof(c)) != sizeof(c)) {
+            fprintf(stderr, "Lost a client in handoff\n");
+            exit(9);
+        }
+        srv->next_shard = (srv->next_shard + 1) % srv->num_shards;
+    }
+}
+
+/*
+ * Adopt every client other shards have passed to s.
+ */
+static void
+take_handoffs(struct shard *s)
+{
+    struct client *c;
+
+    while (read(s->handoff[0], &c, sizeof(c)) == sizeof(c)) {
+        adopt_client(s, c);
+    }
+}
+
+/*
+ * Thread body: run shard arg's event loop forever.
+ */
+static void *
+run_shard(void *arg)
+{
+    struct shard *s = arg;
+    struct epoll_event events[MAX_EVENTS];
+    struct client *c;
+    int n, i;
+
+    while (1) {
+        if ((n = epoll_wait(s->epfd, events, MAX_EVENTS, -1)) < 0) {
+            continue;
+        }
+
+        for (i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &s->server->listen_fd) {
+                accept_clients(s);
+            } else if (events[i].data.ptr == s) {
+                take_handoffs(s);
+            } else {
+                c = events[i].data.ptr;
+                if (events[i].events & EPOLLOUT) {
+                    flush_client(c);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    read_client(c);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Host games for clients connecting to the Unix socket at path, with the
+ * games and clients split across workers threads each running their own
+ * epoll loop. Never returns; exits with status 9 if the socket can't be
+ * set up.
+ *
+ * Clients send lines of:
+ *   new height width players   make a game and sit in its first seat
+ *   join id                    sit in the next free seat of game id
+ *   move y x h|v               play a move in your game
+ *   board                      get the whole board, ending with "end"
+ *   quit                       hang up
+ *
+ * and get back "game id" and "seat P" on sitting down, "start" then
+ * "turn P" once every seat is filled, and for each move "edge y x h|v P",
+ * "box y x P" for every box it closed and then "turn P" or "over P...".
+ * "left P" says a player hung up, freeing their seat. Anything that can't
+ * be done gets "error reason".
+ */
+void
+serve(char const *path, int workers)
+{
+    struct server srv;
+    struct sockaddr_un addr;
+    struct epoll_event ev;
+    struct rlimit rl;
+    int i;
+
+    /* Every client needs a descriptor, so take as many as we can have. */
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Can not open socket\n");
+        exit(9);
+    }
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    srv.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (srv.listen_fd < 0 ||
+            bind(srv.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(srv.listen_fd, SOMAXCONN)) {
+        fprintf(stderr, "Can not open socket\n");
+        exit(9);
+    }
+    fcntl(srv.listen_fd, F_SETFL, fcntl(srv.listen_fd, F_GETFL) | O_NONBLOCK);
+
+    srv.num_shards = workers;
+    srv.next_shard = 0;
+    srv.shards = calloc(workers, sizeof(struct shard));
+
+    for (i = 0; i < workers; ++i) {
+        srv.shards[i].id = i;
+        srv.shards[i].server = &srv;
+        srv.shards[i].epfd = epoll_create1(0);
+        if (pipe(srv.shards[i].handoff)) {
+            fprintf(stderr, "Can not open socket\n");
+            exit(9);
+        }
+        fcntl(srv.shards[i].handoff[0], F_SETFL, O_NONBLOCK);
+
+        ev.events = EPOLLIN;
+        ev.data.ptr = &srv.shards[i];
+        epoll_ctl(srv.shards[i].epfd, EPOLL_CTL_ADD,
+                srv.shards[i].handoff[0], &ev);
+    }
+
+    /* Only the first shard accepts, handing clients out to the rest. */
+    ev.events = EPOLLIN;
+    ev.data.ptr = &srv.listen_fd;
+    epoll_ctl(srv.shards[0].epfd, EPOLL_CTL_ADD, srv.listen_fd, &ev);
+
+    for (i = 1; i < workers; ++i) {
+        pthread_create(&srv.shards[i].thread, NULL, run_shard,
+                &srv.shards[i]);
+    }
+    run_shard(&srv.shards[0]);
+}
@@ -0,0 +1,6 @@
+#ifndef SERVER_H_
+#define SERVER_H_
+
+void serve(char const *path, int workers);
+
+#endif
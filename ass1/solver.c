@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "board.h"
+#include "journal.h"
+#include "solver.h"
+
+/* Transposition table size, as a power of two. */
+#define TT_BITS 20
+#define TT_SIZE (1L << TT_BITS)
+
+/*
+ * Mixed into every key. The empty board hashes to 0, the key every unused
+ * slot has, so without it the empty board would match any empty slot. With
+ * it only a position hashing to the salt itself can, which is as unlikely
+ * as any other collision.
+ */
+#define KEY_SALT 0x5a5a5a5a5a5a5a5aULL
+
+/* Bigger than any margin the solver can see. */
+#define INF 30000
+
+enum bound {
+    BOUND_EXACT,
+    BOUND_LOWER,
+    BOUND_UPPER,
+};
+
+/*
+ * One transposition table slot. key is the canonical hash of the position,
+ * depth how far it was searched (capped at the number of free edges, so an
+ * entry that reached the end of the game is good for any depth) and move
+ * the best edge found, in the canonical orientation.
+ */
+struct tt_entry {
+    uint64_t key;
+    int16_t value;
+    uint16_t depth;
+    uint8_t bound;
+    int32_t move;
+};
+
+/*
+ * Search state. sym[t * edges + e] is where symmetry t sends edge e and
+ * inv[] undoes it. hash[t] is the Zobrist hash of the board as seen through
+ * symmetry t; the smallest of them is the canonical key.
+ *
+ * moves holds one list of candidate edges per ply. Moves are made and taken
+ * back through path, which is sized for the whole game so it never grows.
+ */
+struct solver {
+    struct game *g;
+    long edges;
+    long free_edges;
+    int nsym;
+    int root_player;
+    long *sym;
+    long *inv;
+    uint64_t zobrist[SOLVE_MAX_EDGES];
+    uint64_t player_keys[100];
+    uint64_t hash[8];
+    struct tt_entry *tt;
+    long *moves;
+    struct journal path;
+    long root_best;
+    long nodes;
+    long probes;
+    long hits;
+    struct timespec deadline;
+    int aborted;
+};
+
+/*
+ * splitmix64, good enough to fill the Zobrist tables from a fixed seed.
+ */
+static uint64_t
+next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * Fill in the symmetry tables for the board in s->g.
+ */
+static void
+build_symmetries(struct solver *s)
+{
+    struct game *g = s->g;
+    int t;
+    long e, m;
+
+    s->nsym = symmetry_count(g);
+
+    for (t = 0; t < s->nsym; ++t) {
+        for (e = 0; e < s->edges; ++e) {
+            m = map_edge(t, e, g);
+            s->sym[t * s->edges + e] = m;
+            s->inv[t * s->edges + m] = e;
+        }
+    }
+}
+
+/*
+ * Flip edge e in every symmetric hash.
+ */
+static void
+toggle_hash(struct solver *s, long e)
+{
+    int t;
+
+    for (t = 0; t < s->nsym; ++t) {
+        s->hash[t] ^= s->zobrist[s->sym[t * s->edges + e]];
+    }
+}
+
+/*
+ * Return the canonical key of the current position and put the symmetry
+ * that produced it in *t. With more than two players whose turn it is
+ * matters too, since the side to move is then not always the same team.
+ */
+static uint64_t
+canonical_key(struct solver *s, int *t)
+{
+    uint64_t key = s->hash[0];
+    int i;
+
+    *t = 0;
+    for (i = 1; i < s->nsym; ++i) {
+        if (s->hash[i] < key) {
+            key = s->hash[i];
+            *t = i;
+        }
+    }
+
+    if (s->g->num_players > 2) {
+        key ^= s->player_keys[s->g->current_player];
+    }
+
+    return key ^ KEY_SALT;
+}
+
+/*
+ * Check the clock every so often and give up once the budget is spent.
+ */
+static int
+out_of_time(struct solver *s)
+{
+    struct timespec now;
+
+    if (!s->aborted && (s->nodes & 1023) == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        s->aborted = now.tv_sec > s->deadline.tv_sec ||
+                (now.tv_sec == s->deadline.tv_sec &&
+                now.tv_nsec >= s->deadline.tv_nsec);
+    }
+
+    return s->aborted;
+}
+
+/*
+ * Fill the move list for ply with every free edge, hint (if any) first,
+ * then moves that capture, then safe moves, then the rest. Returns the
+ * number of moves.
+ */
+static long
+order_moves(struct solver *s, int ply, long hint)
+{
+    struct game *g = s->g;
+    long *list = s->moves + (long)ply * s->edges, n = 0, e;
+    int pass, x, y, vertical, kind;
+
+    if (hint >= 0) {
+        list[n++] = hint;
+    }
+
+    for (pass = 0; pass < 3; ++pass) {
+        for (e = 0; e < s->edges; ++e) {
+            if (e == hint || edge_filled(e, g)) {
+                continue;
+            }
+            edge_coords(e, &x, &y, &vertical, g);
+            kind = edge_closes(e, g) ? 0 : is_safe_edge(x, y, vertical, g) ?
+                    1 : 2;
+            if (kind == pass) {
+                list[n++] = e;
+            }
+        }
+    }
+
+    return n;
+}
+
+/*
+ * Negamax with alpha-beta over the next depth edges. Returns the margin the
+ * side to move can get over everybody else from the boxes taken in that
+ * window. With more than two players the other players are treated as a
+ * single team that plays against whoever was to move at the root.
+ */
+static int
+search(struct solver *s, int depth, int alpha, int beta, int ply)
+{
+    struct game *g = s->g;
+    struct tt_entry *slot;
+    long *list, n, i, best_move = -1, hint = -1;
+    int t, d, closed, player, v, best = -INF, alpha0 = alpha;
+    uint64_t key;
+
+    if (s->free_edges == 0 || depth == 0) {
+        return 0;
+    }
+
+    ++s->nodes;
+    if (out_of_time(s)) {
+        return 0;
+    }
+
+    /* Anything searched to the end of the game is good for any depth. */
+    d = depth < s->free_edges ? depth : s->free_edges;
+    key = canonical_key(s, &t);
+    slot = &s->tt[key & (TT_SIZE - 1)];
+    ++s->probes;
+    if (slot->key == key) {
+        ++s->hits;
+        hint = s->inv[t * s->edges + slot->move];
+        if (edge_filled(hint, g)) {
+            hint = -1;
+        }
+        if (slot->depth >= d && ply > 0) {
+            if (slot->bound == BOUND_EXACT) {
+                return slot->value;
+            } else if (slot->bound == BOUND_LOWER && slot->value > alpha) {
+                alpha = slot->value;
+            } else if (slot->bound == BOUND_UPPER && slot->value < beta) {
+                beta = slot->value;
+            }
+            if (alpha >= beta) {
+                return slot->value;
+            }
+        }
+    }
+
+    n = order_moves(s, ply, hint);
+    list = s->moves + (long)ply * s->edges;
+
+    for (i = 0; i < n; ++i) {
+        player = g->current_player;
+        closed = journal_make(&s->path, list[i], g);
+        toggle_hash(s, list[i]);
+        s->free_edges--;
+
+        if (closed) {
+            /* Same player goes again. */
+            v = closed + search(s, depth - 1, alpha - closed, beta - closed,
+                    ply + 1);
+        } else if ((player == s->root_player) ==
+                (g->current_player == s->root_player)) {
+            v = search(s, depth - 1, alpha, beta, ply + 1);
+        } else {
+            v = -search(s, depth - 1, -beta, -alpha, ply + 1);
+        }
+
+        s->free_edges++;
+        toggle_hash(s, list[i]);
+        journal_undo(&s->path, g);
+
+        if (s->aborted) {
+            return 0;
+        }
+
+        if (v > best) {
+            best = v;
+            best_move = list[i];
+            if (v > alpha) {
+                alpha = v;
+            }
+            if (alpha >= beta) {
+                break;
+            }
+        }
+    }
+
+    if (ply == 0) {
+        s->root_best = best_move;
+    }
+
+    slot->key = key;
+    slot->value = best;
+    slot->depth = d;
+    slot->bound = best <= alpha0 ? BOUND_UPPER :
+            best >= beta ? BOUND_LOWER : BOUND_EXACT;
+    slot->move = s->sym[t * s->edges + best_move];
+
+    return best;
+}
+
+/*
+ * Work out the score margin for the side to move in g by iterative
+ * deepening, stopping when the end of the game is reached or budget seconds
+ * have gone by. g is left as it was found.
+ *
+ * Returns 1 (and leaves res alone) if the board is too big to solve,
+ * otherwise 0.
+ */
+int
+solve(struct game *g, double budget, struct solve_result *res)
+{
+    struct solver *s;
+    struct timespec start, stop;
+    uint64_t seed = 0x626f786573ULL;
+    long e;
+    int depth, v, i, last[3];
+
+    if (edge_count(g) > SOLVE_MAX_EDGES) {
+        return 1;
+    }
+
+    /* Making moves moves the last move, so put it back at the end. */
+    last[0] = g->last_x;
+    last[1] = g->last_y;
+    last[2] = g->last_vertical;
+
+    s = calloc(1, sizeof(*s));
+    s->g = g;
+    s->edges = edge_count(g);
+    s->root_player = g->current_player;
+    s->sym = malloc(8 * s->edges * sizeof(long));
+    s->inv = malloc(8 * s->edges * sizeof(long));
+    s->tt = calloc(TT_SIZE, sizeof(struct tt_entry));
+    s->moves = malloc((s->edges + 1) * s->edges * sizeof(long));
+    journal_init(&s->path, s->edges);
+
+    for (e = 0; e < s->edges; ++e) {
+        s->zobrist[e] = next_random(&seed);
+    }
+    for (i = 0; i < 100; ++i) {
+        s->player_keys[i] = next_random(&seed);
+    }
+
+    build_symmetries(s);
+    for (e = 0; e < s->edges; ++e) {
+        if (edge_filled(e, g)) {
+            toggle_hash(s, e);
+        } else {
+            s->free_edges++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    s->deadline = start;
+    s->deadline.tv_sec += (time_t)budget;
+    s->deadline.tv_nsec += (long)((budget - (time_t)budget) * 1e9);
+    if (s->deadline.tv_nsec >= 1000000000L) {
+        s->deadline.tv_sec++;
+        s->deadline.tv_nsec -= 1000000000L;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->best_move = -1;
+    res->exact = s->free_edges == 0;
+
+    for (depth = 1; depth <= s->free_edges; ++depth) {
+        v = search(s, depth, -INF, INF, 0);
+        if (s->aborted) {
+            break;
+        }
+        res->score = v;
+        res->best_move = s->root_best;
+        res->depth = depth;
+        res->exact = depth == s->free_edges;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    res->seconds = (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9;
+    res->nodes = s->nodes;
+    res->tt_probes = s->probes;
+    res->tt_hits = s->hits;
+
+    journal_free(&s->path);
+    free(s->moves);
+    free(s->tt);
+    free(s->inv);
+    free(s->sym);
+    free(s);
+
+    g->last_x = last[0];
+    g->last_y = last[1];
+    g->last_vertical = last[2];
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef SOLVER_H_
+#define SOLVER_H_
+
+#include "board.h"
+
+/* Largest board, in edges, the solver will take on. */
+#define SOLVE_MAX_EDGES 1024
+
+/*
+ * What solve found out about a position. score is the margin, over the
+ * boxes still to be taken, of the side to move over everybody else. It is
+ * exact when the search reached the end of the game, otherwise it is the
+ * result of the deepest iteration that finished in time (moves past that
+ * depth are scored as 0).
+ */
+struct solve_result {
+    int score;
+    int exact;
+    int depth;
+    long best_move;
+    long nodes;
+    long tt_probes;
+    long tt_hits;
+    double seconds;
+};
+
+int solve(struct game *g, double budget, struct solve_result *res);
+
+#endif
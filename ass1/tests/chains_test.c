@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "board.h"
+#include "chains.h"
+#include "journal.h"
+#include "policy.h"
+#include "check.h"
+
+/* Boards tried. */
+#define ROUNDS 150
+
+/*
+ * Put the boxes box b is joined to in its chain in links: the neighbours
+ * with two sides filled that it shares a free edge with. Returns how many.
+ */
+static int
+chain_links(struct game *g, long b, long *links)
+{
+    int x = b % g->width, y = b / g->width, n = 0;
+
+    if (y > 0 && !hedge_filled(x, y, g) && box_sides(x, y - 1, g) == 2) {
+        links[n++] = b - g->width;
+    }
+    if (y < g->height - 1 && !hedge_filled(x, y + 1, g) &&
+            box_sides(x, y + 1, g) == 2) {
+        links[n++] = b + g->width;
+    }
+    if (x > 0 && !vedge_filled(x, y, g) && box_sides(x - 1, y, g) == 2) {
+        links[n++] = b - 1;
+    }
+    if (x < g->width - 1 && !vedge_filled(x + 1, y, g) &&
+            box_sides(x + 1, y, g) == 2) {
+        links[n++] = b + 1;
+    }
+
+    return n;
+}
+
+/*
+ * Find the chains and loops of g by flood fill and check the index agrees
+ * about every box, every chain's length, ends and shape, and how many
+ * there are. Returns whether it did.
+ */
+static int
+check_chains(struct game *g)
+{
+    long boxes = (long)g->width * g->height, *stack, ends[2], links[4];
+    long b, v, label, length, found = 0, top, i;
+    char *seen = calloc(boxes, 1), *used;
+    struct chain *c;
+    int loop, n, ok = 1;
+
+    stack = malloc(boxes * sizeof(long));
+    used = calloc(g->chains->used + 1, 1);
+
+    for (b = 0; b < boxes && ok; ++b) {
+        label = chains_of(b % g->width, b / g->width, g);
+        ok = (box_sides(b % g->width, b / g->width, g) == 2) == (label >= 0);
+        CHECK(ok, "box %ld has %d sides but label %ld", b,
+                box_sides(b % g->width, b / g->width, g), label);
+        if (!ok || label < 0 || seen[b]) {
+            continue;
+        }
+
+        CHECK(ok = !used[label], "chain %ld labels two chains", label);
+        used[label] = 1;
+        found++;
+
+        length = 0;
+        loop = 1;
+        n = 0;
+        seen[b] = 1;
+        stack[0] = b;
+        for (top = 1; top > 0 && ok; ) {
+            v = stack[--top];
+            length++;
+            CHECK(ok = chains_of(v % g->width, v / g->width, g) == label,
+                    "box %ld isn't in chain %ld with box %ld", v, label, b);
+            i = chain_links(g, v, links);
+            /* A chain of one box is both of its own ends. */
+            if (i < 2) {
+                loop = 0;
+                ends[n++ & 1] = v;
+                if (i == 0) {
+                    ends[n++ & 1] = v;
+                }
+            }
+            while (i-- > 0) {
+                if (!seen[links[i]]) {
+                    seen[links[i]] = 1;
+                    stack[top++] = links[i];
+                }
+            }
+        }
+        if (!ok) {
+            break;
+        }
+
+        c = &g->chains->chains[label];
+        CHECK(ok = c->length == length && c->loop == loop,
+                "chain %ld is %ld long (loop %d), flood fill says %ld (%d)",
+                label, c->length, c->loop, length, loop);
+        CHECK(ok = ok && (loop || (c->ends[0] == ends[0] &&
+                c->ends[1] == ends[1]) || (c->ends[0] == ends[1] &&
+                c->ends[1] == ends[0])), "chain %ld has the wrong ends",
+                label);
+    }
+
+    CHECK(!ok || found == g->chains->live,
+            "index has %ld chains, flood fill found %ld", g->chains->live,
+            found);
+
+    free(seen);
+    free(used);
+    free(stack);
+    return ok && found == g->chains->live;
+}
+
+/*
+ * Make random moves, undos and redos on g, with the index kept from part
+ * way through, checking it after each one while it still holds up.
+ */
+int
+main(void)
+{
+    uint64_t rng = 11;
+    struct journal j;
+    struct game g;
+    long edges, step;
+    int round, h, w, r, ok;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        h = 2 + next_rand(&rng) % (round % 25 == 0 ? 100 : 9);
+        w = 2 + next_rand(&rng) % (round % 25 == 0 ? 100 : 9);
+        test_game(h, w, 2, &g);
+        edges = edge_count(&g);
+        journal_init(&j, 0);
+
+        for (step = next_rand(&rng) % 3 * edges / 4; step > 0; --step) {
+            journal_make(&j, next_rand(&rng) % edges, &g);
+        }
+        chains_enable(&g);
+        ok = check_chains(&g);
+
+        for (step = 0; step < 3 * edges && ok; ++step) {
+            r = next_rand(&rng) % 10;
+            if (r < 3) {
+                journal_undo(&j, &g);
+            } else if (r < 4) {
+                journal_redo(&j, &g);
+            } else {
+                journal_make(&j, next_rand(&rng) % edges, &g);
+            }
+            if (h * w < 400 || step % 97 == 0) {
+                ok = check_chains(&g);
+            }
+        }
+
+        journal_free(&j);
+        free_grid(&g);
+    }
+
+    return test_report("chains");
+}
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "board.h"
+#include "policy.h"
+#include "check.h"
+
+int failures;
+
+/*
+ * Set g up as an empty height by width game for players players.
+ */
+void
+test_game(int height, int width, int players, struct game *g)
+{
+    memset(g, 0, sizeof(*g));
+    g->height = height;
+    g->width = width;
+    g->num_players = players;
+    g->possible_closures = (long)height * width;
+    allocate_empty_grid(g);
+}
+
+/*
+ * Return the numbers 0 to n - 1 in an order shuffled by rng.
+ */
+long *
+test_shuffle(uint64_t *rng, long n)
+{
+    long *order = malloc(n * sizeof(long)), i, j, t;
+
+    for (i = 0; i < n; ++i) {
+        order[i] = i;
+    }
+    for (i = n - 1; i > 0; --i) {
+        j = next_rand(rng) % (i + 1);
+        t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+
+    return order;
+}
+
+/*
+ * Make moves moves on g, each on a random free edge, as the players would
+ * with make_move.
+ */
+void
+test_play(uint64_t *rng, long moves, struct game *g)
+{
+    long edges = edge_count(g), *order = test_shuffle(rng, edges), i;
+    int x, y, vertical;
+
+    for (i = 0; i < moves && i < edges; ++i) {
+        edge_coords(order[i], &x, &y, &vertical, g);
+        make_move(x, y, vertical, g);
+    }
+    free(order);
+}
+
+/*
+ * Return whether a and b are the same position: the same board, edges,
+ * owners, scores, whose turn it is and counters, down to the side totals
+ * and safe edge count.
+ */
+int
+same_position(struct game *a, struct game *b)
+{
+    long edges = edge_count(a), e;
+    int x, y, i;
+
+    if (a->height != b->height || a->width != b->width ||
+            a->num_players != b->num_players ||
+            a->current_player != b->current_player ||
+            a->close_count != b->close_count ||
+            a->safe_edges != b->safe_edges ||
+            memcmp(a->side_totals, b->side_totals, sizeof(a->side_totals))) {
+        return 0;
+    }
+    for (e = 0; e < edges; ++e) {
+        if (edge_filled(e, a) != edge_filled(e, b)) {
+            return 0;
+        }
+    }
+    for (y = 0; y < a->height; ++y) {
+        for (x = 0; x < a->width; ++x) {
+            if (box_owner(x, y, a) != box_owner(x, y, b) ||
+                    box_sides(x, y, a) != box_sides(x, y, b)) {
+                return 0;
+            }
+        }
+    }
+    for (i = 0; i < a->num_players; ++i) {
+        if (a->scores[i] != b->scores[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * Say how the test called name went. Returns the exit status for it.
+ */
+int
+test_report(char const *name)
+{
+    if (failures != 0) {
+        fprintf(stderr, "%s: %d failed\n", name, failures);
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
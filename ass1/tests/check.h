@@ -0,0 +1,32 @@
+#ifndef CHECK_H_
+#define CHECK_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "board.h"
+
+/* How many checks have failed so far. */
+extern int failures;
+
+/*
+ * Count a failure, and say where it was and why, unless cond holds. The
+ * reason is formatted as by printf.
+ */
+#define CHECK(cond, ...) \
+        do { \
+            if (!(cond)) { \
+                fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+                fprintf(stderr, __VA_ARGS__); \
+                fputc('\n', stderr); \
+                failures++; \
+            } \
+        } while (0)
+
+void test_game(int height, int width, int players, struct game *g);
+void test_play(uint64_t *rng, long moves, struct game *g);
+long *test_shuffle(uint64_t *rng, long n);
+int same_position(struct game *a, struct game *b);
+int test_report(char const *name);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "board.h"
+#include "policy.h"
+#include "check.h"
+
+/* Boards tried, and how far each is played before it is saved. */
+#define ROUNDS 200
+
+/*
+ * Save g to path in the binary format, load it onto a fresh board and
+ * check nothing was lost.
+ */
+static void
+binary_round_trip(char const *path, struct game *g)
+{
+    struct game back;
+    int fd, status;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd >= 0 && save_binary(fd, 7, g) == 0, "binary save failed");
+    close(fd);
+
+    test_game(g->height, g->width, g->num_players, &back);
+    status = read_grid_file(path, &back);
+    CHECK(status == LOAD_OK, "binary load of %dx%d gave %d", g->height,
+            g->width, status);
+    CHECK(status != LOAD_OK || same_position(g, &back),
+            "binary round trip of %dx%d changed the position", g->height,
+            g->width);
+    CHECK(save_serial(path) == 7, "binary save lost its serial");
+    free_grid(&back);
+}
+
+/*
+ * Save g to path as text, load it onto a fresh board and check nothing was
+ * lost. Then check that every cut short copy of the save, bar the one only
+ * missing its last newline, is turned away as bad contents.
+ */
+static void
+text_round_trip(char const *path, struct game *g)
+{
+    struct game back;
+    FILE *f = fopen(path, "w+");
+    char *data;
+    long len, cut;
+    int status;
+
+    save_game(f, g);
+    len = ftell(f);
+    data = malloc(len);
+    rewind(f);
+    CHECK(fread(data, 1, len, f) == (size_t)len, "text save read back short");
+    fclose(f);
+
+    test_game(g->height, g->width, g->num_players, &back);
+    status = read_grid_file(path, &back);
+    CHECK(status == LOAD_OK, "text load of %dx%d gave %d", g->height,
+            g->width, status);
+    CHECK(status != LOAD_OK || same_position(g, &back),
+            "text round trip of %dx%d changed the position", g->height,
+            g->width);
+
+    for (cut = 0; cut < len - 1 && len < 4096; ++cut) {
+        reset_grid(g->height, g->width, &back);
+        status = read_grid_data(data, cut, &back);
+        CHECK(status == LOAD_CONTENTS, "text save cut to %ld of %ld gave %d",
+                cut, len, status);
+    }
+
+    free(data);
+    free_grid(&back);
+}
+
+/*
+ * Load a big save and then a small one into the same game, as
+ * boxes-analyze does with its workers' boards, and check the board is
+ * just like a fresh one once emptied to the small size and once the small
+ * save is on it.
+ */
+static void
+reuse_after_resize(char const *path, uint64_t *rng)
+{
+    struct game big, small, empty, shared;
+    FILE *f;
+
+    test_game(100, 120, 2, &big);
+    test_play(rng, edge_count(&big) * 2 / 3, &big);
+    test_game(4, 6, 2, &small);
+    test_play(rng, 10, &small);
+    test_game(4, 6, 2, &empty);
+
+    test_game(2, 2, 2, &shared);
+    f = fopen(path, "w");
+    save_game(f, &big);
+    fclose(f);
+    reset_grid(big.height, big.width, &shared);
+    CHECK(read_grid_file(path, &shared) == LOAD_OK, "big save didn't load");
+
+    reset_grid(small.height, small.width, &shared);
+    CHECK(same_position(&empty, &shared),
+            "board emptied to a smaller size isn't like a fresh one");
+
+    f = fopen(path, "w");
+    save_game(f, &small);
+    fclose(f);
+    CHECK(read_grid_file(path, &shared) == LOAD_OK &&
+            same_position(&small, &shared),
+            "small save loaded after a big one came out differently");
+
+    free_grid(&big);
+    free_grid(&small);
+    free_grid(&empty);
+    free_grid(&shared);
+}
+
+int
+main(void)
+{
+    char path[] = "/tmp/boxes-codec-XXXXXX";
+    uint64_t rng = 4;
+    struct game g;
+    int round, h, w, fd;
+
+    if ((fd = mkstemp(path)) < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    for (round = 0; round < ROUNDS; ++round) {
+        /* Mostly small boards, some across several tiles. */
+        h = 2 + next_rand(&rng) % (round % 10 == 0 ? 150 : 9);
+        w = 2 + next_rand(&rng) % (round % 10 == 0 ? 150 : 9);
+        test_game(h, w, 2 + next_rand(&rng) % 4, &g);
+        test_play(&rng, next_rand(&rng) % (edge_count(&g) + 1), &g);
+
+        binary_round_trip(path, &g);
+        text_round_trip(path, &g);
+        free_grid(&g);
+    }
+
+    reuse_after_resize(path, &rng);
+
+    unlink(path);
+    return test_report("codec");
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "edgeset.h"
+#include "journal.h"
+#include "policy.h"
+#include "check.h"
+
+/* Boards tried. */
+#define ROUNDS 150
+
+/*
+ * Return how many sides of box (x, y) are filled, straight from the edges.
+ */
+static int
+sides_of(int x, int y, struct game *g)
+{
+    return hedge_filled(x, y, g) + hedge_filled(x, y + 1, g) +
+            vedge_filled(x, y, g) + vedge_filled(x + 1, y, g);
+}
+
+/*
+ * Check the set s holds together: every edge in it is where pos says and
+ * pos has nothing else. Returns whether it did.
+ */
+static int
+check_set(struct edge_set const *s, long edges, char const *name)
+{
+    long e, members = 0;
+    int ok = 1;
+
+    for (e = 0; e < edges && ok; ++e) {
+        if (s->pos[e] >= 0) {
+            members++;
+            CHECK(ok = s->pos[e] < s->count && s->edges[s->pos[e]] == e,
+                    "%s set has edge %ld in the wrong place", name, e);
+        }
+    }
+    CHECK(ok = ok && members == s->count,
+            "%s set counts %ld edges but has %ld", name, s->count, members);
+
+    return ok;
+}
+
+/*
+ * Work out by looking at every free edge of g which are safe and which
+ * close a box, and check the sets and the safe edge count agree. Returns
+ * whether they did.
+ */
+static int
+check_edge_sets(uint64_t *rng, struct game *g)
+{
+    struct edge_sets *sets = g->edge_sets;
+    long edges = edge_count(g), e, safe = 0;
+    int x, y, vertical, bx[2], by[2], n, i, sides, is_safe, closes, ok = 1;
+
+    ok = check_set(&sets->safe, edges, "safe") &&
+            check_set(&sets->capture, edges, "capture");
+
+    for (e = 0; e < edges && ok; ++e) {
+        is_safe = closes = 0;
+        if (!edge_filled(e, g)) {
+            edge_coords(e, &x, &y, &vertical, g);
+            n = 0;
+            if (vertical) {
+                if (x > 0) {
+                    bx[n] = x - 1;
+                    by[n++] = y;
+                }
+                if (x < g->width) {
+                    bx[n] = x;
+                    by[n++] = y;
+                }
+            } else {
+                if (y > 0) {
+                    bx[n] = x;
+                    by[n++] = y - 1;
+                }
+                if (y < g->height) {
+                    bx[n] = x;
+                    by[n++] = y;
+                }
+            }
+            is_safe = 1;
+            for (i = 0; i < n; ++i) {
+                sides = sides_of(bx[i], by[i], g);
+                is_safe &= sides < 2;
+                closes |= sides == 3;
+            }
+            safe += is_safe;
+        }
+        CHECK(ok = edge_set_has(&sets->safe, e) == is_safe,
+                "edge %ld %s the safe set", e,
+                is_safe ? "missing from" : "wrongly in");
+        if (ok) {
+            CHECK(ok = edge_set_has(&sets->capture, e) == closes,
+                    "edge %ld %s the capture set", e,
+                    closes ? "missing from" : "wrongly in");
+        }
+    }
+
+    CHECK(!ok || g->safe_edges == safe,
+            "safe edge count is %ld, should be %ld", g->safe_edges, safe);
+    if (ok && sets->safe.count > 0) {
+        e = edge_set_pick(&sets->safe, next_rand(rng));
+        CHECK(ok = edge_set_has(&sets->safe, e),
+                "edge %ld picked from the safe set isn't in it", e);
+    }
+
+    return ok && g->safe_edges == safe;
+}
+
+/*
+ * Make random moves, undos and redos on g, with the sets kept from part
+ * way through, checking them after each one while they still hold up.
+ */
+int
+main(void)
+{
+    uint64_t rng = 23;
+    struct journal j;
+    struct game g;
+    long edges, step;
+    int round, h, w, r, ok;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        h = 2 + next_rand(&rng) % (round % 25 == 0 ? 100 : 9);
+        w = 2 + next_rand(&rng) % (round % 25 == 0 ? 100 : 9);
+        test_game(h, w, 2, &g);
+        edges = edge_count(&g);
+        journal_init(&j, 0);
+
+        for (step = next_rand(&rng) % 3 * edges / 4; step > 0; --step) {
+            journal_make(&j, next_rand(&rng) % edges, &g);
+        }
+        edge_sets_enable(&g);
+        ok = check_edge_sets(&rng, &g);
+
+        for (step = 0; step < 3 * edges && ok; ++step) {
+            r = next_rand(&rng) % 10;
+            if (r < 3) {
+                journal_undo(&j, &g);
+            } else if (r < 4) {
+                journal_redo(&j, &g);
+            } else {
+                journal_make(&j, next_rand(&rng) % edges, &g);
+            }
+            if (h * w < 400 || step % 97 == 0) {
+                ok = check_edge_sets(&rng, &g);
+            }
+        }
+
+        journal_free(&j);
+        free_grid(&g);
+    }
+
+    return test_report("edgeset");
+}
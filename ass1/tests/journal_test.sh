@@ -0,0 +1,140 @@
+#!/bin/sh
+#
+# Play random moves, undos and redos through boxes --journal, split over
+# several runs that each end without warning, and check the game comes back
+# with the moves it should have.
+# Some runs also leave half a record on the end of the journal, as a crash
+# in the middle of a write would.
+
+boxes=${BOXES:-./boxes}
+dir=$(mktemp -d /tmp/boxes-journal-XXXXXX) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+for seed in $(seq 1 60); do
+    rm -f "$dir"/*
+    : > "$dir/commands"
+    : > "$dir/expected_moves"
+
+    # Board size, players and snapshot interval go in setup, the commands
+    # in commands and the moves that should be on the board at the end in
+    # expected_moves. A snapshot forgets what could be undone or redone, so
+    # the commands are followed here rather than replayed without a journal.
+    # There are never enough moves to finish the game.
+    awk -v seed="$seed" -v dir="$dir" '
+    function note() {
+        if (++since >= every) {
+            for (i = 0; i < nh; ++i) {
+                base[nb++] = hist[i];
+            }
+            nh = nr = since = 0;
+        }
+    }
+    function taken(m,    i) {
+        for (i = 0; i < nb; ++i) {
+            if (base[i] == m) {
+                return 1;
+            }
+        }
+        for (i = 0; i < nh; ++i) {
+            if (hist[i] == m) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    BEGIN {
+        srand(seed);
+        h = 2 + int(rand() * 5); w = 2 + int(rand() * 5);
+        p = 2 + int(rand() * 2);
+        split("1 2 3 7 1000", intervals, " ");
+        every = intervals[1 + int(rand() * 5)];
+        print h, w, p, every > (dir "/setup");
+        n = int(rand() * (h * (w + 1) + w * (h + 1)) / 2);
+        for (c = 0; c < n; ++c) {
+            r = rand();
+            if (r < 0.15) {
+                m = "u";
+                if (nh > 0) {
+                    redo[nr++] = hist[--nh];
+                    note();
+                }
+            } else if (r < 0.25) {
+                m = "r";
+                if (nr > 0) {
+                    hist[nh++] = redo[--nr];
+                    note();
+                }
+            } else {
+                if (rand() < 0.5) {
+                    m = int(rand() * (h + 1)) " " int(rand() * w) " h";
+                } else {
+                    m = int(rand() * h) " " int(rand() * (w + 1)) " v";
+                }
+                if (!taken(m)) {
+                    hist[nh++] = m;
+                    nr = 0;
+                    note();
+                }
+            }
+            print m > (dir "/commands");
+        }
+        for (i = 0; i < nb; ++i) {
+            print base[i] > (dir "/expected_moves");
+        }
+        for (i = 0; i < nh; ++i) {
+            print hist[i] > (dir "/expected_moves");
+        }
+    }'
+    read h w p every < "$dir/setup"
+
+    total=$(wc -l < "$dir/commands")
+    done=0
+    run=0
+    while [ "$done" -lt "$total" ]; do
+        take=$(( (seed * 7 + run * 13) % 9 + 1 ))
+        sed -n "$((done + 1)),$((done + take))p" "$dir/commands" |
+                "$boxes" --journal "$dir/j" --snapshot-every "$every" \
+                "$h" "$w" "$p" > /dev/null 2>&1
+        if [ $((seed % 3)) -eq 0 ]; then
+            printf 'xx' >> "$dir/j"
+        fi
+        done=$((done + take))
+        run=$((run + 1))
+    done
+
+    echo "w $dir/recovered" | "$boxes" --journal "$dir/j" \
+            --snapshot-every "$every" "$h" "$w" "$p" > /dev/null 2>&1
+    { cat "$dir/expected_moves"; echo "w $dir/expected"; } |
+            "$boxes" "$h" "$w" "$p" > /dev/null 2>&1
+
+    if ! cmp -s "$dir/recovered" "$dir/expected"; then
+        echo "journal: seed $seed (${h}x$w, $p players, every $every)" \
+                "recovered differently" >&2
+        failures=$((failures + 1))
+    fi
+done
+
+# A move turned away after an undo must leave the undone move to be redone,
+# with or without a journal, and across a restart.
+rm -f "$dir"/*
+printf '0 0 h\n0 1 h\nu\n0 0 h\n' |
+        "$boxes" --journal "$dir/j" 2 2 2 > /dev/null 2>&1
+printf 'r\nr\nw %s\n' "$dir/recovered" |
+        "$boxes" --journal "$dir/j" 2 2 2 > /dev/null 2>&1
+printf '0 0 h\n0 1 h\nu\n0 0 h\nr\nr\nw %s\n' "$dir/plain" |
+        "$boxes" 2 2 2 > /dev/null 2>&1
+printf '0 0 h\n0 1 h\nw %s\n' "$dir/expected" |
+        "$boxes" 2 2 2 > /dev/null 2>&1
+for got in recovered plain; do
+    if ! cmp -s "$dir/$got" "$dir/expected"; then
+        echo "journal: redo after a rejected move lost it ($got)" >&2
+        failures=$((failures + 1))
+    fi
+done
+
+if [ "$failures" -ne 0 ]; then
+    echo "journal: $failures failed" >&2
+    exit 1
+fi
+echo "journal: ok"
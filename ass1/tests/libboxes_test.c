@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#include "libboxes.h"
+#include "check.h"
+
+/*
+ * A save held in memory. pos is how far reading has got.
+ */
+struct buffer {
+    char *data;
+    size_t len;
+    size_t pos;
+};
+
+static int
+buffer_write(void *ctx, char const *buf, size_t n)
+{
+    struct buffer *b = ctx;
+
+    b->data = realloc(b->data, b->len + n);
+    memcpy(b->data + b->len, buf, n);
+    b->len += n;
+    return 0;
+}
+
+static long
+buffer_read(void *ctx, char *buf, size_t n)
+{
+    struct buffer *b = ctx;
+
+    if (n > b->len - b->pos) {
+        n = b->len - b->pos;
+    }
+    memcpy(buf, b->data + b->pos, n);
+    b->pos += n;
+    return n;
+}
+
+static int
+failing_write(void *ctx, char const *buf, size_t n)
+{
+    (void)ctx;
+    (void)buf;
+    (void)n;
+    return 1;
+}
+
+static long
+failing_read(void *ctx, char *buf, size_t n)
+{
+    (void)ctx;
+    (void)buf;
+    (void)n;
+    return -1;
+}
+
+/*
+ * Read spaces for ever, so a load has to keep growing its buffer.
+ */
+static long
+endless_read(void *ctx, char *buf, size_t n)
+{
+    (void)ctx;
+    memset(buf, ' ', n);
+    return n;
+}
+
+/*
+ * Check games are only made with the sizes and player counts boxes takes.
+ */
+static void
+check_create(void)
+{
+    struct boxes *b;
+    int status;
+
+    CHECK(boxes_create(1, 5, 2, &status) == NULL &&
+            status == BOXES_DIMENSIONS, "1x5 board made");
+    CHECK(boxes_create(5, MAX_DIM + 1, 2, &status) == NULL &&
+            status == BOXES_DIMENSIONS, "board wider than MAX_DIM made");
+    CHECK(boxes_create(5, 5, 1, &status) == NULL && status == BOXES_PLAYERS,
+            "one player game made");
+    CHECK(boxes_create(5, 5, 101, NULL) == NULL, "101 player game made");
+
+    b = boxes_create(2, 3, 4, &status);
+    CHECK(b != NULL && status == BOXES_OK, "2x3 four player game not made");
+    CHECK(boxes_player(b) == 0 && boxes_score(b, 3) == 0 &&
+            boxes_score(b, 4) == -1 && !boxes_over(b),
+            "new game doesn't start empty with A to move");
+    boxes_destroy(b);
+    boxes_destroy(NULL);
+}
+
+/*
+ * Play a whole 2x2 game, with moves turned away, undos and redos, checking
+ * what each call says and does.
+ */
+static void
+check_play(void)
+{
+    static char const *moves[] = {
+        "0 0 h", "0 1 h", "2 0 h", "2 1 h", "0 0 v", "1 0 v", "0 2 v",
+        "1 2 v", "1 0 h", "0 1 v", "1 1 h", "1 1 v",
+    };
+    struct boxes *b = boxes_create(2, 2, 2, NULL);
+    int winners[2], i, n;
+
+    CHECK(boxes_play(b, "0 0 x") == BOXES_MOVE, "badly formed move taken");
+    CHECK(boxes_play(b, "3 0 h") == BOXES_MOVE, "move off the board taken");
+    CHECK(boxes_undo(b) == BOXES_NOTHING, "undo with no moves worked");
+    CHECK(boxes_play(b, moves[0]) == BOXES_OK, "first move turned away");
+    CHECK(boxes_play(b, moves[0]) == BOXES_MOVE, "filled edge taken again");
+    CHECK(boxes_move(b, 0, 1, 0) == BOXES_OK && boxes_player(b) == 0,
+            "second move didn't pass the turn back to A");
+
+    CHECK(boxes_undo(b) == BOXES_OK && boxes_player(b) == 1,
+            "undo didn't give B the turn back");
+    CHECK(boxes_play(b, moves[0]) == BOXES_MOVE, "filled edge taken again");
+    CHECK(boxes_redo(b) == BOXES_OK && boxes_player(b) == 0,
+            "redo after a move turned away didn't work");
+    CHECK(boxes_redo(b) == BOXES_NOTHING, "redo with nothing undone worked");
+
+    for (i = 2; i < 12; ++i) {
+        CHECK(boxes_play(b, moves[i]) == BOXES_OK, "move %s turned away",
+                moves[i]);
+    }
+    CHECK(boxes_over(b), "game not over with every edge filled");
+    CHECK(boxes_play(b, "0 0 h") == BOXES_OVER, "move after the end taken");
+    CHECK(boxes_score(b, 0) + boxes_score(b, 1) == 4,
+            "scores don't add up to the 4 boxes");
+
+    n = boxes_winners(b, winners);
+    CHECK(n >= 1 && boxes_score(b, winners[0]) >= boxes_score(b, 0) &&
+            boxes_score(b, winners[0]) >= boxes_score(b, 1),
+            "winner hasn't the top score");
+
+    CHECK(boxes_undo(b) == BOXES_OK && !boxes_over(b),
+            "undoing the last move didn't reopen the game");
+    boxes_destroy(b);
+}
+
+/*
+ * Save a game part way through, load it into another and check they
+ * match, and check that bad saves, failed reads and writes and missing
+ * files are reported and leave the game alone.
+ */
+static void
+check_save_load(void)
+{
+    struct buffer save = { NULL, 0, 0 }, copy = { NULL, 0, 0 };
+    struct boxes_io out = { &save, NULL, buffer_write };
+    struct boxes_io in = { &save, buffer_read, NULL };
+    struct boxes_io bad = { NULL, failing_read, failing_write };
+    struct boxes *b = boxes_create(3, 4, 3, NULL);
+    struct boxes *c = boxes_create(3, 4, 3, NULL);
+    int i;
+
+    boxes_play(b, "0 0 h");
+    boxes_play(b, "1 0 h");
+    boxes_play(b, "0 0 v");
+    boxes_play(b, "0 1 v");
+
+    CHECK(boxes_save(b, &out) == BOXES_OK, "save to memory failed");
+    CHECK(boxes_load(c, &in) == BOXES_OK, "load from memory failed");
+    out.ctx = &copy;
+    boxes_save(c, &out);
+    CHECK(copy.len == save.len && memcmp(copy.data, save.data, save.len) == 0,
+            "loaded game saves differently");
+    for (i = 0; i < 3; ++i) {
+        CHECK(boxes_score(c, i) == boxes_score(b, i),
+                "player %c's score changed on loading", 'A' + i);
+    }
+    CHECK(boxes_player(c) == boxes_player(b), "turn changed on loading");
+    CHECK(boxes_undo(c) == BOXES_NOTHING, "loaded game has moves to undo");
+
+    save.data[save.len / 2] = 'x';
+    save.pos = 0;
+    CHECK(boxes_load(c, &in) == BOXES_CONTENTS, "bad save loaded");
+    CHECK(boxes_load(c, &bad) == BOXES_READ, "failed read not reported");
+    CHECK(boxes_save(c, &bad) == BOXES_WRITE, "failed write not reported");
+    CHECK(boxes_print(c, &bad) == BOXES_WRITE, "failed print not reported");
+    CHECK(boxes_load_file(c, "/nonexistent/save") == BOXES_OPEN,
+            "missing file not reported");
+    CHECK(boxes_player(c) == boxes_player(b) &&
+            boxes_score(c, 0) == boxes_score(b, 0),
+            "failed loads changed the game");
+
+    free(save.data);
+    free(copy.data);
+    boxes_destroy(b);
+    boxes_destroy(c);
+}
+
+/*
+ * Check a save too big to fit in memory is reported as a failed read and
+ * leaves the game alone. Address space is limited for this, so it has to
+ * come last.
+ */
+static void
+check_out_of_memory(void)
+{
+    struct boxes_io endless = { NULL, endless_read, NULL };
+    struct boxes *b = boxes_create(2, 2, 2, NULL);
+    struct rlimit limit = { 256L << 20, 256L << 20 };
+
+    boxes_play(b, "0 0 h");
+    if (setrlimit(RLIMIT_AS, &limit) != 0) {
+        return;
+    }
+    CHECK(boxes_load(b, &endless) == BOXES_READ,
+            "load that ran out of memory not reported");
+    CHECK(boxes_player(b) == 1 && boxes_undo(b) == BOXES_OK,
+            "load that ran out of memory changed the game");
+    boxes_destroy(b);
+}
+
+int
+main(void)
+{
+    int status;
+
+    check_create();
+    check_play();
+    check_save_load();
+
+    for (status = 0; status <= BOXES_WRITE; ++status) {
+        CHECK(boxes_message(status) != NULL, "no message for %d", status);
+    }
+    CHECK(strcmp(boxes_message(BOXES_CONTENTS), "Error reading grid contents")
+            == 0, "bad contents message isn't the one boxes prints");
+
+    check_out_of_memory();
+
+    return test_report("libboxes");
+}
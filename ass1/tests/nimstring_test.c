@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "nimstring.h"
+#include "policy.h"
+#include "check.h"
+
+/* Positions tried. */
+#define ROUNDS 150
+
+/* Most edges a board can have for the brute force search to take it. */
+#define BRUTE_MAX_EDGES 24
+
+/*
+ * A board as the brute force search sees it: which edges each box needs,
+ * and whether the player to move wins for each set of filled edges
+ * already worked out (offset by one so 0 means not yet).
+ */
+struct brute {
+    int edges;
+    int boxes;
+    uint32_t box_edges[BRUTE_MAX_EDGES];
+    signed char *memo;
+};
+
+/*
+ * Return whether the player to move wins nimstring from the position with
+ * the edges in filled filled, by trying everything. Closing a box means
+ * moving again, and whoever can't move loses.
+ */
+static int
+brute_wins(struct brute *b, uint32_t filled)
+{
+    int e, i, closed, wins = 0;
+    uint32_t after;
+
+    if (filled == ((uint32_t)1 << b->edges) - 1) {
+        return 0;
+    }
+    if (b->memo[filled] != 0) {
+        return b->memo[filled] - 1;
+    }
+
+    for (e = 0; e < b->edges && !wins; ++e) {
+        if (filled >> e & 1) {
+            continue;
+        }
+        after = filled | (uint32_t)1 << e;
+        for (closed = 0, i = 0; i < b->boxes; ++i) {
+            closed |= (b->box_edges[i] >> e & 1) &&
+                    (after & b->box_edges[i]) == b->box_edges[i];
+        }
+        wins = closed ? brute_wins(b, after) : !brute_wins(b, after);
+    }
+
+    b->memo[filled] = wins + 1;
+    return wins;
+}
+
+/*
+ * Work out whether the player to move in g wins nimstring by brute force.
+ */
+static int
+brute_nimstring(struct game *g)
+{
+    struct brute b;
+    uint32_t filled = 0;
+    int x, y, e, wins;
+
+    b.edges = edge_count(g);
+    b.boxes = g->width * g->height;
+    for (y = 0; y < g->height; ++y) {
+        for (x = 0; x < g->width; ++x) {
+            b.box_edges[y * g->width + x] =
+                    (uint32_t)1 << edge_index(x, y, 0, g) |
+                    (uint32_t)1 << edge_index(x, y + 1, 0, g) |
+                    (uint32_t)1 << edge_index(x, y, 1, g) |
+                    (uint32_t)1 << edge_index(x + 1, y, 1, g);
+        }
+    }
+    for (e = 0; e < b.edges; ++e) {
+        filled |= (uint32_t)edge_filled(e, g) << e;
+    }
+
+    b.memo = calloc((size_t)1 << b.edges, 1);
+    wins = brute_wins(&b, filled);
+    free(b.memo);
+
+    return wins;
+}
+
+/*
+ * Fill a random number of random edges of g without giving anybody the
+ * boxes they close, the way nimstring looks at a board.
+ */
+static void
+fill_randomly(uint64_t *rng, struct game *g)
+{
+    long edges = edge_count(g), n = next_rand(rng) % edges, i, e;
+    int x, y, vertical;
+
+    for (i = 0; i < n; ++i) {
+        e = next_rand(rng) % edges;
+        if (!edge_filled(e, g)) {
+            edge_coords(e, &x, &y, &vertical, g);
+            fill_edge(x, y, vertical, g);
+        }
+    }
+}
+
+int
+main(void)
+{
+    static int const sizes[][2] = { { 2, 2 }, { 2, 3 }, { 3, 2 }, { 3, 3 } };
+    struct nim_result res;
+    struct nim_memo memo;
+    uint64_t rng = 13;
+    struct game g;
+    int round, s, want, got;
+
+    nim_memo_open(&memo, NULL);
+    for (round = 0; round < ROUNDS; ++round) {
+        s = next_rand(&rng) % 4;
+        test_game(sizes[s][0], sizes[s][1], 2, &g);
+        fill_randomly(&rng, &g);
+
+        want = brute_nimstring(&g);
+        nimstring(&g, 60, &memo, &res);
+        got = res.loony || res.value != 0;
+        CHECK(res.decided, "%dx%d position not decided", g.height, g.width);
+        CHECK(!res.decided || got == want,
+                "%dx%d position: nimstring says %s, brute force %s",
+                g.height, g.width, got ? "win" : "loss",
+                want ? "win" : "loss");
+
+        free(res.components);
+        free_grid(&g);
+    }
+    nim_memo_close(&memo);
+
+    return test_report("nimstring");
+}
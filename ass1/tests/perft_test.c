@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "perft.h"
+#include "policy.h"
+#include "check.h"
+
+/* Positions tried. */
+#define ROUNDS 120
+
+/*
+ * Add up in res the move sequences of depth moves from g, trying each on
+ * a fresh copy of the board through make_move. closed is how many boxes
+ * the move that led to g closed.
+ */
+static void
+brute_perft(struct game *g, int depth, long closed, struct perft_result *res)
+{
+    struct game next;
+    long e, edges = edge_count(g);
+    int x, y, vertical;
+
+    if (depth == 0 || check_game_over(g)) {
+        res->nodes++;
+        res->captures += closed > 0;
+        res->doubles += closed == 2;
+        return;
+    }
+
+    for (e = 0; e < edges; ++e) {
+        if (edge_filled(e, g)) {
+            continue;
+        }
+        copy_grid(&next, g);
+        edge_coords(e, &x, &y, &vertical, &next);
+        make_move(x, y, vertical, &next);
+        brute_perft(&next, depth - 1, next.close_count - g->close_count,
+                res);
+        free_grid(&next);
+    }
+}
+
+int
+main(void)
+{
+    struct perft_result want, got, shared;
+    uint64_t rng = 17;
+    struct game g;
+    int round, depth;
+    long edges;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        test_game(2 + next_rand(&rng) % 3, 2 + next_rand(&rng) % 3,
+                2 + next_rand(&rng) % 2, &g);
+        edges = edge_count(&g);
+        test_play(&rng, edges / 2 + next_rand(&rng) % (edges / 2), &g);
+        depth = 1 + next_rand(&rng) % (edges - filled_edges(&g) < 10 ? 6 : 4);
+
+        want.nodes = want.captures = want.doubles = 0;
+        brute_perft(&g, depth, 0, &want);
+        perft(&g, depth, 1, &got);
+        perft(&g, depth, 3, &shared);
+
+        CHECK(got.nodes == want.nodes && got.captures == want.captures &&
+                got.doubles == want.doubles,
+                "%dx%d depth %d: perft counted %llu/%llu/%llu, brute force "
+                "%llu/%llu/%llu", g.height, g.width, depth,
+                (unsigned long long)got.nodes,
+                (unsigned long long)got.captures,
+                (unsigned long long)got.doubles,
+                (unsigned long long)want.nodes,
+                (unsigned long long)want.captures,
+                (unsigned long long)want.doubles);
+        CHECK(shared.nodes == got.nodes && shared.captures == got.captures &&
+                shared.doubles == got.doubles,
+                "%dx%d depth %d: three threads counted differently from one",
+                g.height, g.width, depth);
+        free_grid(&g);
+    }
+
+    return test_report("perft");
+}
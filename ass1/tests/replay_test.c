@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "policy.h"
+#include "replay.h"
+#include "check.h"
+
+/* Boards tried, bar the one big enough to take several windows. */
+#define ROUNDS 40
+
+/*
+ * Return count random moves for g in the binary move file layout. Some are
+ * off the board and, as the board fills, plenty are on filled edges.
+ */
+static uint32_t *
+random_moves(uint64_t *rng, long count, struct game *g)
+{
+    uint32_t *moves = malloc(2 * count * sizeof(uint32_t));
+    long i;
+
+    for (i = 0; i < count; ++i) {
+        moves[2 * i] = next_rand(rng) % (g->height + 2);
+        moves[2 * i + 1] = next_rand(rng) % (g->width + 2);
+        if (next_rand(rng) & 1) {
+            moves[2 * i + 1] |= MOVE_VERTICAL;
+        }
+    }
+
+    return moves;
+}
+
+/*
+ * Make the moves one at a time with make_move, as a sequential replay
+ * does, counting them in res.
+ */
+static void
+replay_one_by_one(uint32_t const *moves, long count, struct replay_result *res,
+        struct game *g)
+{
+    long i;
+
+    res->applied = res->rejected = 0;
+    for (i = 0; i < count && !check_game_over(g); ++i) {
+        if (make_move(moves[2 * i + 1] & ~MOVE_VERTICAL, moves[2 * i],
+                (moves[2 * i + 1] & MOVE_VERTICAL) != 0, g)) {
+            res->rejected++;
+        } else {
+            res->applied++;
+        }
+    }
+}
+
+/*
+ * Replay count random moves on an h by w board one at a time and with
+ * replay_moves on one to four threads, and check they all agree.
+ */
+static void
+compare_replays(uint64_t *rng, int h, int w, long count)
+{
+    struct replay_result want, got;
+    struct game seq, par;
+    int players = 2 + next_rand(rng) % 3, threads;
+    uint32_t *moves;
+
+    test_game(h, w, players, &seq);
+    moves = random_moves(rng, count, &seq);
+    replay_one_by_one(moves, count, &want, &seq);
+
+    for (threads = 1; threads <= 4; ++threads) {
+        test_game(h, w, players, &par);
+        replay_moves(moves, count, threads, &got, &par);
+        CHECK(got.applied == want.applied && got.rejected == want.rejected,
+                "%dx%d on %d threads: %ld applied, %ld rejected, "
+                "one by one %ld and %ld", h, w, threads, got.applied,
+                got.rejected, want.applied, want.rejected);
+        CHECK(same_position(&seq, &par),
+                "%dx%d on %d threads: position differs from one by one",
+                h, w, threads);
+        free_grid(&par);
+    }
+
+    free(moves);
+    free_grid(&seq);
+}
+
+int
+main(void)
+{
+    uint64_t rng = 19;
+    int round, h, w;
+
+    /* Sizes either side of the tile seams, and some far from them. */
+    for (round = 0; round < ROUNDS; ++round) {
+        h = round % 2 ? 60 + next_rand(&rng) % 140 : 2 + next_rand(&rng) % 20;
+        w = round % 3 ? 60 + next_rand(&rng) % 140 : 2 + next_rand(&rng) % 20;
+        compare_replays(&rng, h, w, 3L * h * w + next_rand(&rng) % 1000);
+    }
+    compare_replays(&rng, 1100, 1100, 5000000);
+
+    return test_report("replay");
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "board.h"
+#include "policy.h"
+#include "solver.h"
+#include "check.h"
+
+/* Positions tried. */
+#define ROUNDS 300
+
+/* Most edges a board can have for the brute force search to take it. */
+#define BRUTE_MAX_EDGES 24
+
+/*
+ * A board as the brute force search sees it: which edges each box needs,
+ * and the best margin already worked out for each set of filled edges
+ * (offset by one so 0 means not yet).
+ */
+struct brute {
+    int edges;
+    int boxes;
+    uint32_t box_edges[BRUTE_MAX_EDGES];
+    signed char *memo;
+};
+
+/*
+ * Return how many more boxes the player to move can take than the other
+ * from the position with the edges in filled filled, by trying everything.
+ */
+static int
+brute_margin(struct brute *b, uint32_t filled)
+{
+    int e, i, closed, v, best = -1000;
+    uint32_t after;
+
+    if (filled == ((uint32_t)1 << b->edges) - 1) {
+        return 0;
+    }
+    if (b->memo[filled] != 0) {
+        return b->memo[filled] - 1 - b->boxes;
+    }
+
+    for (e = 0; e < b->edges; ++e) {
+        if (filled >> e & 1) {
+            continue;
+        }
+        after = filled | (uint32_t)1 << e;
+        for (closed = 0, i = 0; i < b->boxes; ++i) {
+            closed += (b->box_edges[i] >> e & 1) &&
+                    (after & b->box_edges[i]) == b->box_edges[i];
+        }
+        v = closed ? closed + brute_margin(b, after) :
+                -brute_margin(b, after);
+        if (v > best) {
+            best = v;
+        }
+    }
+
+    b->memo[filled] = best + 1 + b->boxes;
+    return best;
+}
+
+/*
+ * Work out the margin for the position in g by brute force.
+ */
+static int
+brute_solve(struct game *g)
+{
+    struct brute b;
+    uint32_t filled = 0;
+    int x, y, e, margin;
+
+    b.edges = edge_count(g);
+    b.boxes = g->width * g->height;
+    for (y = 0; y < g->height; ++y) {
+        for (x = 0; x < g->width; ++x) {
+            b.box_edges[y * g->width + x] =
+                    (uint32_t)1 << edge_index(x, y, 0, g) |
+                    (uint32_t)1 << edge_index(x, y + 1, 0, g) |
+                    (uint32_t)1 << edge_index(x, y, 1, g) |
+                    (uint32_t)1 << edge_index(x + 1, y, 1, g);
+        }
+    }
+    for (e = 0; e < b.edges; ++e) {
+        filled |= (uint32_t)edge_filled(e, g) << e;
+    }
+
+    b.memo = calloc((size_t)1 << b.edges, 1);
+    margin = brute_margin(&b, filled);
+    free(b.memo);
+
+    return margin;
+}
+
+int
+main(void)
+{
+    static int const sizes[][2] = { { 2, 2 }, { 2, 3 }, { 3, 2 }, { 3, 3 } };
+    struct solve_result res;
+    uint64_t rng = 7;
+    struct game g;
+    int round, s, want;
+    long edges;
+
+    for (round = 0; round < ROUNDS; ++round) {
+        s = next_rand(&rng) % 4;
+        test_game(sizes[s][0], sizes[s][1], 2, &g);
+        edges = edge_count(&g);
+        test_play(&rng, edges * (3 + next_rand(&rng) % 5) / 10, &g);
+
+        want = brute_solve(&g);
+        solve(&g, 60, &res);
+        CHECK(res.exact, "%dx%d position not solved exactly", g.height,
+                g.width);
+        CHECK(res.score == want, "%dx%d position scored %d, brute force %d",
+                g.height, g.width, res.score, want);
+        free_grid(&g);
+    }
+
+    return test_report("solver");
+}
@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "board.h"
+#include "policy.h"
+
+/*
+ * What one seat's policy got up to over a run. seconds is the time it spent
+ * picking its moves.
+ */
+struct stats {
+    long games;
+    long wins;
+    long ties;
+    long boxes;
+    long moves;
+    double seconds;
+};
+
+/*
+ * Games still to be played by one worker. The owner takes from the bottom
+ * and idle workers steal from the top.
+ */
+struct deque {
+    pthread_mutex_t lock;
+    long *jobs;
+    long top;
+    long bottom;
+};
+
+struct worker {
+    pthread_t thread;
+    int id;
+    struct tournament *t;
+    struct deque jobs;
+    struct stats stats[100];
+};
+
+/*
+ * Everything about a run. Seat i plays policies[i], and in game n seat i is
+ * player (i + n) % players so nobody always goes first.
+ */
+struct tournament {
+    int height;
+    int width;
+    int players;
+    enum policy policies[100];
+    long games;
+    uint64_t seed;
+    int num_workers;
+    struct worker *workers;
+};
+
+void usage(void);
+void play_game(struct tournament *t, long n, struct stats *stats);
+long take_job(struct tournament *t, int self);
+void *run_worker(void *arg);
+void report(struct tournament *t, double seconds);
+
+int
+main(int argc, char **argv)
+{
+    struct tournament t;
+    struct timespec start, stop;
+    char *err;
+    long h, w, games, i;
+    int opt, p;
+
+    memset(&t, 0, sizeof(t));
+    t.num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    t.seed = 1;
+
+    while ((opt = getopt(argc, argv, "j:s:")) != -1) {
+        switch (opt) {
+            case 'j':
+                t.num_workers = strtol(optarg, &err, 10);
+                if (*err != '\0' || t.num_workers < 1) {
+                    usage();
+                }
+                break;
+            case 's':
+                t.seed = strtoull(optarg, &err, 10);
+                if (*err != '\0') {
+                    usage();
+                }
+                break;
+            default:
+                usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+    if (argc < 5) {
+        usage();
+    }
+
+    h = strtol(argv[0], &err, 10);
+    if (*err != '\0' || h < 2 || h > MAX_DIM) {
+        fprintf(stderr, "Invalid grid dimensions\n");
+        exit(2);
+    }
+
+    w = strtol(argv[1], &err, 10);
+    if (*err != '\0' || w < 2 || w > MAX_DIM) {
+        fprintf(stderr, "Invalid grid dimensions\n");
+        exit(2);
+    }
+
+    games = strtol(argv[2], &err, 10);
+    if (*err != '\0' || games < 1) {
+        usage();
+    }
+
+    if (argc - 3 > 100) {
+        fprintf(stderr, "Invalid player count\n");
+        exit(3);
+    }
+
+    for (i = 3; i < argc; ++i) {
+        if ((p = parse_policy(argv[i])) < 0) {
+            fprintf(stderr, "Unknown policy %s\n", argv[i]);
+            exit(4);
+        }
+        t.policies[t.players++] = p;
+    }
+
+    t.height = h;
+    t.width = w;
+    t.games = games;
+    t.seed = t.seed ? t.seed : 1;
+
+    /* Deal the games out round robin, stealing evens things up later. */
+    t.workers = calloc(t.num_workers, sizeof(struct worker));
+    for (i = 0; i < t.num_workers; ++i) {
+        t.workers[i].id = i;
+        t.workers[i].t = &t;
+        pthread_mutex_init(&t.workers[i].jobs.lock, NULL);
+        t.workers[i].jobs.jobs = malloc((games / t.num_workers + 1) *
+                sizeof(long));
+    }
+    for (i = 0; i < games; ++i) {
+        struct deque *d = &t.workers[i % t.num_workers].jobs;
+
+        d->jobs[d->bottom++] = i;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < t.num_workers; ++i) {
+        pthread_create(&t.workers[i].thread, NULL, run_worker,
+                &t.workers[i]);
+    }
+    for (i = 0; i < t.num_workers; ++i) {
+        pthread_join(t.workers[i].thread, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    report(&t, (stop.tv_sec - start.tv_sec) +
+            (stop.tv_nsec - start.tv_nsec) / 1e9);
+
+    return 0;
+}
+
+/*
+ * Print the usage message and exit.
+ */
+void
+usage(void)
+{
+    fprintf(stderr, "Usage: boxes-tournament [-j threads] [-s seed] "
+            "height width games policy policy...\n"
+            "Policies: random greedy safe\n");
+    exit(1);
+}
+
+/*
+ * Return the seconds elapsed on the monotonic clock.
+ */
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Play game number n of t to the end and add how each seat did to stats.
+ * The game's random numbers depend only on the seed and n, so results
+ * don't depend on which worker plays it.
+ */
+void
+play_game(struct tournament *t, long n, struct stats *stats)
+{
+    struct game g;
+    struct move_list moves;
+    uint64_t rng = (t->seed + n) * 0x9e3779b97f4a7c15ULL | 1;
+    int winners[100], count, seat, x, y, vertical, i;
+    double start;
+    long e;
+
+    memset(&g, 0, sizeof(g));
+    g.height = t->height;
+    g.width = t->width;
+    g.num_players = t->players;
+    g.possible_closures = t->height * t->width;
+    allocate_empty_grid(&g);
+    init_move_list(&moves, &g);
+
+    while (!check_game_over(&g)) {
+        seat = (g.current_player + t->players - n % t->players) %
+                t->players;
+
+        start = now();
+        e = choose_move(t->policies[seat], &moves, &g, &rng);
+        stats[seat].seconds += now() - start;
+        stats[seat].moves++;
+
+        edge_coords(e, &x, &y, &vertical, &g);
+        make_move(x, y, vertical, &g);
+        remove_move(&moves, e);
+    }
+
+    count = find_winners(&g, winners);
+    for (i = 0; i < t->players; ++i) {
+        seat = (i + t->players - n % t->players) % t->players;
+        stats[seat].games++;
+        stats[seat].boxes += g.scores[i];
+    }
+    for (i = 0; i < count; ++i) {
+        seat = (winners[i] + t->players - n % t->players) % t->players;
+        if (count == 1) {
+            stats[seat].wins++;
+        } else {
+            stats[seat].ties++;
+        }
+    }
+
+    free_move_list(&moves);
+    free_grid(&g);
+}
+
+/*
+ * Return the next game for worker self to play, from its own deque if it
+ * has any left and otherwise stolen from another. Returns -1 once every
+ * game has been handed out.
+ */
+long
+take_job(struct tournament *t, int self)
+{
+    struct deque *d = &t->workers[self].jobs;
+    long job = -1;
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        job = d->jobs[--d->bottom];
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    for (i = 1; job < 0 && i < t->num_workers; ++i) {
+        d = &t->workers[(self + i) % t->num_workers].jobs;
+        pthread_mutex_lock(&d->lock);
+        if (d->bottom > d->top) {
+            job = d->jobs[d->top++];
+        }
+        pthread_mutex_unlock(&d->lock);
+    }
+
+    return job;
+}
+
+/*
+ * Thread body: play games until there are none left anywhere.
+ */
+void *
+run_worker(void *arg)
+{
+    struct worker *w = arg;
+    long job;
+
+    while ((job = take_job(w->t, w->id)) >= 0) {
+        play_game(w->t, job, w->stats);
+    }
+
+    return NULL;
+}
+
+/*
+ * Merge the workers' stats and print a line per seat plus the totals.
+ */
+void
+report(struct tournament *t, double seconds)
+{
+    struct stats total[100];
+    long moves = 0;
+    int i, j;
+
+    memset(total, 0, sizeof(total));
+    for (i = 0; i < t->num_workers; ++i) {
+        for (j = 0; j < t->players; ++j) {
+            total[j].games += t->workers[i].stats[j].games;
+            total[j].wins += t->workers[i].stats[j].wins;
+            total[j].ties += t->workers[i].stats[j].ties;
+            total[j].boxes += t->workers[i].stats[j].boxes;
+            total[j].moves += t->workers[i].stats[j].moves;
+            total[j].seconds += t->workers[i].stats[j].seconds;
+        }
+    }
+
+    printf("%-4s %-8s %8s %8s %8s %7s %10s %12s\n", "Seat", "Policy",
+            "Games", "Wins", "Ties", "Win%", "Boxes/game", "Moves/sec");
+    for (j = 0; j < t->players; ++j) {
+        printf("%-4c %-8s %8ld %8ld %8ld %6.1f%% %10.2f %12.0f\n", j + 'A',
+                policy_name(t->policies[j]), total[j].games, total[j].wins,
+                total[j].ties, 100.0 * total[j].wins / total[j].games,
+                (double)total[j].boxes / total[j].games,
+                total[j].seconds > 0 ? total[j].moves / total[j].seconds :
+                0.0);
+        moves += total[j].moves;
+    }
+
+    printf("%ld games, %ld moves in %.3fs on %d threads (%.0f moves/sec)\n",
+            t->games, moves, seconds, t->num_workers,
+            seconds > 0 ? moves / seconds : 0.0);
+}